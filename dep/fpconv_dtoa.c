@@ -0,0 +1,306 @@
+/* Shortest round-trip formatting of doubles, see fpconv_dtoa.h.
+ *
+ * The digit generation is Grisu2: the double and its rounding boundaries are
+ * scaled by a cached power of ten into 64 bit integers, then digits are
+ * generated until the result is inside the boundaries, and the last digit
+ * is adjusted to be the closest to the exact value. */
+
+#include "fpconv_dtoa.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#define FPCONV_FRAC_MASK 0x000FFFFFFFFFFFFFULL
+#define FPCONV_EXP_MASK 0x7FF0000000000000ULL
+#define FPCONV_HIDDEN_BIT 0x0010000000000000ULL
+#define FPCONV_SIGNIFICAND_SIZE 52
+#define FPCONV_EXP_BIAS (1075)
+
+typedef struct fpconvFp {
+    uint64_t f;
+    int e;
+} fpconvFp;
+
+/* Normalized 10^k for k = -348, -340, ..., 340: f * 2^e, f rounded. */
+static const fpconvFp fpconvPowers[] = {
+    {0xfa8fd5a0081c0288ULL, -1220}, /* 1e-348 */
+    {0xbaaee17fa23ebf76ULL, -1193}, /* 1e-340 */
+    {0x8b16fb203055ac76ULL, -1166}, /* 1e-332 */
+    {0xcf42894a5dce35eaULL, -1140}, /* 1e-324 */
+    {0x9a6bb0aa55653b2dULL, -1113}, /* 1e-316 */
+    {0xe61acf033d1a45dfULL, -1087}, /* 1e-308 */
+    {0xab70fe17c79ac6caULL, -1060}, /* 1e-300 */
+    {0xff77b1fcbebcdc4fULL, -1034}, /* 1e-292 */
+    {0xbe5691ef416bd60cULL, -1007}, /* 1e-284 */
+    {0x8dd01fad907ffc3cULL, -980}, /* 1e-276 */
+    {0xd3515c2831559a83ULL, -954}, /* 1e-268 */
+    {0x9d71ac8fada6c9b5ULL, -927}, /* 1e-260 */
+    {0xea9c227723ee8bcbULL, -901}, /* 1e-252 */
+    {0xaecc49914078536dULL, -874}, /* 1e-244 */
+    {0x823c12795db6ce57ULL, -847}, /* 1e-236 */
+    {0xc21094364dfb5637ULL, -821}, /* 1e-228 */
+    {0x9096ea6f3848984fULL, -794}, /* 1e-220 */
+    {0xd77485cb25823ac7ULL, -768}, /* 1e-212 */
+    {0xa086cfcd97bf97f4ULL, -741}, /* 1e-204 */
+    {0xef340a98172aace5ULL, -715}, /* 1e-196 */
+    {0xb23867fb2a35b28eULL, -688}, /* 1e-188 */
+    {0x84c8d4dfd2c63f3bULL, -661}, /* 1e-180 */
+    {0xc5dd44271ad3cdbaULL, -635}, /* 1e-172 */
+    {0x936b9fcebb25c996ULL, -608}, /* 1e-164 */
+    {0xdbac6c247d62a584ULL, -582}, /* 1e-156 */
+    {0xa3ab66580d5fdaf6ULL, -555}, /* 1e-148 */
+    {0xf3e2f893dec3f126ULL, -529}, /* 1e-140 */
+    {0xb5b5ada8aaff80b8ULL, -502}, /* 1e-132 */
+    {0x87625f056c7c4a8bULL, -475}, /* 1e-124 */
+    {0xc9bcff6034c13053ULL, -449}, /* 1e-116 */
+    {0x964e858c91ba2655ULL, -422}, /* 1e-108 */
+    {0xdff9772470297ebdULL, -396}, /* 1e-100 */
+    {0xa6dfbd9fb8e5b88fULL, -369}, /* 1e-92 */
+    {0xf8a95fcf88747d94ULL, -343}, /* 1e-84 */
+    {0xb94470938fa89bcfULL, -316}, /* 1e-76 */
+    {0x8a08f0f8bf0f156bULL, -289}, /* 1e-68 */
+    {0xcdb02555653131b6ULL, -263}, /* 1e-60 */
+    {0x993fe2c6d07b7facULL, -236}, /* 1e-52 */
+    {0xe45c10c42a2b3b06ULL, -210}, /* 1e-44 */
+    {0xaa242499697392d3ULL, -183}, /* 1e-36 */
+    {0xfd87b5f28300ca0eULL, -157}, /* 1e-28 */
+    {0xbce5086492111aebULL, -130}, /* 1e-20 */
+    {0x8cbccc096f5088ccULL, -103}, /* 1e-12 */
+    {0xd1b71758e219652cULL, -77}, /* 1e-4 */
+    {0x9c40000000000000ULL, -50}, /* 1e4 */
+    {0xe8d4a51000000000ULL, -24}, /* 1e12 */
+    {0xad78ebc5ac620000ULL, 3}, /* 1e20 */
+    {0x813f3978f8940984ULL, 30}, /* 1e28 */
+    {0xc097ce7bc90715b3ULL, 56}, /* 1e36 */
+    {0x8f7e32ce7bea5c70ULL, 83}, /* 1e44 */
+    {0xd5d238a4abe98068ULL, 109}, /* 1e52 */
+    {0x9f4f2726179a2245ULL, 136}, /* 1e60 */
+    {0xed63a231d4c4fb27ULL, 162}, /* 1e68 */
+    {0xb0de65388cc8ada8ULL, 189}, /* 1e76 */
+    {0x83c7088e1aab65dbULL, 216}, /* 1e84 */
+    {0xc45d1df942711d9aULL, 242}, /* 1e92 */
+    {0x924d692ca61be758ULL, 269}, /* 1e100 */
+    {0xda01ee641a708deaULL, 295}, /* 1e108 */
+    {0xa26da3999aef774aULL, 322}, /* 1e116 */
+    {0xf209787bb47d6b85ULL, 348}, /* 1e124 */
+    {0xb454e4a179dd1877ULL, 375}, /* 1e132 */
+    {0x865b86925b9bc5c2ULL, 402}, /* 1e140 */
+    {0xc83553c5c8965d3dULL, 428}, /* 1e148 */
+    {0x952ab45cfa97a0b3ULL, 455}, /* 1e156 */
+    {0xde469fbd99a05fe3ULL, 481}, /* 1e164 */
+    {0xa59bc234db398c25ULL, 508}, /* 1e172 */
+    {0xf6c69a72a3989f5cULL, 534}, /* 1e180 */
+    {0xb7dcbf5354e9beceULL, 561}, /* 1e188 */
+    {0x88fcf317f22241e2ULL, 588}, /* 1e196 */
+    {0xcc20ce9bd35c78a5ULL, 614}, /* 1e204 */
+    {0x98165af37b2153dfULL, 641}, /* 1e212 */
+    {0xe2a0b5dc971f303aULL, 667}, /* 1e220 */
+    {0xa8d9d1535ce3b396ULL, 694}, /* 1e228 */
+    {0xfb9b7cd9a4a7443cULL, 720}, /* 1e236 */
+    {0xbb764c4ca7a44410ULL, 747}, /* 1e244 */
+    {0x8bab8eefb6409c1aULL, 774}, /* 1e252 */
+    {0xd01fef10a657842cULL, 800}, /* 1e260 */
+    {0x9b10a4e5e9913129ULL, 827}, /* 1e268 */
+    {0xe7109bfba19c0c9dULL, 853}, /* 1e276 */
+    {0xac2820d9623bf429ULL, 880}, /* 1e284 */
+    {0x80444b5e7aa7cf85ULL, 907}, /* 1e292 */
+    {0xbf21e44003acdd2dULL, 933}, /* 1e300 */
+    {0x8e679c2f5e44ff8fULL, 960}, /* 1e308 */
+    {0xd433179d9c8cb841ULL, 986}, /* 1e316 */
+    {0x9e19db92b4e31ba9ULL, 1013}, /* 1e324 */
+    {0xeb96bf6ebadf77d9ULL, 1039}, /* 1e332 */
+    {0xaf87023b9bf0ee6bULL, 1066}, /* 1e340 */
+};
+
+static const uint32_t fpconvPow10[] = {1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000};
+
+static fpconvFp fpconvNormalize(fpconvFp x) {
+    int shift = __builtin_clzll(x.f);
+    x.f <<= shift;
+    x.e -= shift;
+    return x;
+}
+
+static fpconvFp fpconvMultiply(fpconvFp a, fpconvFp b) {
+    const uint64_t lomask = 0x00000000FFFFFFFFULL;
+    uint64_t ah = a.f >> 32, al = a.f & lomask, bh = b.f >> 32, bl = b.f & lomask;
+    uint64_t ahbl = ah * bl, albh = al * bh, albl = al * bl, ahbh = ah * bh;
+    uint64_t tmp = (ahbl & lomask) + (albh & lomask) + (albl >> 32);
+
+    tmp += 1ULL << 31; /* Round. */
+    fpconvFp r = {ahbh + (ahbl >> 32) + (albh >> 32) + (tmp >> 32), a.e + b.e + 64};
+    return r;
+}
+
+/* The cached power c with -60 <= e(w * c) <= -32 for a normalized w with
+ * exponent 'e', sets *k to the opposite of its decimal exponent. */
+static fpconvFp fpconvCachedPower(int e, int *k) {
+    const double d_1_log2_10 = 0.30102999566398114; /* 1 / lg(10) */
+    double dk = (-61 - e) * d_1_log2_10 + 347;
+    int ik = (int)dk;
+    if (dk - ik > 0.0) ik++;
+
+    unsigned idx = (unsigned)((ik >> 3) + 1);
+    *k = -(-348 + (int)(idx << 3));
+    return fpconvPowers[idx];
+}
+
+/* Move the last digit towards the exact value while staying inside the
+ * boundaries. */
+static void fpconvRound(char *digits, int len, uint64_t delta, uint64_t rest, uint64_t ten_kappa, uint64_t wp_w) {
+    while (rest < wp_w && delta - rest >= ten_kappa &&
+           (rest + ten_kappa < wp_w || wp_w - rest > rest + ten_kappa - wp_w)) {
+        digits[len - 1]--;
+        rest += ten_kappa;
+    }
+}
+
+static int fpconvCountDigits(uint32_t n) {
+    int d = 1;
+    while (d < 10 && n >= fpconvPow10[d]) d++;
+    return d;
+}
+
+static int fpconvGenerateDigits(fpconvFp w, fpconvFp mp, uint64_t delta, char *digits, int *k) {
+    fpconvFp one = {1ULL << -mp.e, mp.e};
+    uint64_t wp_w = mp.f - w.f;
+    uint32_t p1 = (uint32_t)(mp.f >> -one.e);
+    uint64_t p2 = mp.f & (one.f - 1);
+    int kappa = fpconvCountDigits(p1), len = 0;
+
+    while (kappa > 0) {
+        uint32_t div = fpconvPow10[kappa - 1];
+        uint32_t d = p1 / div;
+        p1 %= div;
+        if (d || len) digits[len++] = (char)('0' + d);
+        kappa--;
+
+        uint64_t rest = ((uint64_t)p1 << -one.e) + p2;
+        if (rest <= delta) {
+            *k += kappa;
+            fpconvRound(digits, len, delta, rest, (uint64_t)fpconvPow10[kappa] << -one.e, wp_w);
+            return len;
+        }
+    }
+
+    for (;;) {
+        p2 *= 10;
+        delta *= 10;
+        char d = (char)(p2 >> -one.e);
+        if (d || len) digits[len++] = (char)('0' + d);
+        p2 &= one.f - 1;
+        kappa--;
+        if (p2 < delta) {
+            *k += kappa;
+            fpconvRound(digits, len, delta, p2, one.f, wp_w * (-kappa < 10 ? fpconvPow10[-kappa] : 0));
+            return len;
+        }
+    }
+}
+
+/* Shortest digits of the positive finite 'bits', sets *k so that the value
+ * is digits * 10^k. */
+static int fpconvGrisu2(uint64_t bits, char *digits, int *k) {
+    fpconvFp w, lower, upper;
+    int exp = (int)((bits & FPCONV_EXP_MASK) >> FPCONV_SIGNIFICAND_SIZE);
+
+    if (exp) {
+        w.f = (bits & FPCONV_FRAC_MASK) + FPCONV_HIDDEN_BIT;
+        w.e = exp - FPCONV_EXP_BIAS;
+    } else {
+        w.f = bits & FPCONV_FRAC_MASK;
+        w.e = 1 - FPCONV_EXP_BIAS;
+    }
+
+    /* Boundaries: the half way points to the neighbour doubles, the lower
+     * one is closer when w is a power of two. */
+    upper.f = (w.f << 1) + 1;
+    upper.e = w.e - 1;
+    upper = fpconvNormalize(upper);
+    if (w.f == FPCONV_HIDDEN_BIT) {
+        lower.f = (w.f << 2) - 1;
+        lower.e = w.e - 2;
+    } else {
+        lower.f = (w.f << 1) - 1;
+        lower.e = w.e - 1;
+    }
+    lower.f <<= lower.e - upper.e;
+    lower.e = upper.e;
+
+    fpconvFp c = fpconvCachedPower(upper.e, k);
+    w = fpconvMultiply(fpconvNormalize(w), c);
+    upper = fpconvMultiply(upper, c);
+    lower = fpconvMultiply(lower, c);
+    lower.f++;
+    upper.f--;
+    return fpconvGenerateDigits(w, upper, upper.f - lower.f, digits, k);
+}
+
+/* Lay out 'len' digits worth digits * 10^k like printf("%.17g"). */
+static int fpconvEmit(char *dest, const char *digits, int len, int k) {
+    int exp = len + k - 1, n = 0;
+
+    if (exp < -4 || exp >= 17) {
+        dest[n++] = digits[0];
+        if (len > 1) {
+            dest[n++] = '.';
+            memcpy(dest + n, digits + 1, len - 1);
+            n += len - 1;
+        }
+        dest[n++] = 'e';
+        dest[n++] = exp < 0 ? '-' : '+';
+        if (exp < 0) exp = -exp;
+        if (exp >= 100) dest[n++] = (char)('0' + exp / 100);
+        dest[n++] = (char)('0' + exp / 10 % 10);
+        dest[n++] = (char)('0' + exp % 10);
+    } else if (k >= 0) {
+        memcpy(dest, digits, len);
+        memset(dest + len, '0', k);
+        n = len + k;
+    } else if (exp >= 0) {
+        memcpy(dest, digits, exp + 1);
+        dest[exp + 1] = '.';
+        memcpy(dest + exp + 2, digits + exp + 1, len - exp - 1);
+        n = len + 1;
+    } else {
+        dest[n++] = '0';
+        dest[n++] = '.';
+        memset(dest + n, '0', -exp - 1);
+        n += -exp - 1;
+        memcpy(dest + n, digits, len);
+        n += len;
+    }
+    return n;
+}
+
+/* Print 'value' in 'dest', not null terminated, and return the length. NaN
+ * and infinities are printed as "nan", "inf" and "-inf". */
+int m_fpconv_dtoa(double value, char dest[FPCONV_MAX_CHARS]) {
+    char digits[18];
+    uint64_t bits;
+    int k = 0, len, n = 0;
+
+    memcpy(&bits, &value, sizeof(bits));
+    if ((bits & FPCONV_EXP_MASK) == FPCONV_EXP_MASK) {
+        if (bits & FPCONV_FRAC_MASK) {
+            memcpy(dest, "nan", 3);
+            return 3;
+        }
+        if (bits >> 63) {
+            memcpy(dest, "-inf", 4);
+            return 4;
+        }
+        memcpy(dest, "inf", 3);
+        return 3;
+    }
+
+    if (bits >> 63) dest[n++] = '-';
+    bits &= ~(1ULL << 63);
+    if (bits == 0) {
+        dest[n++] = '0';
+        return n;
+    }
+
+    len = fpconvGrisu2(bits, digits, &k);
+    return n + fpconvEmit(dest + n, digits, len, k);
+}
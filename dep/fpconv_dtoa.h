@@ -0,0 +1,16 @@
+/* Shortest round-trip formatting of doubles.
+ *
+ * m_fpconv_dtoa() prints a decimal string strtod(3) reads back as the same
+ * double, with the least digits but for rare cases where Grisu2 emits one
+ * more (see "Printing Floating-Point Numbers Quickly and Accurately with
+ * Integers", Florian Loitsch, PLDI 2010). The string is laid out like
+ * printf("%.17g"): exponential notation only for exponents below -4 or
+ * above 16, with at least two exponent digits. So "0.1" instead of
+ * "0.10000000000000001", without any call to snprintf(). */
+
+#pragma once
+
+/* Enough for "-1.2345678901234567e-308". */
+#define FPCONV_MAX_CHARS 24
+
+int m_fpconv_dtoa(double value, char dest[FPCONV_MAX_CHARS]);
@@ -0,0 +1,357 @@
+#include "listpack.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define REDISMODULE_API_FUNC(x) (*x)
+extern void *REDISMODULE_API_FUNC(RedisModule_Alloc)(size_t bytes);
+extern void *REDISMODULE_API_FUNC(RedisModule_Realloc)(void *ptr, size_t bytes);
+extern void REDISMODULE_API_FUNC(RedisModule_Free)(void *ptr);
+
+#define lp_malloc RedisModule_Alloc
+#define lp_realloc RedisModule_Realloc
+#define lp_free RedisModule_Free
+
+#define LP_HDR_SIZE 6 /* 32 bit total len + 16 bit number of elements. */
+#define LP_HDR_NUMELE_UNKNOWN UINT16_MAX
+#define LP_EOF 0xFF
+#define LP_MAX_SAFETY_SIZE (1 << 30)
+
+#define LP_ENCODING_6BIT_STR 0x80
+#define LP_ENCODING_6BIT_STR_MASK 0xC0
+#define LP_ENCODING_12BIT_STR 0xE0
+#define LP_ENCODING_12BIT_STR_MASK 0xF0
+#define LP_ENCODING_32BIT_STR 0xF0
+#define LP_ENCODING_32BIT_STR_MASK 0xFF
+
+#define lpGetTotalBytes(p)                                                                 \
+    (((uint32_t)(p)[0] << 0) | ((uint32_t)(p)[1] << 8) | ((uint32_t)(p)[2] << 16) | \
+     ((uint32_t)(p)[3] << 24))
+
+#define lpGetNumElements(p) (((uint32_t)(p)[4] << 0) | ((uint32_t)(p)[5] << 8))
+
+#define lpSetTotalBytes(p, v)                  \
+    do {                                       \
+        (p)[0] = (v)&0xff;                     \
+        (p)[1] = ((v) >> 8) & 0xff;            \
+        (p)[2] = ((v) >> 16) & 0xff;           \
+        (p)[3] = ((v) >> 24) & 0xff;           \
+    } while (0)
+
+#define lpSetNumElements(p, v)      \
+    do {                            \
+        (p)[4] = (v)&0xff;          \
+        (p)[5] = ((v) >> 8) & 0xff; \
+    } while (0)
+
+/* Create a new, empty listpack. 'capacity' is a hint of the number of bytes
+ * that will be needed, the allocation is never smaller than the header. */
+unsigned char *m_lpNew(size_t capacity) {
+    unsigned char *lp = lp_malloc(capacity > LP_HDR_SIZE + 1 ? capacity : LP_HDR_SIZE + 1);
+    lpSetTotalBytes(lp, LP_HDR_SIZE + 1);
+    lpSetNumElements(lp, 0);
+    lp[LP_HDR_SIZE] = LP_EOF;
+    return lp;
+}
+
+void m_lpFree(unsigned char *lp) {
+    lp_free(lp);
+}
+
+size_t m_lpBytes(unsigned char *lp) {
+    return lpGetTotalBytes(lp);
+}
+
+/* Return the number of bytes needed to encode the header of a string entry
+ * of length 'len'. */
+static inline uint32_t lpEncodingSize(uint32_t len) {
+    if (len < 64) return 1;
+    if (len < 4096) return 2;
+    return 5;
+}
+
+static inline void lpEncodeString(unsigned char *buf, uint32_t len) {
+    if (len < 64) {
+        buf[0] = len | LP_ENCODING_6BIT_STR;
+    } else if (len < 4096) {
+        buf[0] = (len >> 8) | LP_ENCODING_12BIT_STR;
+        buf[1] = len & 0xff;
+    } else {
+        buf[0] = LP_ENCODING_32BIT_STR;
+        buf[1] = len & 0xff;
+        buf[2] = (len >> 8) & 0xff;
+        buf[3] = (len >> 16) & 0xff;
+        buf[4] = (len >> 24) & 0xff;
+    }
+}
+
+/* Store a reverse-encoded variable length field representing the length
+ * of the previous element in 'buf'. Returns the number of bytes used, when
+ * 'buf' is NULL just the number of bytes needed is returned. */
+static inline unsigned long lpEncodeBacklen(unsigned char *buf, uint64_t l) {
+    if (l <= 127) {
+        if (buf) buf[0] = l;
+        return 1;
+    } else if (l < 16383) {
+        if (buf) {
+            buf[0] = l >> 7;
+            buf[1] = (l & 127) | 128;
+        }
+        return 2;
+    } else if (l < 2097151) {
+        if (buf) {
+            buf[0] = l >> 14;
+            buf[1] = ((l >> 7) & 127) | 128;
+            buf[2] = (l & 127) | 128;
+        }
+        return 3;
+    } else if (l < 268435455) {
+        if (buf) {
+            buf[0] = l >> 21;
+            buf[1] = ((l >> 14) & 127) | 128;
+            buf[2] = ((l >> 7) & 127) | 128;
+            buf[3] = (l & 127) | 128;
+        }
+        return 4;
+    } else {
+        if (buf) {
+            buf[0] = l >> 28;
+            buf[1] = ((l >> 21) & 127) | 128;
+            buf[2] = ((l >> 14) & 127) | 128;
+            buf[3] = ((l >> 7) & 127) | 128;
+            buf[4] = (l & 127) | 128;
+        }
+        return 5;
+    }
+}
+
+/* Decode the backlen and return it. 'p' points to the last byte of the
+ * backlen field, that is, the byte just before the following entry. */
+static inline uint64_t lpDecodeBacklen(unsigned char *p) {
+    uint64_t val = 0;
+    uint64_t shift = 0;
+    do {
+        val |= (uint64_t)(p[0] & 127) << shift;
+        if (!(p[0] & 128)) break;
+        shift += 7;
+        p--;
+    } while (shift <= 28);
+    return val;
+}
+
+/* Return the length of the string stored at 'p' and set '*hdrlen' to the
+ * size of the encoding header. */
+static inline uint32_t lpDecodeString(unsigned char *p, uint32_t *hdrlen) {
+    if ((p[0] & LP_ENCODING_6BIT_STR_MASK) == LP_ENCODING_6BIT_STR) {
+        *hdrlen = 1;
+        return p[0] & 0x3f;
+    } else if ((p[0] & LP_ENCODING_12BIT_STR_MASK) == LP_ENCODING_12BIT_STR) {
+        *hdrlen = 2;
+        return ((uint32_t)(p[0] & 0xf) << 8) | p[1];
+    } else {
+        assert(p[0] == LP_ENCODING_32BIT_STR);
+        *hdrlen = 5;
+        return (uint32_t)p[1] | ((uint32_t)p[2] << 8) | ((uint32_t)p[3] << 16) | ((uint32_t)p[4] << 24);
+    }
+}
+
+/* Return the total number of bytes used by the entry at 'p',
+ * backlen included. */
+static inline uint32_t lpEntrySize(unsigned char *p) {
+    uint32_t hdrlen;
+    uint32_t len = lpDecodeString(p, &hdrlen);
+    return hdrlen + len + lpEncodeBacklen(NULL, hdrlen + len);
+}
+
+/* Return a pointer to the string stored at 'p' and set '*len' to its
+ * length. */
+unsigned char *m_lpGet(unsigned char *p, uint32_t *len) {
+    uint32_t hdrlen;
+    *len = lpDecodeString(p, &hdrlen);
+    return p + hdrlen;
+}
+
+unsigned char *m_lpFirst(unsigned char *lp) {
+    unsigned char *p = lp + LP_HDR_SIZE;
+    if (p[0] == LP_EOF) return NULL;
+    return p;
+}
+
+unsigned char *m_lpNext(unsigned char *lp, unsigned char *p) {
+    assert(p);
+    p += lpEntrySize(p);
+    assert(p < lp + lpGetTotalBytes(lp));
+    if (p[0] == LP_EOF) return NULL;
+    return p;
+}
+
+unsigned char *m_lpPrev(unsigned char *lp, unsigned char *p) {
+    assert(p);
+    if (p - lp == LP_HDR_SIZE) return NULL;
+    p--; /* Seek the last byte of the previous entry backlen. */
+    uint64_t prevlen = lpDecodeBacklen(p);
+    prevlen += lpEncodeBacklen(NULL, prevlen);
+    return p - prevlen + 1;
+}
+
+unsigned char *m_lpLast(unsigned char *lp) {
+    unsigned char *p = lp + lpGetTotalBytes(lp) - 1; /* Seek EOF element. */
+    return m_lpPrev(lp, p);
+}
+
+unsigned long m_lpLength(unsigned char *lp) {
+    uint32_t numele = lpGetNumElements(lp);
+    if (numele != LP_HDR_NUMELE_UNKNOWN) return numele;
+
+    /* Too many elements inside the listpack. We need to scan in order
+     * to get the total number. */
+    unsigned long count = 0;
+    unsigned char *p = m_lpFirst(lp);
+    while (p) {
+        count++;
+        p = m_lpNext(lp, p);
+    }
+
+    /* If the count is again within range of the header numele field,
+     * set it. */
+    if (count < LP_HDR_NUMELE_UNKNOWN) lpSetNumElements(lp, count);
+    return count;
+}
+
+static inline void lpUpdateNumElements(unsigned char *lp, long delta) {
+    uint32_t numele = lpGetNumElements(lp);
+    if (numele == LP_HDR_NUMELE_UNKNOWN) return;
+    long newnum = (long)numele + delta;
+    if (newnum >= LP_HDR_NUMELE_UNKNOWN) newnum = LP_HDR_NUMELE_UNKNOWN;
+    lpSetNumElements(lp, newnum);
+}
+
+/* Return 1 if adding 'add' bytes to the listpack keeps it within the
+ * safety limit, 0 otherwise. */
+int m_lpSafeToAdd(unsigned char *lp, size_t add) {
+    size_t len = lp ? lpGetTotalBytes(lp) : 0;
+    if (len + add > LP_MAX_SAFETY_SIZE) return 0;
+    return 1;
+}
+
+/* Insert, delete or replace the string element 's' of length 'slen' at the
+ * position 'p'. 'where' is one of LP_BEFORE, LP_AFTER or LP_REPLACE. When
+ * 's' is NULL the element at 'p' is deleted.
+ *
+ * The function returns the new listpack pointer (it may be reallocated),
+ * and if 'newp' is not NULL it is set to the address of the inserted
+ * element, or in case of deletion to the element following the deleted
+ * one (NULL if the deleted element was the last one). */
+unsigned char *m_lpInsertString(unsigned char *lp, const unsigned char *s, uint32_t slen, unsigned char *p, int where, unsigned char **newp) {
+    if (s == NULL) where = LP_REPLACE;
+
+    /* Inserting after 'p' is the same as inserting before the next one. */
+    if (where == LP_AFTER) {
+        p += lpEntrySize(p);
+        where = LP_BEFORE;
+    }
+
+    unsigned long poff = p - lp;
+    uint32_t old_bytes = lpGetTotalBytes(lp);
+    uint32_t replaced_len = 0;
+    if (where == LP_REPLACE) replaced_len = lpEntrySize(p);
+
+    uint32_t enclen = 0, backlen_size = 0, new_entry_len = 0;
+    if (s) {
+        enclen = lpEncodingSize(slen);
+        backlen_size = lpEncodeBacklen(NULL, enclen + slen);
+        new_entry_len = enclen + slen + backlen_size;
+    }
+
+    uint64_t new_bytes = (uint64_t)old_bytes + new_entry_len - replaced_len;
+    assert(new_bytes <= UINT32_MAX);
+
+    /* Move the tail of the listpack so that the new entry fits exactly
+     * where the old one (if any) was. */
+    unsigned char *dst = lp + poff;
+    if (new_bytes > old_bytes) {
+        lp = lp_realloc(lp, new_bytes);
+        dst = lp + poff;
+        memmove(dst + new_entry_len, dst + replaced_len, old_bytes - poff - replaced_len);
+    } else if (new_bytes < old_bytes) {
+        memmove(dst + new_entry_len, dst + replaced_len, old_bytes - poff - replaced_len);
+        lp = lp_realloc(lp, new_bytes);
+        dst = lp + poff;
+    }
+
+    if (newp) {
+        *newp = dst;
+        /* In case of deletion, set 'newp' to NULL if the next element is
+         * the EOF element. */
+        if (!s && dst[0] == LP_EOF) *newp = NULL;
+    }
+
+    if (s) {
+        lpEncodeString(dst, slen);
+        memcpy(dst + enclen, s, slen);
+        lpEncodeBacklen(dst + enclen + slen, enclen + slen);
+    }
+
+    lpSetTotalBytes(lp, (uint32_t)new_bytes);
+    if (where == LP_BEFORE) {
+        lpUpdateNumElements(lp, 1);
+    } else if (!s) {
+        lpUpdateNumElements(lp, -1);
+    }
+    return lp;
+}
+
+unsigned char *m_lpAppend(unsigned char *lp, const unsigned char *s, uint32_t slen) {
+    unsigned char *eofptr = lp + lpGetTotalBytes(lp) - 1;
+    return m_lpInsertString(lp, s, slen, eofptr, LP_BEFORE, NULL);
+}
+
+unsigned char *m_lpDelete(unsigned char *lp, unsigned char *p, unsigned char **newp) {
+    return m_lpInsertString(lp, NULL, 0, p, LP_REPLACE, newp);
+}
+
+/* Seek the specified element and return a pointer to it. Negative indexes
+ * count from the tail (-1 is the last element). NULL is returned when the
+ * index is out of range. */
+unsigned char *m_lpSeek(unsigned char *lp, long index) {
+    unsigned long numele = m_lpLength(lp);
+    if (index < 0) index = (long)numele + index;
+    if (index < 0 || (unsigned long)index >= numele) return NULL;
+
+    unsigned char *p;
+    if ((unsigned long)index > numele / 2) {
+        /* Walking backward is faster. */
+        long back = numele - 1 - index;
+        p = m_lpLast(lp);
+        while (back--) p = m_lpPrev(lp, p);
+    } else {
+        p = m_lpFirst(lp);
+        while (index--) p = m_lpNext(lp, p);
+    }
+    return p;
+}
+
+/* Delete 'num' consecutive elements starting at 'index' with a single
+ * memory move. */
+unsigned char *m_lpDeleteRange(unsigned char *lp, long index, unsigned long num) {
+    unsigned char *first = m_lpSeek(lp, index);
+    if (first == NULL || num == 0) return lp;
+
+    unsigned char *tail = first;
+    unsigned long deleted = 0;
+    while (deleted < num && tail[0] != LP_EOF) {
+        tail += lpEntrySize(tail);
+        deleted++;
+    }
+
+    uint32_t old_bytes = lpGetTotalBytes(lp);
+    unsigned long poff = first - lp;
+    unsigned long span = tail - first;
+    memmove(first, tail, old_bytes - poff - span);
+    lp = lp_realloc(lp, old_bytes - span);
+    lpSetTotalBytes(lp, old_bytes - span);
+    lpUpdateNumElements(lp, -(long)deleted);
+    return lp;
+}
@@ -0,0 +1,38 @@
+/* A compact, contiguous list of binary-safe strings.
+ *
+ * This is a reduced version of the Redis listpack: only string entries are
+ * supported, which is all the compact TairZset encoding needs (a member
+ * entry followed by a packed score vector entry).
+ *
+ * Layout: <total-bytes:32> <num-elements:16> <entry> ... <entry> <eof:0xFF>
+ * Entry:  <encoding+len> <data> <backlen>
+ *
+ * The backlen field stores the size of <encoding+len> + <data> as a variable
+ * length integer that can be parsed right-to-left, so the list can be
+ * traversed in both directions. */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* m_lpInsertString() where argument. */
+#define LP_BEFORE 0
+#define LP_AFTER 1
+#define LP_REPLACE 2
+
+unsigned char *m_lpNew(size_t capacity);
+void m_lpFree(unsigned char *lp);
+unsigned char *m_lpInsertString(unsigned char *lp, const unsigned char *s, uint32_t slen, unsigned char *p, int where, unsigned char **newp);
+unsigned char *m_lpAppend(unsigned char *lp, const unsigned char *s, uint32_t slen);
+unsigned char *m_lpDelete(unsigned char *lp, unsigned char *p, unsigned char **newp);
+unsigned char *m_lpDeleteRange(unsigned char *lp, long index, unsigned long num);
+unsigned long m_lpLength(unsigned char *lp);
+unsigned char *m_lpGet(unsigned char *p, uint32_t *len);
+unsigned char *m_lpFirst(unsigned char *lp);
+unsigned char *m_lpLast(unsigned char *lp);
+unsigned char *m_lpNext(unsigned char *lp, unsigned char *p);
+unsigned char *m_lpPrev(unsigned char *lp, unsigned char *p);
+unsigned char *m_lpSeek(unsigned char *lp, long index);
+size_t m_lpBytes(unsigned char *lp);
+int m_lpSafeToAdd(unsigned char *lp, size_t add);
@@ -148,6 +148,61 @@ sds m_sdsnewlen(const void *init, size_t initlen) {
     return s;
 }
 
+/* Return the number of bytes needed by m_sdsnewplacement() to store a
+ * string of 'initlen' bytes: header, payload and null term. */
+size_t m_sdsplacementsize(size_t initlen) {
+    return sdsHdrSize(sdsReqType(initlen)) + initlen + 1;
+}
+
+/* Create a new sds string of 'initlen' bytes copied from 'init' inside the
+ * caller provided buffer 'buf', that must be at least
+ * m_sdsplacementsize(initlen) bytes long. No allocation is performed: the
+ * string is embedded in another structure, it can be read with the usual
+ * functions but must never be freed nor resized. */
+sds m_sdsnewplacement(char *buf, const void *init, size_t initlen) {
+    char type = sdsReqType(initlen);
+    sds s = buf + sdsHdrSize(type);
+    unsigned char *fp = ((unsigned char *)s) - 1;
+
+    switch (type) {
+        case SDS_TYPE_5: {
+            *fp = type | (initlen << SDS_TYPE_BITS);
+            break;
+        }
+        case SDS_TYPE_8: {
+            SDS_HDR_VAR(8, s);
+            sh->len = initlen;
+            sh->alloc = initlen;
+            *fp = type;
+            break;
+        }
+        case SDS_TYPE_16: {
+            SDS_HDR_VAR(16, s);
+            sh->len = initlen;
+            sh->alloc = initlen;
+            *fp = type;
+            break;
+        }
+        case SDS_TYPE_32: {
+            SDS_HDR_VAR(32, s);
+            sh->len = initlen;
+            sh->alloc = initlen;
+            *fp = type;
+            break;
+        }
+        case SDS_TYPE_64: {
+            SDS_HDR_VAR(64, s);
+            sh->len = initlen;
+            sh->alloc = initlen;
+            *fp = type;
+            break;
+        }
+    }
+    if (initlen) memcpy(s, init, initlen);
+    s[initlen] = '\0';
+    return s;
+}
+
 /* Create an empty (zero length) sds string. Even in this case the string
  * always has an implicit null term. */
 sds m_sdsempty(void) {
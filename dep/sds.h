@@ -212,6 +212,8 @@ static inline void sdssetalloc(sds s, size_t newlen) {
 }
 
 sds m_sdsnewlen(const void *init, size_t initlen);
+size_t m_sdsplacementsize(size_t initlen);
+sds m_sdsnewplacement(char *buf, const void *init, size_t initlen);
 sds m_sdsnew(const char *init);
 sds m_sdsempty(void);
 sds m_sdsdup(const sds s);
@@ -1,8 +1,11 @@
 #include "skiplist.h"
 
 #include <assert.h>
+#include <float.h>
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
+#include <strings.h>
 
 #include "util.h"
 
@@ -14,51 +17,107 @@ static inline void *rm_calloc(size_t nelem, size_t elemsz) {
     return RedisModule_Calloc(nelem, elemsz);
 }
 
+static inline void *rm_realloc(void *p, size_t n) {
+    return RedisModule_Realloc(p, n);
+}
+
 static inline void rm_free(void *p) {
     RedisModule_Free(p);
 }
 
-RedisModuleString *shared_minstring = NULL;
-RedisModuleString *shared_maxstring = NULL;
+sds shared_minstring = NULL;
+sds shared_maxstring = NULL;
+
+/* Compare the member of a node with the 'ele' buffer, binary safe and with
+ * the same semantic of m_sdscmp(). */
+static inline int m_zslEleCmp(sds nodeele, const char *ele, size_t elelen) {
+    size_t len = sdslen(nodeele);
+    size_t minlen = (len < elelen) ? len : elelen;
+    int cmp = memcmp(nodeele, ele, minlen);
+    if (cmp == 0) return (len > elelen) - (len < elelen);
+    return cmp;
+}
+
+/* Return the score key of the node 'x', stored right after its score. */
+static inline uint64_t *m_zslNodeKey(m_zskiplistNode *x) {
+    return (uint64_t *)(x->score->scores + x->score->score_num);
+}
+
+/* Compare the node 'x' with the element made of the score key 'key' and
+ * 'ele', first by score and then by member. */
+static inline int m_zslNodeCmp(m_zskiplist *zsl, m_zskiplistNode *x, const uint64_t *key, const char *ele, size_t elelen) {
+    int cmp = zsl->ops->keycmp(m_zslNodeKey(x), key, zsl->score_num);
+    if (cmp == 0) cmp = m_zslEleCmp(x->ele, ele, elelen);
+    return cmp;
+}
 
 /* Create a skiplist node with the specified number of levels.
- * The SDS string 'ele' is referenced by the node after the call. */
-m_zskiplistNode *m_zslCreateNode(int level, scoretype *score, RedisModuleString *ele) {
-    m_zskiplistNode *zn = rm_malloc(sizeof(*zn) + level * sizeof(struct zskiplistLevel));
-    zn->score = score;
-    zn->ele = ele;
+ *
+ * The node is a single allocation: the level array is followed by the score
+ * vector, the score key and then by the member, stored as an embedded sds
+ * string. Both are copied from 'score' (zero filled when NULL) and 'ele' (no
+ * member when NULL), so the caller keeps the ownership of its arguments. */
+m_zskiplistNode *m_zslCreateNode(int level, unsigned char score_num, const unsigned char *types, scoretype *score,
+                                 const char *ele, size_t elelen) {
+    size_t levelsize = level * sizeof(struct zskiplistLevel);
+    size_t scoresize = sizeof(scoretype) + score_num * sizeof(double);
+    size_t keysize = score_num * sizeof(uint64_t);
+    size_t elesize = ele ? m_sdsplacementsize(elelen) : 0;
+    m_zskiplistNode *zn = rm_malloc(sizeof(*zn) + levelsize + scoresize + keysize + elesize);
+    zn->score = (scoretype *)((char *)zn->level + levelsize);
+    if (score) {
+        assert(score->score_num == score_num);
+        memcpy(zn->score, score, scoresize);
+    } else {
+        memset(zn->score, 0, scoresize);
+        zn->score->score_num = score_num;
+    }
+    m_zscoreToKey(zn->score, types, m_zslNodeKey(zn));
+    zn->ele = ele ? m_sdsnewplacement((char *)zn->score + scoresize + keysize, ele, elelen) : NULL;
+    zn->hnext = NULL;
     return zn;
 }
 
-/* Create a new skiplist. */
-m_zskiplist *m_zslCreate(unsigned char score_num) {
-    int j;
+/* Resize the header of the skiplist to 'level' levels, the new levels are
+ * empty. The header may move, so no pointer to it must be kept across this
+ * call. */
+static void m_zslResizeHeader(m_zskiplist *zsl, int level) {
+    m_zskiplistNode *header = zsl->header;
+
+    header = rm_realloc(header, sizeof(*header) + level * sizeof(struct zskiplistLevel));
+    for (int j = zsl->header_level; j < level; j++) {
+        header->level[j].forward = NULL;
+        header->level[j].backward = NULL;
+        header->level[j].span = 0;
+    }
+    zsl->header = header;
+    zsl->header_level = level;
+}
+
+/* Create a new skiplist with the schema 'types' (NULL when all the
+ * dimensions are doubles), that must outlive the skiplist. */
+m_zskiplist *m_zslCreate(unsigned char score_num, const unsigned char *types) {
     m_zskiplist *zsl;
 
     zsl = rm_malloc(sizeof(*zsl));
     zsl->level = 1;
     zsl->length = 0;
-    scoretype *score = rm_calloc(1, sizeof(scoretype) + score_num * sizeof(double));
-    score->score_num = score_num;
-    zsl->header = m_zslCreateNode(ZSKIPLIST_MAXLEVEL, score, NULL);
-    for (j = 0; j < ZSKIPLIST_MAXLEVEL; j++) {
-        zsl->header->level[j].forward = NULL;
-        zsl->header->level[j].span = 0;
-    }
-    zsl->header->backward = NULL;
+    zsl->header = NULL;
+    zsl->header_level = 0;
+    m_zslResizeHeader(zsl, 1);
+    zsl->header->ele = NULL;
+    zsl->header->score = NULL;
+    zsl->header->hnext = NULL;
     zsl->tail = NULL;
     zsl->score_num = score_num;
+    zsl->near_tail = 0;
+    zsl->types = types;
+    zsl->ops = m_zscoreGetOps(score_num, types);
     return zsl;
 }
 
-/* Free the specified skiplist node. The referenced SDS string representation
- * of the element is freed too, unless node->ele is set to NULL before calling
- * this function. */
+/* Free the specified skiplist node, together with its score and member. */
 void m_zslFreeNode(m_zskiplistNode *node) {
-    if (node->ele) {
-        RedisModule_FreeString(NULL, node->ele);
-    }
-    rm_free(node->score);
     rm_free(node);
 }
 
@@ -66,8 +125,6 @@ void m_zslFreeNode(m_zskiplistNode *node) {
 void m_zslFree(m_zskiplist *zsl) {
     m_zskiplistNode *node = zsl->header->level[0].forward, *next;
 
-    rm_free(zsl->header->ele);
-    rm_free(zsl->header->score);
     rm_free(zsl->header);
     while (node) {
         next = node->level[0].forward;
@@ -88,32 +145,115 @@ int m_zslRandomLevel(void) {
     return (level < ZSKIPLIST_MAXLEVEL) ? level : ZSKIPLIST_MAXLEVEL;
 }
 
-/* Insert a new node in the skiplist. Assumes the element does not already
- * exist (up to the caller to enforce that). The skiplist takes ownership
- * of the passed SDS string 'ele'. */
-m_zskiplistNode *m_zslInsert(m_zskiplist *zsl, scoretype *score, RedisModuleString *ele) {
-    m_zskiplistNode *update[ZSKIPLIST_MAXLEVEL], *x;
-    unsigned int rank[ZSKIPLIST_MAXLEVEL];
-    int i, level;
+/* Like m_zslRandomLevel(), drawing from the xorshift64 state '*seed'
+ * (never zero) instead of random(), so that nodes can be created by other
+ * threads than the main one. */
+int m_zslRandomLevelR(uint64_t *seed) {
+    int level = 1;
+    for (;;) {
+        uint64_t x = *seed;
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        *seed = x;
+        if ((x & 0xFFFF) >= (ZSKIPLIST_P * 0xFFFF)) break;
+        level += 1;
+    }
+    return (level < ZSKIPLIST_MAXLEVEL) ? level : ZSKIPLIST_MAXLEVEL;
+}
 
-    x = zsl->header;
-    for (i = zsl->level - 1; i >= 0; i--) {
-        /* store rank that is crossed to reach the insert position */
-        rank[i] = i == (zsl->level - 1) ? 0 : rank[i + 1];
-        while (x->level[i].forward && 
-                (mscoreCmp(x->level[i].forward->score, score) < 0 || 
-                (mscoreCmp(x->level[i].forward->score, score) == 0 && 
-                RedisModule_StringCompare(x->level[i].forward->ele, ele) < 0))) {
-            rank[i] += x->level[i].span;
-            x = x->level[i].forward;
+/* Return the number of levels of node 'x', the score vector is placed right
+ * after the level array. */
+static inline int m_zslNodeLevel(m_zskiplistNode *x) {
+    return ((char *)x->score - (char *)x->level) / sizeof(struct zskiplistLevel);
+}
+
+/* Fill 'update' and 'rank' with the insert position of 'x' searching from
+ * the tail instead of the header, as the finger of a finger search.
+ *
+ * The last node of every level is found walking back from the tail: the last
+ * node of level i is the last node of level i-1 tall enough, and the spans
+ * of the backward steps give its rank. We climb until the last node of a
+ * level sorts before 'x' and search down from there, so the cost depends on
+ * the distance of 'x' from the tail rather than on the length. If 'x' sorts
+ * after the tail this is an append: one comparison, then only the levels of
+ * 'x' are walked (one node in most cases).
+ *
+ * The levels above both the climb and the height of 'x' are left out, their
+ * last link is NULL so there is nothing to update there. The number of
+ * levels filled is returned, or 0 if the last node of level 'maxclimb' - 1
+ * still sorts after 'x', in which case the caller searches from the header. */
+static int m_zslFindFromTail(m_zskiplist *zsl, m_zskiplistNode *x, int maxclimb, m_zskiplistNode **update,
+                             unsigned int *rank) {
+    m_zskiplistNode *y = zsl->tail ? zsl->tail : zsl->header;
+    unsigned int r = zsl->length;
+    int i, top = -1, level = m_zslNodeLevel(x);
+    size_t elelen = sdslen(x->ele);
+    uint64_t *key = m_zslNodeKey(x);
+
+    for (i = 0; top < 0 || i < level; i++) {
+        while (y != zsl->header && m_zslNodeLevel(y) <= i) {
+            m_zskiplistNode *b = y->level[i - 1].backward;
+            y = b ? b : zsl->header;
+            r -= y->level[i - 1].span;
+        }
+        update[i] = y;
+        rank[i] = r;
+        if (top < 0) {
+            if (y == zsl->header || m_zslNodeCmp(zsl, y, key, x->ele, elelen) < 0)
+                top = i;
+            else if (i + 1 == maxclimb)
+                return 0;
         }
-        update[i] = x;
     }
-    /* we assume the element is not already inside, since we allow duplicated
-     * scores, reinserting the same element should never happen since the
-     * caller of m_zslInsert() should test in the hash table if the element is
-     * already inside or not. */
-    level = m_zslRandomLevel();
+
+    /* update[top] is the last node of its level, search down from it. */
+    y = update[top];
+    r = rank[top];
+    for (i = top - 1; i >= 0; i--) {
+        while (y->level[i].forward && m_zslNodeCmp(zsl, y->level[i].forward, key, x->ele, elelen) < 0) {
+            r += y->level[i].span;
+            y = y->level[i].forward;
+        }
+        update[i] = y;
+        rank[i] = r;
+    }
+    return top + 1 > level ? top + 1 : level;
+}
+
+/* Link the node 'x', which is not in the skiplist, at the position given by
+ * its score and member. The node keeps its number of levels.
+ *
+ * Keys ordered by time or by a sequence get their new members at or near the
+ * tail, so the position is searched from the tail first: an append always
+ * (it costs a single comparison to rule out), and a few levels up when the
+ * previous insert landed close to the tail.
+ *
+ * The 1-based rank of 'x' is returned, as the search computes it anyway. */
+static unsigned long m_zslInsertNode(m_zskiplist *zsl, m_zskiplistNode *x) {
+    m_zskiplistNode *update[ZSKIPLIST_MAXLEVEL], *y;
+    unsigned int rank[ZSKIPLIST_MAXLEVEL];
+    int i, filled, level = m_zslNodeLevel(x);
+    size_t elelen = sdslen(x->ele);
+    uint64_t *key = m_zslNodeKey(x);
+
+    if (level > zsl->header_level) m_zslResizeHeader(zsl, level);
+    filled = m_zslFindFromTail(zsl, x, zsl->near_tail ? ZSKIPLIST_FINGER_LEVELS : 1, update, rank);
+    if (filled == 0) {
+        y = zsl->header;
+        for (i = zsl->level - 1; i >= 0; i--) {
+            /* store rank that is crossed to reach the insert position */
+            rank[i] = i == (zsl->level - 1) ? 0 : rank[i + 1];
+            while (y->level[i].forward && m_zslNodeCmp(zsl, y->level[i].forward, key, x->ele, elelen) < 0) {
+                rank[i] += y->level[i].span;
+                y = y->level[i].forward;
+            }
+            update[i] = y;
+        }
+        filled = zsl->level;
+    }
+    zsl->near_tail = zsl->length - rank[0] <= ZSKIPLIST_FINGER_DISTANCE;
+
     if (level > zsl->level) {
         for (i = zsl->level; i < level; i++) {
             rank[i] = 0;
@@ -122,30 +262,203 @@ m_zskiplistNode *m_zslInsert(m_zskiplist *zsl, scoretype *score, RedisModuleStri
         }
         zsl->level = level;
     }
-    x = m_zslCreateNode(level, score, ele);
     for (i = 0; i < level; i++) {
         x->level[i].forward = update[i]->level[i].forward;
         update[i]->level[i].forward = x;
+        x->level[i].backward = (update[i] == zsl->header) ? NULL : update[i];
+        if (x->level[i].forward) x->level[i].forward->level[i].backward = x;
 
         /* update span covered by update[i] as x is inserted here */
         x->level[i].span = update[i]->level[i].span - (rank[0] - rank[i]);
         update[i]->level[i].span = (rank[0] - rank[i]) + 1;
     }
 
-    /* increment span for untouched levels */
-    for (i = level; i < zsl->level; i++) {
+    /* increment span for untouched levels, the ones not filled have no
+     * forward link and so nothing to span */
+    for (i = level; i < filled && i < zsl->level; i++) {
         update[i]->level[i].span++;
     }
 
-    x->backward = (update[0] == zsl->header) ? NULL : update[0];
-    if (x->level[0].forward)
-        x->level[0].forward->backward = x;
-    else
-        zsl->tail = x;
+    if (x->level[0].forward == NULL) zsl->tail = x;
     zsl->length++;
+    return rank[0] + 1;
+}
+
+/* Insert a new node in the skiplist. Assumes the element does not already
+ * exist (up to the caller to enforce that). Both 'score' and 'ele' are
+ * copied into the node. */
+m_zskiplistNode *m_zslInsert(m_zskiplist *zsl, scoretype *score, const char *ele, size_t elelen) {
+    /* we assume the element is not already inside, since we allow duplicated
+     * scores, reinserting the same element should never happen since the
+     * caller of m_zslInsert() should test in the hash table if the element is
+     * already inside or not. */
+    m_zskiplistNode *x = m_zslCreateNode(m_zslRandomLevel(), zsl->score_num, zsl->types, score, ele, elelen);
+    m_zslInsertNode(zsl, x);
     return x;
 }
 
+/* Like m_zslInsert(), also storing the 1-based rank of the new element in
+ * '*rank', found by the insertion search itself. */
+m_zskiplistNode *m_zslInsertWithRank(m_zskiplist *zsl, scoretype *score, const char *ele, size_t elelen,
+                                     unsigned long *rank) {
+    m_zskiplistNode *x = m_zslCreateNode(m_zslRandomLevel(), zsl->score_num, zsl->types, score, ele, elelen);
+    *rank = m_zslInsertNode(zsl, x);
+    return x;
+}
+
+/* Order two nodes by score key and member, for qsort(). */
+static int m_zslNodeSortCmp(const void *a, const void *b) {
+    m_zskiplistNode *x = *(m_zskiplistNode *const *)a, *y = *(m_zskiplistNode *const *)b;
+    const uint64_t *kx = m_zslNodeKey(x), *ky = m_zslNodeKey(y);
+
+    for (int i = 0; i < x->score->score_num; i++) {
+        if (kx[i] != ky[i]) return kx[i] < ky[i] ? -1 : 1;
+    }
+    return m_zslEleCmp(x->ele, y->ele, sdslen(y->ele));
+}
+
+/* Link the 'count' nodes of 'nodes', which are not in the skiplist and hold
+ * distinct members not in it either, in a single sweep. The array is sorted
+ * by score and member in place.
+ *
+ * The search frontier (update[] and rank[]) is kept from one node to the
+ * next, as in sorted order it only moves forward: for the next node we climb
+ * from level 0 while the frontier link of the level lands before the node,
+ * and search down from the first level where it does not, since all the
+ * links above it land after the node too. Merging M nodes into N elements
+ * so takes O(N + M) steps at most (plus the sort) instead of M searches from
+ * the top, and close to O(M) when the nodes are clustered. */
+void m_zslInsertNodes(m_zskiplist *zsl, m_zskiplistNode **nodes, unsigned long count) {
+    m_zskiplistNode *update[ZSKIPLIST_MAXLEVEL], *x, *y;
+    unsigned long rank[ZSKIPLIST_MAXLEVEL], j;
+    int i, t, level, maxlevel = zsl->level;
+
+    if (count == 0) return;
+    qsort(nodes, count, sizeof(*nodes), m_zslNodeSortCmp);
+
+    /* Grow the header once before the sweep, as it may move. */
+    for (j = 0; j < count; j++) {
+        level = m_zslNodeLevel(nodes[j]);
+        if (level > maxlevel) maxlevel = level;
+    }
+    if (maxlevel > zsl->header_level) m_zslResizeHeader(zsl, maxlevel);
+    for (i = 0; i < maxlevel; i++) {
+        update[i] = zsl->header;
+        rank[i] = 0;
+    }
+
+    for (j = 0; j < count; j++) {
+        x = nodes[j];
+        level = m_zslNodeLevel(x);
+        size_t elelen = sdslen(x->ele);
+        uint64_t *key = m_zslNodeKey(x);
+
+        for (t = 0; t < zsl->level; t++) {
+            y = update[t]->level[t].forward;
+            if (y == NULL || m_zslNodeCmp(zsl, y, key, x->ele, elelen) > 0) break;
+        }
+        for (i = t - 1; i >= 0; i--) {
+            /* store rank that is crossed to reach the insert position */
+            if (i + 1 < t && rank[i + 1] > rank[i]) {
+                update[i] = update[i + 1];
+                rank[i] = rank[i + 1];
+            }
+            y = update[i];
+            while (y->level[i].forward && m_zslNodeCmp(zsl, y->level[i].forward, key, x->ele, elelen) < 0) {
+                rank[i] += y->level[i].span;
+                y = y->level[i].forward;
+            }
+            update[i] = y;
+        }
+
+        if (level > zsl->level) {
+            for (i = zsl->level; i < level; i++) {
+                rank[i] = 0;
+                update[i] = zsl->header;
+                update[i]->level[i].span = zsl->length;
+            }
+            zsl->level = level;
+        }
+        for (i = 0; i < level; i++) {
+            x->level[i].forward = update[i]->level[i].forward;
+            update[i]->level[i].forward = x;
+            x->level[i].backward = (update[i] == zsl->header) ? NULL : update[i];
+            if (x->level[i].forward) x->level[i].forward->level[i].backward = x;
+
+            /* update span covered by update[i] as x is inserted here */
+            x->level[i].span = update[i]->level[i].span - (rank[0] - rank[i]);
+            update[i]->level[i].span = (rank[0] - rank[i]) + 1;
+        }
+
+        /* increment span for untouched levels */
+        for (i = level; i < zsl->level; i++) {
+            update[i]->level[i].span++;
+        }
+
+        if (x->level[0].forward == NULL) zsl->tail = x;
+        zsl->length++;
+
+        /* The next node sorts after x, which is the frontier of its levels. */
+        for (i = level - 1; i >= 0; i--) {
+            update[i] = x;
+            rank[i] = rank[0] + 1;
+        }
+    }
+}
+
+/* Set the score of 'x', a node not linked in the skiplist yet, for example
+ * one waiting for m_zslInsertNodes(). The score is copied. */
+void m_zslSetNodeScore(m_zskiplist *zsl, m_zskiplistNode *x, scoretype *score) {
+    zsl->ops->assign(x->score, score);
+    m_zscoreToKey(x->score, zsl->types, m_zslNodeKey(x));
+}
+
+/* Like m_zslInsert(), for elements usually inserted in descending order, as
+ * they are when an RDB file is loaded (sorted sets are saved from the tail).
+ *
+ * When the element sorts before the first one the node is linked at the
+ * head without searching: the header levels the node covers now point to
+ * it, with the previous header spans moved to the node, and the higher
+ * header levels just get one more element to span. So a whole skiplist is
+ * built in linear time. Otherwise the element is inserted at its position
+ * with the usual search. */
+m_zskiplistNode *m_zslInsertHead(m_zskiplist *zsl, scoretype *score, const char *ele, size_t elelen) {
+    m_zskiplistNode *x = m_zslCreateNode(m_zslRandomLevel(), zsl->score_num, zsl->types, score, ele, elelen);
+    m_zslInsertNodeHead(zsl, x);
+    return x;
+}
+
+/* The m_zslInsertHead() of a node already created with m_zslCreateNode(). */
+void m_zslInsertNodeHead(m_zskiplist *zsl, m_zskiplistNode *x) {
+    m_zskiplistNode *first = zsl->header->level[0].forward, *header;
+    int i, level = m_zslNodeLevel(x);
+
+    if (first && m_zslNodeCmp(zsl, first, m_zslNodeKey(x), x->ele, sdslen(x->ele)) <= 0) {
+        m_zslInsertNode(zsl, x);
+        return;
+    }
+
+    if (level > zsl->header_level) m_zslResizeHeader(zsl, level);
+    header = zsl->header;
+    for (i = zsl->level; i < level; i++) header->level[i].span = zsl->length;
+    if (level > zsl->level) zsl->level = level;
+
+    for (i = 0; i < level; i++) {
+        x->level[i].forward = header->level[i].forward;
+        x->level[i].backward = NULL;
+        x->level[i].span = header->level[i].span;
+        if (x->level[i].forward) x->level[i].forward->level[i].backward = x;
+        header->level[i].forward = x;
+        header->level[i].span = 1;
+    }
+    for (i = level; i < zsl->level; i++) {
+        header->level[i].span++;
+    }
+
+    if (zsl->tail == NULL) zsl->tail = x;
+    zsl->length++;
+}
+
 /* Internal function used by m_zslDelete, zslDeleteByScore and zslDeleteByRank */
 void m_zslDeleteNode(m_zskiplist *zsl, m_zskiplistNode *x, m_zskiplistNode **update) {
     int i;
@@ -153,20 +466,47 @@ void m_zslDeleteNode(m_zskiplist *zsl, m_zskiplistNode *x, m_zskiplistNode **upd
         if (update[i]->level[i].forward == x) {
             update[i]->level[i].span += x->level[i].span - 1;
             update[i]->level[i].forward = x->level[i].forward;
+            if (x->level[i].forward) x->level[i].forward->level[i].backward = x->level[i].backward;
         } else {
             update[i]->level[i].span -= 1;
         }
     }
-    if (x->level[0].forward) {
-        x->level[0].forward->backward = x->backward;
-    } else {
-        zsl->tail = x->backward;
+    if (x->level[0].forward == NULL) {
+        zsl->tail = x->level[0].backward;
     }
     while (zsl->level > 1 && zsl->header->level[zsl->level - 1].forward == NULL)
         zsl->level--;
     zsl->length--;
 }
 
+/* Fill 'update' with the predecessors of 'x' at every level of the skiplist
+ * without searching from the top: below the height of 'x' they are its own
+ * backward links, above it we climb the backward links of the predecessors
+ * until a node tall enough is found (or the header). No score or member is
+ * compared. */
+static void m_zslGetUpdateByNode(m_zskiplist *zsl, m_zskiplistNode *x, m_zskiplistNode **update) {
+    m_zskiplistNode *y = NULL;
+    int i, level = m_zslNodeLevel(x);
+
+    for (i = 0; i < zsl->level; i++) {
+        if (i < level) {
+            y = x->level[i].backward;
+        } else {
+            while (y && m_zslNodeLevel(y) <= i) y = y->level[i - 1].backward;
+        }
+        update[i] = y ? y : zsl->header;
+    }
+}
+
+/* Unlink the node 'x' from the skiplist and free it. */
+void m_zslDeleteByNode(m_zskiplist *zsl, m_zskiplistNode *x) {
+    m_zskiplistNode *update[ZSKIPLIST_MAXLEVEL];
+
+    m_zslGetUpdateByNode(zsl, x, update);
+    m_zslDeleteNode(zsl, x, update);
+    m_zslFreeNode(x);
+}
+
 /* Delete an element with matching score/element from the skiplist.
  * The function returns 1 if the node was found and deleted, otherwise
  * 0 is returned.
@@ -174,17 +514,17 @@ void m_zslDeleteNode(m_zskiplist *zsl, m_zskiplistNode *x, m_zskiplistNode **upd
  * If 'node' is NULL the deleted node is freed by m_zslFreeNode(), otherwise
  * it is not freed (but just unlinked) and *node is set to the node pointer,
  * so that it is possible for the caller to reuse the node (including the
- * referenced SDS string at node->ele). */
-int m_zslDelete(m_zskiplist *zsl, scoretype *score, RedisModuleString *ele, m_zskiplistNode **node) {
+ * embedded member at node->ele). */
+int m_zslDelete(m_zskiplist *zsl, scoretype *score, sds ele, m_zskiplistNode **node) {
     m_zskiplistNode *update[ZSKIPLIST_MAXLEVEL], *x;
+    uint64_t key[MAX_SCORE_NUM];
     int i;
 
+    m_zscoreToKey(score, zsl->types, key);
     x = zsl->header;
     for (i = zsl->level - 1; i >= 0; i--) {
-        while (x->level[i].forward && 
-                (mscoreCmp(x->level[i].forward->score, score) < 0 || 
-                (mscoreCmp(x->level[i].forward->score, score) == 0 && 
-                RedisModule_StringCompare(x->level[i].forward->ele, ele) < 0))) {
+        while (x->level[i].forward &&
+               m_zslNodeCmp(zsl, x->level[i].forward, key, ele, sdslen(ele)) < 0) {
             x = x->level[i].forward;
         }
         update[i] = x;
@@ -192,7 +532,7 @@ int m_zslDelete(m_zskiplist *zsl, scoretype *score, RedisModuleString *ele, m_zs
     /* We may have multiple elements with the same score, what we need
      * is to find the element with both the right score and object. */
     x = x->level[0].forward;
-    if (x && mscoreCmp(score, x->score) == 0 && RedisModule_StringCompare(x->ele, ele) == 0) {
+    if (x && m_zslNodeCmp(zsl, x, key, ele, sdslen(ele)) == 0) {
         m_zslDeleteNode(zsl, x, update);
         if (!node)
             m_zslFreeNode(x);
@@ -203,60 +543,44 @@ int m_zslDelete(m_zskiplist *zsl, scoretype *score, RedisModuleString *ele, m_zs
     return 0; /* not found */
 }
 
-/* Update the score of an elmenent inside the sorted set skiplist.
- * Note that the element must exist and must match 'score'.
- * This function does not update the score in the hash table side, the
- * caller should take care of it.
+/* Update the score of the skiplist node 'x' to 'newscore', which is copied
+ * and still owned by the caller. This function does not update the hash
+ * table side, but since the node is always reused its address (and the one
+ * of its score and member) does not change.
  *
- * Note that this function attempts to just update the node, in case after
- * the score update, the node would be exactly at the same position.
- * Otherwise the skiplist is modified by removing and re-adding a new
- * element, which is more costly.
+ * If the node, after the score update, would be still exactly at the same
+ * position, just the score is updated. Otherwise the node is unlinked, using
+ * its backward links to find its predecessors, and linked again at its new
+ * position, which is the only search performed.
  *
- * The function returns the updated element skiplist node pointer. */
-m_zskiplistNode *m_zslUpdateScore(m_zskiplist *zsl, scoretype *curscore, RedisModuleString *ele, scoretype *newscore) {
-    m_zskiplistNode *update[ZSKIPLIST_MAXLEVEL], *x;
-    int i;
-
-    /* We need to seek to element to update to start: this is useful anyway,
-     * we'll have to update or remove it. */
-    x = zsl->header;
-    for (i = zsl->level - 1; i >= 0; i--) {
-        while (x->level[i].forward && 
-        (mscoreCmp(x->level[i].forward->score, curscore) < 0 || 
-        (mscoreCmp(x->level[i].forward->score, curscore) == 0 && RedisModule_StringCompare(x->level[i].forward->ele, ele) < 0))) {
-            x = x->level[i].forward;
-        }
-        update[i] = x;
+ * When 'rank' is not NULL the 1-based rank of the node after the update is
+ * stored there: the search gives it when the node is linked again, otherwise
+ * it is summed by m_zslGetRankByNode(). */
+void m_zslUpdateScore(m_zskiplist *zsl, m_zskiplistNode *x, scoretype *newscore, unsigned long *rank) {
+    m_zskiplistNode *update[ZSKIPLIST_MAXLEVEL];
+    m_zskiplistNode *prev = x->level[0].backward, *next = x->level[0].forward;
+    uint64_t key[MAX_SCORE_NUM];
+
+    m_zscoreToKey(newscore, zsl->types, key);
+    if ((prev == NULL || zsl->ops->keycmp(m_zslNodeKey(prev), key, zsl->score_num) < 0) &&
+        (next == NULL || zsl->ops->keycmp(m_zslNodeKey(next), key, zsl->score_num) > 0)) {
+        zsl->ops->assign(x->score, newscore);
+        memcpy(m_zslNodeKey(x), key, zsl->score_num * sizeof(uint64_t));
+        if (rank) *rank = m_zslGetRankByNode(zsl, x);
+        return;
     }
 
-    /* Jump to our element: note that this function assumes that the
-     * element with the matching score exists. */
-    x = x->level[0].forward;
-    assert(x && mscoreCmp(curscore, x->score) == 0 && RedisModule_StringCompare(x->ele, ele) == 0);
-    /* If the node, after the score update, would be still exactly
-     * at the same position, we can just update the score without
-     * actually removing and re-inserting the element in the skiplist. */
-    if ((x->backward == NULL || mscoreCmp(x->backward->score, newscore) < 0) && (x->level[0].forward == NULL || mscoreCmp(x->level[0].forward->score, newscore) > 0)) {
-        rm_free(x->score);
-        x->score = newscore;
-        return x;
-    }
-
-    /* No way to reuse the old node: we need to remove and insert a new
-     * one at a different place. */
+    m_zslGetUpdateByNode(zsl, x, update);
     m_zslDeleteNode(zsl, x, update);
-    m_zskiplistNode *newnode = m_zslInsert(zsl, newscore, x->ele);
-    /* We reused the old node x->ele SDS string, free the node now
-     * since m_zslInsert created a new one. */
-    x->ele = NULL;
-    m_zslFreeNode(x);
-    return newnode;
+    zsl->ops->assign(x->score, newscore);
+    memcpy(m_zslNodeKey(x), key, zsl->score_num * sizeof(uint64_t));
+    unsigned long newrank = m_zslInsertNode(zsl, x);
+    if (rank) *rank = newrank;
 }
 
 /* Delete all the elements with rank between start and end from the skiplist.
  * Start and end are inclusive. Note that start and end need to be 1-based */
-unsigned long m_zslDeleteRangeByRank(m_zskiplist *zsl, unsigned int start, unsigned int end, dict *dict) {
+unsigned long m_zslDeleteRangeByRank(m_zskiplist *zsl, unsigned int start, unsigned int end, m_zindex *zi) {
     m_zskiplistNode *update[ZSKIPLIST_MAXLEVEL], *x;
     unsigned long traversed = 0, removed = 0;
     int i;
@@ -275,7 +599,7 @@ unsigned long m_zslDeleteRangeByRank(m_zskiplist *zsl, unsigned int start, unsig
     while (x && traversed <= end) {
         m_zskiplistNode *next = x->level[0].forward;
         m_zslDeleteNode(zsl, x, update);
-        m_dictDelete(dict, x->ele);
+        m_zindexDelete(zi, x);
         m_zslFreeNode(x);
         removed++;
         traversed++;
@@ -290,12 +614,14 @@ unsigned long m_zslDeleteRangeByRank(m_zskiplist *zsl, unsigned int start, unsig
 unsigned long m_zslGetRankByScore(m_zskiplist *zsl, scoretype *score) {
     m_zskiplistNode *x;
     unsigned long rank = 0;
+    uint64_t key[MAX_SCORE_NUM];
     int i;
 
+    m_zscoreToKey(score, zsl->types, key);
     x = zsl->header;
     for (i = zsl->level - 1; i >= 0; i--) {
         while (x->level[i].forward &&
-               (mscoreCmp(x->level[i].forward->score, score) < 0)) {
+               zsl->ops->keycmp(m_zslNodeKey(x->level[i].forward), key, zsl->score_num) < 0) {
             rank += x->level[i].span;
             x = x->level[i].forward;
         }
@@ -303,33 +629,83 @@ unsigned long m_zslGetRankByScore(m_zskiplist *zsl, scoretype *score) {
     return rank;
 }
 
+/* Return the last node sorting before the element (score, ele), which does
+ * not need to be in the skiplist, or NULL if there is none. With 'inclusive'
+ * a node holding the element itself is returned too. The descent is the one
+ * of an insertion, on the full (score, member) order. When 'rank' is not
+ * NULL the 1-based rank of the node (0 for NULL) is stored there.
+ *
+ * This resumes a keyset pagination from a (score, member) token: the next
+ * page starts right after (or, in reverse, right before) the token, even if
+ * the token element was removed meanwhile. */
+m_zskiplistNode *m_zslLastBefore(m_zskiplist *zsl, scoretype *score, const char *ele, size_t elelen, int inclusive,
+                                 unsigned long *rank) {
+    m_zskiplistNode *x;
+    unsigned long traversed = 0;
+    uint64_t key[MAX_SCORE_NUM];
+    int i;
+
+    m_zscoreToKey(score, zsl->types, key);
+    x = zsl->header;
+    for (i = zsl->level - 1; i >= 0; i--) {
+        /* cmp < 1 also goes past an equal node. */
+        while (x->level[i].forward && m_zslNodeCmp(zsl, x->level[i].forward, key, ele, elelen) < (inclusive ? 1 : 0)) {
+            traversed += x->level[i].span;
+            x = x->level[i].forward;
+        }
+    }
+    if (rank) *rank = traversed;
+    return x == zsl->header ? NULL : x;
+}
+
 /* Find the rank for an element by both score and key.
  * Returns 0 when the element cannot be found, rank otherwise.
  * Note that the rank is 1-based due to the span of zsl->header to the
  * first element. */
-unsigned long m_zslGetRank(m_zskiplist *zsl, scoretype *score, RedisModuleString *ele) {
+unsigned long m_zslGetRank(m_zskiplist *zsl, scoretype *score, sds ele) {
     m_zskiplistNode *x;
     unsigned long rank = 0;
+    uint64_t key[MAX_SCORE_NUM];
     int i;
 
+    m_zscoreToKey(score, zsl->types, key);
     x = zsl->header;
     for (i = zsl->level - 1; i >= 0; i--) {
-        while (x->level[i].forward && 
-             (mscoreCmp(x->level[i].forward->score, score) < 0 || 
-             (mscoreCmp(x->level[i].forward->score, score) == 0 && 
-             RedisModule_StringCompare(x->level[i].forward->ele, ele) <= 0))) {
+        while (x->level[i].forward &&
+               m_zslNodeCmp(zsl, x->level[i].forward, key, ele, sdslen(ele)) <= 0) {
             rank += x->level[i].span;
             x = x->level[i].forward;
         }
 
         /* x might be equal to zsl->header, so test if obj is non-NULL */
-        if (x->ele && RedisModule_StringCompare(x->ele, ele) == 0) {
+        if (x->ele && m_sdscmp(x->ele, ele) == 0) {
             return rank;
         }
     }
     return 0;
 }
 
+/* Return the 1-based rank of the node 'x', which must be in the skiplist.
+ *
+ * Instead of searching from the top, the spans crossed to reach 'x' from the
+ * header are summed climbing the backward links of its predecessors, always
+ * following the highest level of the current node. This visits the nodes of
+ * the search path of 'x' in reverse, without loading the nodes a search
+ * would reject and without comparing any score or member. */
+unsigned long m_zslGetRankByNode(m_zskiplist *zsl, m_zskiplistNode *x) {
+    unsigned long rank = 0;
+    m_zskiplistNode *y;
+    int level;
+
+    while (x) {
+        level = m_zslNodeLevel(x);
+        y = x->level[level - 1].backward;
+        rank += (y ? y : zsl->header)->level[level - 1].span;
+        x = y;
+    }
+    return rank;
+}
+
 /* Finds an element by its rank. The rank argument needs to be 1-based. */
 m_zskiplistNode *m_zslGetElementByRank(m_zskiplist *zsl, unsigned long rank) {
     m_zskiplistNode *x;
@@ -349,9 +725,32 @@ m_zskiplistNode *m_zslGetElementByRank(m_zskiplist *zsl, unsigned long rank) {
     return NULL;
 }
 
-/* Populate the rangespec according to the objects min and max. */
-int m_zslParseRange(RedisModuleString *min, RedisModuleString *max, m_zrangespec *spec) {
+/* Return the node 'n' positions after 'x' (before it when 'n' is negative),
+ * or NULL past the ends of the skiplist. Rather than following 'n' level 0
+ * links, the rank of 'x' is summed climbing its backward links and the
+ * target is found by spans, so the skip is O(log(N)) whatever its length. */
+m_zskiplistNode *m_zslSkipNodes(m_zskiplist *zsl, m_zskiplistNode *x, long n) {
+    unsigned long rank;
+
+    if (n == 0) return x;
+    rank = m_zslGetRankByNode(zsl, x);
+    if (n > 0) {
+        if ((unsigned long)n > zsl->length - rank) return NULL;
+        rank += n;
+    } else {
+        if ((unsigned long)-(n + 1) >= rank - 1) return NULL;
+        rank -= (unsigned long)-(n + 1) + 1;
+    }
+    return m_zslGetElementByRank(zsl, rank);
+}
+
+/* Populate the rangespec according to the objects min and max, parsed with
+ * the schema 'types' of 'score_num' dimensions (NULL and MAX_SCORE_NUM when
+ * the schema is not known yet), see mscoreParseBound(). */
+int m_zslParseRange(RedisModuleString *min, RedisModuleString *max, const unsigned char *types, int score_num,
+                    m_zrangespec *spec) {
     spec->minex = spec->maxex = 0;
+    spec->types = types;
 
     size_t max_len, min_len;
     const char *min_ptr = RedisModule_StringPtrLen(min, &min_len);
@@ -363,20 +762,20 @@ int m_zslParseRange(RedisModuleString *min, RedisModuleString *max, m_zrangespec
      * ZRANGEBYSCORE zset 1.5 2.5 will instead match min <= x <= max */
 
     if (min_ptr[0] == '(') {
-        ret = mscoreParse(min_ptr + 1, min_len - 1, &spec->min);
+        ret = mscoreParseBound(min_ptr + 1, min_len - 1, types, score_num, &spec->min);
         if (ret <= 0) return C_ERR;
         spec->minex = 1;
     } else {
-        ret = mscoreParse(min_ptr, min_len, &spec->min);
+        ret = mscoreParseBound(min_ptr, min_len, types, score_num, &spec->min);
         if (ret <= 0) return C_ERR;
     }
 
     if (max_ptr[0] == '(') {
-        ret = mscoreParse(max_ptr + 1, max_len - 1, &spec->max);
+        ret = mscoreParseBound(max_ptr + 1, max_len - 1, types, score_num, &spec->max);
         if (ret <= 0) return C_ERR;
         spec->maxex = 1;
     } else {
-        ret = mscoreParse(max_ptr, max_len, &spec->max);
+        ret = mscoreParseBound(max_ptr, max_len, types, score_num, &spec->max);
         if (ret <= 0) return C_ERR;
     }
     return C_OK;
@@ -390,14 +789,14 @@ int m_zslParseRange(RedisModuleString *min, RedisModuleString *max, m_zrangespec
   * - means the min string possible
   * + means the max string possible
   *
-  * If the string is valid the *dest pointer is set to the redis object
+  * If the string is valid the *dest pointer is set to the sds string
   * that will be used for the comparison, and ex will be set to 0 or 1
   * respectively if the item is exclusive or inclusive. C_OK will be
   * returned.
   *
   * If the string is not a valid range C_ERR is returned, and the value
   * of *dest and *ex is undefined. */
-int m_zslParseLexRangeItem(RedisModuleString *item, RedisModuleString **dest, int *ex) {
+int m_zslParseLexRangeItem(RedisModuleString *item, sds *dest, int *ex) {
     size_t len;
     const char *c = RedisModule_StringPtrLen(item, &len);
 
@@ -414,11 +813,11 @@ int m_zslParseLexRangeItem(RedisModuleString *item, RedisModuleString **dest, in
             return C_OK;
         case '(':
             *ex = 1;
-            *dest = RedisModule_CreateString(NULL, c + 1, len - 1);
+            *dest = m_sdsnewlen(c + 1, len - 1);
             return C_OK;
         case '[':
             *ex = 0;
-            *dest = RedisModule_CreateString(NULL, c + 1, len - 1);
+            *dest = m_sdsnewlen(c + 1, len - 1);
             return C_OK;
         default:
             return C_ERR;
@@ -429,10 +828,10 @@ int m_zslParseLexRangeItem(RedisModuleString *item, RedisModuleString **dest, in
  * populated the structure with success (C_OK returned). */
 void m_zslFreeLexRange(m_zlexrangespec *spec) {
     if (spec->min && spec->min != shared_minstring && spec->min != shared_maxstring) {
-        RedisModule_FreeString(NULL, spec->min);
+        m_sdsfree(spec->min);
     }
     if (spec->max && spec->max != shared_minstring && spec->max != shared_maxstring) {
-        RedisModule_FreeString(NULL, spec->max);
+        m_sdsfree(spec->max);
     }
 }
 
@@ -454,58 +853,95 @@ int m_zslParseLexRange(RedisModuleString *min, RedisModuleString *max, m_zlexran
 /* This is just a wrapper to m_sdscmp() that is able to
  * handle shared.minstring and shared.maxstring as the equivalent of
  * -inf and +inf for strings */
-int m_mscmplex(RedisModuleString *a, RedisModuleString *b) {
+int m_mscmplex(sds a, sds b) {
     if (a == b) return 0;
     if (a == shared_minstring || b == shared_maxstring) return -1;
     if (a == shared_maxstring || b == shared_minstring) return 1;
-    return RedisModule_StringCompare(a, b);
+    return m_sdscmp(a, b);
 }
 
-int m_zslLexValueGteMin(RedisModuleString *value, m_zlexrangespec *spec) {
+int m_zslLexValueGteMin(sds value, m_zlexrangespec *spec) {
     return spec->minex ? (m_mscmplex(value, spec->min) > 0) : (m_mscmplex(value, spec->min) >= 0);
 }
 
-int m_zslLexValueLteMax(RedisModuleString *value, m_zlexrangespec *spec) {
+int m_zslLexValueLteMax(sds value, m_zlexrangespec *spec) {
     return spec->maxex ? (m_mscmplex(value, spec->max) < 0) : (m_mscmplex(value, spec->max) <= 0);
 }
 
 int m_zslValueGteMin(scoretype *value, m_zrangespec *spec) {
-    return spec->minex ? (mscoreCmp(value, spec->min) > 0) : (mscoreCmp(value, spec->min) >= 0);
+    int cmp = mscoreCmp(value, spec->min, spec->types);
+    return spec->minex ? cmp > 0 : cmp >= 0;
 }
 
 int m_zslValueLteMax(scoretype *value, m_zrangespec *spec) {
-    return spec->maxex ? (mscoreCmp(value, spec->max) < 0) : (mscoreCmp(value, spec->max) <= 0);
+    int cmp = mscoreCmp(value, spec->max, spec->types);
+    return spec->maxex ? cmp < 0 : cmp <= 0;
 }
 
-/* Returns if there is a part of the zset is in range. */
-int m_zslIsInRange(m_zskiplist *zsl, m_zrangespec *range) {
+/* A m_zrangespec with its bounds encoded as score keys, so that the nodes
+ * are compared with their keys while walking the skiplist. */
+typedef struct {
+    uint64_t min[MAX_SCORE_NUM], max[MAX_SCORE_NUM];
+    int minex, maxex;
+} m_zkeyrange;
+
+static void m_zslKeyRange(m_zrangespec *range, m_zkeyrange *kr) {
+    m_zscoreToKey(range->min, range->types, kr->min);
+    m_zscoreToKey(range->max, range->types, kr->max);
+    kr->minex = range->minex;
+    kr->maxex = range->maxex;
+}
+
+/* Same as m_zslValueGteMin() and m_zslValueLteMax(), for the node 'x'. */
+static inline int m_zslNodeGteMin(m_zskiplist *zsl, m_zskiplistNode *x, m_zkeyrange *kr) {
+    int cmp = zsl->ops->keycmp(m_zslNodeKey(x), kr->min, zsl->score_num);
+    return kr->minex ? cmp > 0 : cmp >= 0;
+}
+
+static inline int m_zslNodeLteMax(m_zskiplist *zsl, m_zskiplistNode *x, m_zkeyrange *kr) {
+    int cmp = zsl->ops->keycmp(m_zslNodeKey(x), kr->max, zsl->score_num);
+    return kr->maxex ? cmp < 0 : cmp <= 0;
+}
+
+static int m_zslKeyIsInRange(m_zskiplist *zsl, m_zkeyrange *kr) {
     m_zskiplistNode *x;
 
     /* Test for ranges that will always be empty. */
-    if (mscoreCmp(range->min, range->max) > 0 || (mscoreCmp(range->min, range->max) == 0 && (range->minex || range->maxex)))
+    int cmp = zsl->ops->keycmp(kr->min, kr->max, zsl->score_num);
+    if (cmp > 0 || (cmp == 0 && (kr->minex || kr->maxex)))
         return 0;
     x = zsl->tail;
-    if (x == NULL || !m_zslValueGteMin(x->score, range))
+    if (x == NULL || !m_zslNodeGteMin(zsl, x, kr))
         return 0;
     x = zsl->header->level[0].forward;
-    if (x == NULL || !m_zslValueLteMax(x->score, range))
+    if (x == NULL || !m_zslNodeLteMax(zsl, x, kr))
         return 0;
     return 1;
 }
 
+/* Returns if there is a part of the zset is in range. */
+int m_zslIsInRange(m_zskiplist *zsl, m_zrangespec *range) {
+    m_zkeyrange kr;
+
+    m_zslKeyRange(range, &kr);
+    return m_zslKeyIsInRange(zsl, &kr);
+}
+
 /* Find the first node that is contained in the specified range.
  * Returns NULL when no element is contained in the range. */
 m_zskiplistNode *m_zslFirstInRange(m_zskiplist *zsl, m_zrangespec *range) {
     m_zskiplistNode *x;
+    m_zkeyrange kr;
     int i;
 
     /* If everything is out of range, return early. */
-    if (!m_zslIsInRange(zsl, range)) return NULL;
+    m_zslKeyRange(range, &kr);
+    if (!m_zslKeyIsInRange(zsl, &kr)) return NULL;
 
     x = zsl->header;
     for (i = zsl->level - 1; i >= 0; i--) {
         /* Go forward while *OUT* of range. */
-        while (x->level[i].forward && !m_zslValueGteMin(x->level[i].forward->score, range))
+        while (x->level[i].forward && !m_zslNodeGteMin(zsl, x->level[i].forward, &kr))
             x = x->level[i].forward;
     }
 
@@ -514,7 +950,7 @@ m_zskiplistNode *m_zslFirstInRange(m_zskiplist *zsl, m_zrangespec *range) {
     assert(x != NULL);
 
     /* Check if score <= max. */
-    if (!m_zslValueLteMax(x->score, range)) return NULL;
+    if (!m_zslNodeLteMax(zsl, x, &kr)) return NULL;
     return x;
 }
 
@@ -522,15 +958,17 @@ m_zskiplistNode *m_zslFirstInRange(m_zskiplist *zsl, m_zrangespec *range) {
  * Returns NULL when no element is contained in the range. */
 m_zskiplistNode *m_zslLastInRange(m_zskiplist *zsl, m_zrangespec *range) {
     m_zskiplistNode *x;
+    m_zkeyrange kr;
     int i;
 
     /* If everything is out of range, return early. */
-    if (!m_zslIsInRange(zsl, range)) return NULL;
+    m_zslKeyRange(range, &kr);
+    if (!m_zslKeyIsInRange(zsl, &kr)) return NULL;
 
     x = zsl->header;
     for (i = zsl->level - 1; i >= 0; i--) {
         /* Go forward while *IN* range. */
-        while (x->level[i].forward && m_zslValueLteMax(x->level[i].forward->score, range))
+        while (x->level[i].forward && m_zslNodeLteMax(zsl, x->level[i].forward, &kr))
             x = x->level[i].forward;
     }
 
@@ -538,18 +976,20 @@ m_zskiplistNode *m_zslLastInRange(m_zskiplist *zsl, m_zrangespec *range) {
     assert(x != NULL);
 
     /* Check if score >= min. */
-    if (!m_zslValueGteMin(x->score, range)) return NULL;
+    if (!m_zslNodeGteMin(zsl, x, &kr)) return NULL;
     return x;
 }
 
-unsigned long m_zslDeleteRangeByScore(m_zskiplist *zsl, m_zrangespec *range, dict *dict) {
+unsigned long m_zslDeleteRangeByScore(m_zskiplist *zsl, m_zrangespec *range, m_zindex *zi) {
     m_zskiplistNode *update[ZSKIPLIST_MAXLEVEL], *x;
     unsigned long removed = 0;
+    m_zkeyrange kr;
     int i;
 
+    m_zslKeyRange(range, &kr);
     x = zsl->header;
     for (i = zsl->level - 1; i >= 0; i--) {
-        while (x->level[i].forward && (range->minex ? mscoreCmp(x->level[i].forward->score, range->min) <= 0 : mscoreCmp(x->level[i].forward->score, range->min) < 0))
+        while (x->level[i].forward && !m_zslNodeGteMin(zsl, x->level[i].forward, &kr))
             x = x->level[i].forward;
         update[i] = x;
     }
@@ -558,10 +998,10 @@ unsigned long m_zslDeleteRangeByScore(m_zskiplist *zsl, m_zrangespec *range, dic
     x = x->level[0].forward;
 
     /* Delete nodes while in range. */
-    while (x && (range->maxex ? mscoreCmp(x->score, range->max) < 0 : mscoreCmp(x->score, range->max) <= 0)) {
+    while (x && m_zslNodeLteMax(zsl, x, &kr)) {
         m_zskiplistNode *next = x->level[0].forward;
         m_zslDeleteNode(zsl, x, update);
-        m_dictDelete(dict, x->ele);
+        m_zindexDelete(zi, x);
         m_zslFreeNode(x); /* Here is where x->ele is actually released. */
         removed++;
         x = next;
@@ -569,7 +1009,7 @@ unsigned long m_zslDeleteRangeByScore(m_zskiplist *zsl, m_zrangespec *range, dic
     return removed;
 }
 
-unsigned long m_zslDeleteRangeByLex(m_zskiplist *zsl, m_zlexrangespec *range, dict *dict) {
+unsigned long m_zslDeleteRangeByLex(m_zskiplist *zsl, m_zlexrangespec *range, m_zindex *zi) {
     m_zskiplistNode *update[ZSKIPLIST_MAXLEVEL], *x;
     unsigned long removed = 0;
     int i;
@@ -588,7 +1028,7 @@ unsigned long m_zslDeleteRangeByLex(m_zskiplist *zsl, m_zlexrangespec *range, di
     while (x && m_zslLexValueLteMax(x->ele, range)) {
         m_zskiplistNode *next = x->level[0].forward;
         m_zslDeleteNode(zsl, x, update);
-        m_dictDelete(dict, x->ele);
+        m_zindexDelete(zi, x);
         m_zslFreeNode(x); /* Here is where x->ele is actually released. */
         removed++;
         x = next;
@@ -696,46 +1136,244 @@ int mscoreGetNum(const char *s, size_t slen) {
     return score_num;
 }
 
-int mscoreParse(const char *s, size_t slen, scoretype **score) {
-    const char *start = s;
-    int len = 0, i = 0;
-    double tmp_score;
-    int score_num = mscoreGetNum(s, slen);
+/* Names of the MSCORE_TYPE_* types in a schema. */
+static const char *mscoreTypeNames[MSCORE_TYPES] = {"double", "int", "float"};
+
+/* Parse a score schema like "int#double#float" into '*types', one
+ * MSCORE_TYPE_* per dimension. '*types' is set to NULL when every dimension
+ * is a double, which is the schema of the sorted sets created without one.
+ * Returns the number of dimensions, or -1 if the schema is not valid. */
+int mscoreParseSchema(const char *s, size_t slen, unsigned char **types) {
+    int score_num = mscoreGetNum(s, slen), typed = 0, i = 0, t;
     if (score_num <= 0 || score_num > MAX_SCORE_NUM) {
         return -1;
     }
 
-    scoretype *multi_score = (scoretype *)RedisModule_Calloc(1, sizeof(scoretype) + score_num * sizeof(double));
-    multi_score->score_num = score_num;
-    const char *iter = s;
-    while (iter <= s + slen) {
-        if (*iter == SCORE_DELIMITER || iter == s + slen) {
-            if (m_string2d(start, len, &tmp_score) != 1) {
-                goto fail;
-            }
+    unsigned char *schema = RedisModule_Alloc(score_num);
+    const char *start = s, *iter;
+    for (iter = s; iter <= s + slen; iter++) {
+        if (iter != s + slen && *iter != SCORE_DELIMITER) continue;
 
-            if (isnan(tmp_score)) {
-                goto fail;
-            }
+        size_t len = iter - start;
+        for (t = 0; t < MSCORE_TYPES; t++) {
+            if (strlen(mscoreTypeNames[t]) == len && !strncasecmp(mscoreTypeNames[t], start, len)) break;
+        }
+        if (t == MSCORE_TYPES) {
+            RedisModule_Free(schema);
+            return -1;
+        }
+        schema[i++] = t;
+        typed |= t != MSCORE_TYPE_DOUBLE;
+        start = iter + 1;
+    }
 
-            multi_score->scores[i++] = tmp_score;
-            start = iter + 1;
-            len = 0;
-            iter++;
-            continue;
+    if (!typed) {
+        RedisModule_Free(schema);
+        schema = NULL;
+    }
+    *types = schema;
+    return score_num;
+}
+
+/* The inverse of mscoreParseSchema(), 'types' must not be NULL. */
+sds mscoreSchema2String(const unsigned char *types, int score_num) {
+    sds schema = m_sdsempty();
+
+    for (int i = 0; i < score_num; i++) {
+        if (i) schema = m_sdscatlen(schema, "#", 1);
+        schema = m_sdscat(schema, mscoreTypeNames[types[i]]);
+    }
+    return schema;
+}
+
+/* Check that the double 'd' of a dimension of type 'type' fits its type,
+ * rounding it to single precision for MSCORE_TYPE_FLOAT. Returns -1 if it
+ * does not. Int dimensions hold an int64_t, which always fits. */
+static int mscoreFitType(double *d, unsigned char type) {
+    if (type == MSCORE_TYPE_FLOAT) {
+        if (isfinite(*d) && fabs(*d) > FLT_MAX) return -1;
+        *d = (float)*d;
+    }
+    return 0;
+}
+
+/* Make 'score', for instance the result of an increment, fit the schema
+ * 'types' (that may be NULL). Returns -1 if a dimension does not fit its
+ * type, in that case 'score' may be partially rounded. */
+int mscoreFitSchema(scoretype *score, const unsigned char *types) {
+    if (types == NULL) return 0;
+    for (int i = 0; i < score->score_num; i++) {
+        if (mscoreFitType(&score->scores[i], types[i]) != 0) return -1;
+    }
+    return 0;
+}
+
+/* Convert the int dimensions of 'score', of schema 'types' (that may be
+ * NULL), to doubles, rounding the integers beyond 2^53. */
+void mscoreIntToDouble(scoretype *score, const unsigned char *types) {
+    if (types == NULL) return;
+    for (int i = 0; i < score->score_num; i++) {
+        if (types[i] == MSCORE_TYPE_INT) score->scores[i] = (double)mscoreGetInt(&score->scores[i]);
+    }
+}
+
+/* Truncate the double 'd' to an int64_t, saturating to its range. NaN is
+ * converted to INT64_MIN. */
+static int64_t mscoreDouble2Int(double d) {
+    if (d >= 0x1p63) return INT64_MAX;
+    if (!(d > -0x1p63)) return INT64_MIN;
+    return (int64_t)d;
+}
+
+/* The inverse of mscoreIntToDouble(), for instance for the scores saved
+ * when the int dimensions were stored as doubles holding an integer. */
+void mscoreDoubleToInt(scoretype *score, const unsigned char *types) {
+    if (types == NULL) return;
+    for (int i = 0; i < score->score_num; i++) {
+        if (types[i] == MSCORE_TYPE_INT) mscoreSetInt(&score->scores[i], mscoreDouble2Int(score->scores[i]));
+    }
+}
+
+/* Powers of ten exactly representable as doubles. */
+static const double mscorePow10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                     1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+/* Parse a double like m_string2d(). Decimal numbers with at most 19 digits,
+ * an integer part of at most 2^53 once the point is removed, and a decimal
+ * exponent of at most 22 are the result of a single exact multiplication or
+ * division (Clinger's fast path), so they are converted without strtod(). */
+static int mscoreString2d(const char *s, size_t slen, double *dp) {
+    const char *p = s, *end = s + slen;
+    uint64_t mantissa = 0;
+    int digits = 0, exp10 = 0, neg = 0;
+
+    if (p < end && (*p == '-' || *p == '+')) neg = *p++ == '-';
+    for (; p < end && *p >= '0' && *p <= '9'; p++, digits++) {
+        mantissa = mantissa * 10 + (*p - '0');
+        if (digits == 19) goto slowpath;
+    }
+    if (p < end && *p == '.') {
+        for (p++; p < end && *p >= '0' && *p <= '9'; p++, digits++, exp10--) {
+            mantissa = mantissa * 10 + (*p - '0');
+            if (digits == 19) goto slowpath;
         }
-        len++;
-        iter++;
     }
+    if (digits == 0) goto slowpath;
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        int e = 0, edigits = 0, eneg = 0;
+        p++;
+        if (p < end && (*p == '-' || *p == '+')) eneg = *p++ == '-';
+        for (; p < end && *p >= '0' && *p <= '9' && edigits < 4; p++, edigits++) e = e * 10 + (*p - '0');
+        if (edigits == 0) goto slowpath;
+        exp10 += eneg ? -e : e;
+    }
+    if (p != end || mantissa > (1ULL << 53) || exp10 < -22 || exp10 > 22) goto slowpath;
+
+    *dp = exp10 < 0 ? (double)mantissa / mscorePow10[-exp10] : (double)mantissa * mscorePow10[exp10];
+    if (neg) *dp = -*dp;
+    return 1;
+
+slowpath:
+    return m_string2d(s, slen, dp);
+}
+
+/* Parse a dimension of type 'type' into 'd', an int64_t for the int
+ * dimensions. When 'bound' is set the dimension is the bound of a range:
+ * int dimensions then also accept -inf and inf, parsed as INT64_MIN and
+ * INT64_MAX, and float dimensions are not rounded. Returns 0 if the
+ * dimension is not valid. */
+static int mscoreParseDim(const char *s, size_t slen, unsigned char type, int bound, double *d) {
+    long long ll;
+
+    if (type == MSCORE_TYPE_INT) {
+        if (m_string2ll(s, slen, &ll)) {
+            mscoreSetInt(d, ll);
+            return 1;
+        }
+        if (!bound || !mscoreString2d(s, slen, d) || !isinf(*d)) return 0;
+        mscoreSetInt(d, *d > 0 ? INT64_MAX : INT64_MIN);
+        return 1;
+    }
+    if (!mscoreString2d(s, slen, d) || isnan(*d)) return 0;
+    return bound || mscoreFitType(d, type) == 0;
+}
+
+/* Parse a score like "1#2.5#-inf" of at most 'max' dimensions into 'scores',
+ * see mscoreParseTo(). */
+static int mscoreParseDims(const char *s, size_t slen, const unsigned char *types, int max, int bound,
+                           double *scores) {
+    const char *end = s + slen, *next;
+    int i = 0;
+
+    if (slen == 0) return -1;
+    for (;;) {
+        next = memchr(s, SCORE_DELIMITER, end - s);
+        if (next == NULL) next = end;
+        if (i == max) return -1;
+
+        if (!mscoreParseDim(s, next - s, types ? types[i] : MSCORE_TYPE_DOUBLE, bound, &scores[i])) return -1;
+
+        i++;
+        if (next == end) return i;
+        s = next + 1;
+    }
+}
+
+/* Parse a score like "1#2.5#-inf" of at most 'max' dimensions into 'scores',
+ * with a single scan of the string, looking for the delimiters with memchr().
+ * When 'types' is not NULL it must have 'max' dimensions: integer dimensions
+ * are then parsed with m_string2ll() as exact int64_t values and float
+ * dimensions are rounded.
+ * Returns the number of dimensions, or -1 if the score is not valid. */
+int mscoreParseTo(const char *s, size_t slen, const unsigned char *types, int max, double *scores) {
+    return mscoreParseDims(s, slen, types, max, 0, scores);
+}
+
+/* Like mscoreParseTo(), for a score given as its dimensions packed as little
+ * endian doubles, or int64_t for the int dimensions, so its length is a
+ * multiple of 8. */
+int mscoreParseBinary(const char *s, size_t slen, const unsigned char *types, int max, double *scores) {
+    const unsigned char *p = (const unsigned char *)s;
+    int score_num = slen / sizeof(double);
+
+    if (slen == 0 || slen % sizeof(double) || score_num > max) return -1;
+    for (int i = 0; i < score_num; i++, p += sizeof(double)) {
+        uint64_t u = 0;
+        for (int k = 0; k < 8; k++) u |= (uint64_t)p[k] << (k * 8);
+        memcpy(&scores[i], &u, sizeof(double));
+        if (types && types[i] == MSCORE_TYPE_INT) continue;
+        if (isnan(scores[i]) || mscoreFitType(&scores[i], types ? types[i] : MSCORE_TYPE_DOUBLE) != 0) return -1;
+    }
+    return score_num;
+}
+
+static int mscoreParseNew(const char *s, size_t slen, const unsigned char *types, int max, int bound,
+                          scoretype **score) {
+    double scores[MAX_SCORE_NUM];
+    int score_num = mscoreParseDims(s, slen, types, max, bound, scores);
 
-    *score = multi_score;
+    if (score_num <= 0) return -1;
+    *score = RedisModule_Alloc(sizeof(scoretype) + score_num * sizeof(double));
+    (*score)->score_num = score_num;
+    memcpy((*score)->scores, scores, score_num * sizeof(double));
     return score_num;
-fail:
-    RedisModule_Free(multi_score);
-    return -1;
 }
 
-inline int mscoreCmp(scoretype *s1, scoretype *s2) {
+/* Parse a score like "1#2.5#-inf" of at most 'max' dimensions into a new
+ * scoretype, see mscoreParseTo(). */
+int mscoreParse(const char *s, size_t slen, const unsigned char *types, int max, scoretype **score) {
+    return mscoreParseNew(s, slen, types, max, 0, score);
+}
+
+/* Like mscoreParse(), for the bound of a range: the int dimensions accept
+ * -inf and inf too, and the float dimensions are not rounded, so that the
+ * bound keeps its meaning. */
+int mscoreParseBound(const char *s, size_t slen, const unsigned char *types, int max, scoretype **score) {
+    return mscoreParseNew(s, slen, types, max, 1, score);
+}
+
+/* Compare two scores of schema 'types' (that may be NULL). */
+inline int mscoreCmp(scoretype *s1, scoretype *s2, const unsigned char *types) {
     assert(s1 != NULL);
     assert(s2 != NULL);
     assert(s1->score_num == s2->score_num);
@@ -746,7 +1384,10 @@ inline int mscoreCmp(scoretype *s1, scoretype *s2) {
     double *s2_p = (double *)s2->scores;
 
     for (i = 0; i < num; i++) {
-        if (s1_p[i] != s2_p[i]) {
+        if (types && types[i] == MSCORE_TYPE_INT) {
+            int64_t a = mscoreGetInt(&s1_p[i]), b = mscoreGetInt(&s2_p[i]);
+            if (a != b) return a < b ? -1 : 1;
+        } else if (s1_p[i] != s2_p[i]) {
             return s1_p[i] < s2_p[i] ? -1 : 1;
         }
     }
@@ -754,32 +1395,67 @@ inline int mscoreCmp(scoretype *s1, scoretype *s2) {
     return 0;
 }
 
-sds mscore2String(scoretype *score) {
-    assert(score != NULL);
-    char scorebuf[128];
-    int scorelen;
+/* Print a double holding a single precision value with the least digits
+ * needed to read back the same float. */
+static int mscoreFloat2String(char *buf, size_t len, double value) {
+    int n = 0;
+
+    if (!isfinite(value) || value == 0) return m_d2string(buf, len, value);
+    for (int precision = 6; precision <= 9; precision++) {
+        n = snprintf(buf, len, "%.*g", precision, value);
+        if ((float)strtod(buf, NULL) == (float)value) break;
+    }
+    return n;
+}
 
-    sds score_str = m_sdsempty();
+/* Print 'score' in 'buf' with the '#' delimiter, each dimension according to
+ * its type in 'types' (that may be NULL for a schema only made of doubles).
+ * 'buf' must have room for MSCORE_MAX_CHARS bytes. Returns the length of the
+ * string, which is not null terminated. */
+size_t mscoreFormat(char *buf, scoretype *score, const unsigned char *types) {
+    assert(score != NULL);
+    size_t len = 0;
 
     int i = 0;
     for (; i < score->score_num; i++) {
-        scorelen = m_d2string(scorebuf, sizeof(scorebuf), score->scores[i]);
-        score_str = m_sdscatlen(score_str, scorebuf, scorelen);
+        unsigned char type = types ? types[i] : MSCORE_TYPE_DOUBLE;
+        if (type == MSCORE_TYPE_INT)
+            len += m_ll2string(buf + len, MSCORE_MAX_DIM_CHARS, mscoreGetInt(&score->scores[i]));
+        else if (type == MSCORE_TYPE_FLOAT)
+            len += mscoreFloat2String(buf + len, MSCORE_MAX_DIM_CHARS, score->scores[i]);
+        else
+            len += m_d2string(buf + len, MSCORE_MAX_DIM_CHARS, score->scores[i]);
         if (i < score->score_num - 1) {
-            score_str = m_sdscatlen(score_str, "#", 1);
+            buf[len++] = SCORE_DELIMITER;
         }
     }
 
-    return score_str;
+    return len;
 }
 
-int mscoreAdd(scoretype *s1, scoretype *s2) {
+sds mscore2String(scoretype *score, const unsigned char *types) {
+    char buf[MSCORE_MAX_CHARS];
+    return m_sdsnewlen(buf, mscoreFormat(buf, score, types));
+}
+
+/* Add 's2' to 's1', both of schema 'types' (that may be NULL). Returns -1 if
+ * a dimension becomes NaN and 1 if an int dimension overflows, 's1' is then
+ * partially updated. */
+int mscoreAdd(scoretype *s1, scoretype *s2, const unsigned char *types) {
     assert(s1 != NULL);
     assert(s2 != NULL);
     assert(s1->score_num == s2->score_num);
 
     int i = 0;
     for (; i < s1->score_num; i++) {
+        if (types && types[i] == MSCORE_TYPE_INT) {
+            int64_t sum;
+            if (__builtin_add_overflow(mscoreGetInt(&s1->scores[i]), mscoreGetInt(&s2->scores[i]), &sum)) {
+                return 1;
+            }
+            mscoreSetInt(&s1->scores[i], sum);
+            continue;
+        }
         s1->scores[i] += s2->scores[i];
         if (isnan(s1->scores[i])) {
             return -1;
@@ -789,17 +1465,36 @@ int mscoreAdd(scoretype *s1, scoretype *s2) {
     return 0;
 }
 
-void mscoreAddIgnoreNan(scoretype *s1, scoretype *s2) {
+/* Round the double 'd' of a float dimension to single precision, the values
+ * too large for a float becoming infinite. */
+static double mscoreRoundFloat(double d) {
+    if (d > FLT_MAX) return INFINITY;
+    if (d < -FLT_MAX) return -INFINITY;
+    return (float)d;
+}
+
+/* Add 's2' to 's1' for the set operations, which don't fail: a dimension
+ * becoming NaN is set to 0, an int dimension saturates to the int64_t range
+ * and a float dimension is rounded, becoming infinite when too large. */
+void mscoreAddIgnoreNan(scoretype *s1, scoretype *s2, const unsigned char *types) {
     assert(s1 != NULL);
     assert(s2 != NULL);
     assert(s1->score_num == s2->score_num);
 
     for (int i = 0; i < s1->score_num; i++) {
+        if (types && types[i] == MSCORE_TYPE_INT) {
+            int64_t a = mscoreGetInt(&s1->scores[i]), b = mscoreGetInt(&s2->scores[i]), sum;
+            if (__builtin_add_overflow(a, b, &sum)) sum = b > 0 ? INT64_MAX : INT64_MIN;
+            mscoreSetInt(&s1->scores[i], sum);
+            continue;
+        }
         s1->scores[i] += s2->scores[i];
         if (isnan(s1->scores[i])) {
             /* If one dimension of the score become NaN,
              * set it to 0. */
             s1->scores[i] = 0;
+        } else if (types && types[i] == MSCORE_TYPE_FLOAT) {
+            s1->scores[i] = mscoreRoundFloat(s1->scores[i]);
         }
     }
 }
@@ -810,17 +1505,42 @@ scoretype *mnewScore(int score_num) {
     return score;
 }
 
-void mscoreMulWithWeight(scoretype *dst, scoretype *base, double weight) {
+/* Multiply the int dimension 'v' by the weight 'w' of a set operation,
+ * rounding the product to the nearest integer and saturating it to the
+ * int64_t range. The product is computed as a long double, exact for the
+ * integral weights as long as it fits. A NaN product is 0, like for the
+ * other dimensions. */
+static int64_t mscoreMulInt(int64_t v, double w) {
+    if (w == 1) return v;
+
+    long double p = (long double)v * w;
+    if (isnan(p)) return 0;
+    p += p < 0 ? -0.5L : 0.5L;
+    if (p >= 0x1p63L) return INT64_MAX;
+    if (p <= -0x1p63L) return INT64_MIN;
+    return (int64_t)p;
+}
+
+/* Set 'dst' to 'base' multiplied by 'weight', both of schema 'types' (that
+ * may be NULL), with the same handling of NaN, int and float dimensions of
+ * mscoreAddIgnoreNan(). 'dst' may be 'base'. */
+void mscoreMulWithWeight(scoretype *dst, scoretype *base, double weight, const unsigned char *types) {
     assert(dst != NULL);
     assert(base != NULL);
     assert(dst->score_num == base->score_num);
 
     for (int i = 0; i < dst->score_num; i++) {
+        if (types && types[i] == MSCORE_TYPE_INT) {
+            mscoreSetInt(&dst->scores[i], mscoreMulInt(mscoreGetInt(&base->scores[i]), weight));
+            continue;
+        }
         dst->scores[i] = base->scores[i] * weight;
         /* If one dimension of the score become NaN,
          * set it to 0. */
         if (isnan(dst->scores[i])) {
             dst->scores[i] = 0;
+        } else if (types && types[i] == MSCORE_TYPE_FLOAT) {
+            dst->scores[i] = mscoreRoundFloat(dst->scores[i]);
         }
     }
 }
@@ -833,4 +1553,621 @@ void mscoreAssign(scoretype *target, scoretype *src) {
     for (int i = 0; i < target->score_num; i++) {
         target->scores[i] = src->scores[i];
     }
-}
\ No newline at end of file
+}
+
+/* Kernels of m_zscoreOps for the schemas only made of doubles, which ignore
+ * their 'types' argument. MSCORE_KERNELS(name, N, KN) defines them for a
+ * fixed number of dimensions, so that the compiler can unroll the loops, while
+ * the generic kernels take the number of dimensions from the first argument,
+ * or from the 'n' argument for the keys (KN). Unlike the mscore*() functions
+ * above they don't check their arguments: the kernels are selected once per
+ * schema by m_zscoreGetOps(). */
+#define MSCORE_KERNELS(name, N, KN)                                                   \
+    static int mscoreCmp##name(scoretype *s1, scoretype *s2,                          \
+                               const unsigned char *t) {                              \
+        for (int i = 0; i < (N); i++) {                                               \
+            if (s1->scores[i] != s2->scores[i])                                       \
+                return s1->scores[i] < s2->scores[i] ? -1 : 1;                        \
+        }                                                                             \
+        return 0;                                                                     \
+    }                                                                                 \
+    static int mscoreAdd##name(scoretype *s1, scoretype *s2,                          \
+                               const unsigned char *t) {                              \
+        for (int i = 0; i < (N); i++) {                                               \
+            s1->scores[i] += s2->scores[i];                                           \
+            if (isnan(s1->scores[i])) return -1;                                      \
+        }                                                                             \
+        return 0;                                                                     \
+    }                                                                                 \
+    static void mscoreAddIgnoreNan##name(scoretype *s1, scoretype *s2,                \
+                                         const unsigned char *t) {                    \
+        for (int i = 0; i < (N); i++) {                                               \
+            s1->scores[i] += s2->scores[i];                                           \
+            if (isnan(s1->scores[i])) s1->scores[i] = 0;                              \
+        }                                                                             \
+    }                                                                                 \
+    static void mscoreMulWithWeight##name(scoretype *s1, scoretype *s2, double w,     \
+                                          const unsigned char *t) {                   \
+        for (int i = 0; i < (N); i++) {                                               \
+            s1->scores[i] = s2->scores[i] * w;                                        \
+            if (isnan(s1->scores[i])) s1->scores[i] = 0;                              \
+        }                                                                             \
+    }                                                                                 \
+    static void mscoreAssign##name(scoretype *s1, scoretype *s2) {                    \
+        memcpy(s1->scores, s2->scores, (N) * sizeof(double));                         \
+    }                                                                                 \
+    static int mscoreKeyCmp##name(const uint64_t *k1, const uint64_t *k2, size_t n) { \
+        for (size_t i = 0; i < (KN); i++) {                                           \
+            if (k1[i] != k2[i]) return k1[i] < k2[i] ? -1 : 1;                        \
+        }                                                                             \
+        return 0;                                                                     \
+    }                                                                                 \
+    static const m_zscoreOps mscoreOps##name = {                                      \
+        mscoreCmp##name, mscoreAdd##name, mscoreAddIgnoreNan##name,                   \
+        mscoreMulWithWeight##name, mscoreAssign##name, mscoreKeyCmp##name,            \
+    };
+
+MSCORE_KERNELS(1, 1, 1)
+MSCORE_KERNELS(2, 2, 2)
+MSCORE_KERNELS(3, 3, 3)
+MSCORE_KERNELS(4, 4, 4)
+MSCORE_KERNELS(Generic, s1->score_num, n)
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+
+/* AVX2 kernels for wide schemas, processing four dimensions per instruction
+ * and the remaining ones with the scalar code. They are compiled for AVX2
+ * whatever the flags of the build and only selected by m_zscoreGetOps() when
+ * the CPU supports it. Compares look for the first lane that is not equal
+ * with a movemask, NaN handling is done with an unordered compare mask. */
+#define MSCORE_AVX2 __attribute__((target("avx2")))
+#define MSCORE_AVX2_MIN_SCORE_NUM 8
+
+MSCORE_AVX2 static int mscoreCmpAVX2(scoretype *s1, scoretype *s2, const unsigned char *types) {
+    int num = s1->score_num, i;
+
+    for (i = 0; i + 4 <= num; i += 4) {
+        __m256d a = _mm256_loadu_pd(s1->scores + i);
+        __m256d b = _mm256_loadu_pd(s2->scores + i);
+        int eq = _mm256_movemask_pd(_mm256_cmp_pd(a, b, _CMP_EQ_OQ));
+        if (eq != 0xf) {
+            i += __builtin_ctz(~eq);
+            return s1->scores[i] < s2->scores[i] ? -1 : 1;
+        }
+    }
+    for (; i < num; i++) {
+        if (s1->scores[i] != s2->scores[i])
+            return s1->scores[i] < s2->scores[i] ? -1 : 1;
+    }
+    return 0;
+}
+
+MSCORE_AVX2 static int mscoreAddAVX2(scoretype *s1, scoretype *s2, const unsigned char *types) {
+    int num = s1->score_num, i, nan = 0;
+
+    for (i = 0; i + 4 <= num; i += 4) {
+        __m256d sum = _mm256_add_pd(_mm256_loadu_pd(s1->scores + i), _mm256_loadu_pd(s2->scores + i));
+        nan |= _mm256_movemask_pd(_mm256_cmp_pd(sum, sum, _CMP_UNORD_Q));
+        _mm256_storeu_pd(s1->scores + i, sum);
+    }
+    for (; i < num; i++) {
+        s1->scores[i] += s2->scores[i];
+        nan |= isnan(s1->scores[i]);
+    }
+    return nan ? -1 : 0;
+}
+
+MSCORE_AVX2 static void mscoreAddIgnoreNanAVX2(scoretype *s1, scoretype *s2, const unsigned char *types) {
+    int num = s1->score_num, i;
+
+    for (i = 0; i + 4 <= num; i += 4) {
+        __m256d sum = _mm256_add_pd(_mm256_loadu_pd(s1->scores + i), _mm256_loadu_pd(s2->scores + i));
+        /* Lanes holding NaN are cleared, so they become 0. */
+        _mm256_storeu_pd(s1->scores + i, _mm256_and_pd(sum, _mm256_cmp_pd(sum, sum, _CMP_ORD_Q)));
+    }
+    for (; i < num; i++) {
+        s1->scores[i] += s2->scores[i];
+        if (isnan(s1->scores[i])) s1->scores[i] = 0;
+    }
+}
+
+MSCORE_AVX2 static void mscoreMulWithWeightAVX2(scoretype *s1, scoretype *s2, double w, const unsigned char *types) {
+    int num = s1->score_num, i;
+    __m256d weight = _mm256_set1_pd(w);
+
+    for (i = 0; i + 4 <= num; i += 4) {
+        __m256d mul = _mm256_mul_pd(_mm256_loadu_pd(s2->scores + i), weight);
+        _mm256_storeu_pd(s1->scores + i, _mm256_and_pd(mul, _mm256_cmp_pd(mul, mul, _CMP_ORD_Q)));
+    }
+    for (; i < num; i++) {
+        s1->scores[i] = s2->scores[i] * w;
+        if (isnan(s1->scores[i])) s1->scores[i] = 0;
+    }
+}
+
+MSCORE_AVX2 static int mscoreKeyCmpAVX2(const uint64_t *k1, const uint64_t *k2, size_t n) {
+    size_t i;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(k1 + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(k2 + i));
+        int eq = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(a, b)));
+        if (eq != 0xf) {
+            i += __builtin_ctz(~eq);
+            return k1[i] < k2[i] ? -1 : 1;
+        }
+    }
+    for (; i < n; i++) {
+        if (k1[i] != k2[i]) return k1[i] < k2[i] ? -1 : 1;
+    }
+    return 0;
+}
+
+static const m_zscoreOps mscoreOpsAVX2 = {
+    mscoreCmpAVX2, mscoreAddAVX2, mscoreAddIgnoreNanAVX2,
+    mscoreMulWithWeightAVX2, mscoreAssignGeneric, mscoreKeyCmpAVX2,
+};
+
+static const m_zscoreOps mscoreOpsTypedAVX2 = {
+    mscoreCmp, mscoreAdd, mscoreAddIgnoreNan,
+    mscoreMulWithWeight, mscoreAssignGeneric, mscoreKeyCmpAVX2,
+};
+#endif
+
+/* Kernels of the schemas with typed dimensions, which handle every dimension
+ * according to its type. Their score keys are compared like the others. */
+static const m_zscoreOps mscoreOpsTyped = {
+    mscoreCmp, mscoreAdd, mscoreAddIgnoreNan,
+    mscoreMulWithWeight, mscoreAssignGeneric, mscoreKeyCmpGeneric,
+};
+
+/* Return the score kernels to use for sorted sets with 'score_num'
+ * dimensions of schema 'types'. Schemas only made of doubles with up to four
+ * dimensions get unrolled kernels, wide ones the AVX2 kernels when
+ * available, for the score keys only when the schema has typed dimensions. */
+const m_zscoreOps *m_zscoreGetOps(unsigned char score_num, const unsigned char *types) {
+    if (types != NULL) {
+#ifdef MSCORE_AVX2
+        if (score_num >= MSCORE_AVX2_MIN_SCORE_NUM && __builtin_cpu_supports("avx2"))
+            return &mscoreOpsTypedAVX2;
+#endif
+        return &mscoreOpsTyped;
+    }
+    switch (score_num) {
+        case 1: return &mscoreOps1;
+        case 2: return &mscoreOps2;
+        case 3: return &mscoreOps3;
+        case 4: return &mscoreOps4;
+    }
+#ifdef MSCORE_AVX2
+    if (score_num >= MSCORE_AVX2_MIN_SCORE_NUM && __builtin_cpu_supports("avx2"))
+        return &mscoreOpsAVX2;
+#endif
+    return &mscoreOpsGeneric;
+}
+
+/* Encode 'score', of schema 'types' (that may be NULL), as a score key, one
+ * word per dimension: the bits of a positive double are flipped in the sign
+ * bit and the ones of a negative double are all flipped, so that the words
+ * compare as unsigned integers in the same order as the doubles. -0 is
+ * encoded as 0 since they compare equal. An int dimension only has its sign
+ * bit flipped. 'key' must have room for score->score_num words. */
+void m_zscoreToKey(scoretype *score, const unsigned char *types, uint64_t *key) {
+    for (int i = 0; i < score->score_num; i++) {
+        if (types && types[i] == MSCORE_TYPE_INT) {
+            key[i] = (uint64_t)mscoreGetInt(&score->scores[i]) ^ (1ULL << 63);
+            continue;
+        }
+        double d = score->scores[i] == 0 ? 0 : score->scores[i];
+        uint64_t u;
+
+        memcpy(&u, &d, sizeof(u));
+        key[i] = (u & (1ULL << 63)) ? ~u : u | (1ULL << 63);
+    }
+}
+/* ----------------------- Listpack-encoded sorted set ------------------------
+ *
+ * Every element is stored as two consecutive listpack entries: the member
+ * bytes followed by the raw score vector (score_num doubles). Elements are
+ * kept ordered by score and then by member, exactly like the skiplist. */
+
+/* Copy the score vector stored at 'sptr' into 'score', that must already be
+ * sized for the schema of the sorted set. */
+void m_zzlGetScore(unsigned char *sptr, scoretype *score) {
+    uint32_t len;
+    unsigned char *vstr;
+
+    assert(sptr != NULL);
+    vstr = m_lpGet(sptr, &len);
+    assert(len == score->score_num * sizeof(double));
+    memcpy(score->scores, vstr, len);
+}
+
+/* Compare the score vector stored at 'sptr' with 'score', of schema 'types'
+ * (that may be NULL), with the same semantic of mscoreCmp(). */
+int m_zzlScoreCmp(unsigned char *sptr, scoretype *score, const unsigned char *types) {
+    uint32_t len;
+    unsigned char *vstr = m_lpGet(sptr, &len);
+    double d;
+
+    assert(len == score->score_num * sizeof(double));
+    for (int i = 0; i < score->score_num; i++) {
+        memcpy(&d, vstr + i * sizeof(double), sizeof(double));
+        if (types && types[i] == MSCORE_TYPE_INT) {
+            int64_t a = mscoreGetInt(&d), b = mscoreGetInt(&score->scores[i]);
+            if (a != b) return a < b ? -1 : 1;
+        } else if (d != score->scores[i]) {
+            return d < score->scores[i] ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+/* Compare element in sorted set with given element. */
+int m_zzlCompareElements(unsigned char *eptr, const char *cstr, size_t clen) {
+    uint32_t len;
+    unsigned char *vstr = m_lpGet(eptr, &len);
+    size_t minlen = (len < clen) ? len : clen;
+    int cmp = memcmp(vstr, cstr, minlen);
+    if (cmp == 0) return (long)len - (long)clen;
+    return cmp;
+}
+
+unsigned int m_zzlLength(unsigned char *zl) {
+    return m_lpLength(zl) / 2;
+}
+
+/* Move to next entry based on the values in eptr and sptr. Both are set to
+ * NULL when there is no next entry. */
+void m_zzlNext(unsigned char *zl, unsigned char **eptr, unsigned char **sptr) {
+    unsigned char *_eptr, *_sptr;
+    assert(*eptr != NULL && *sptr != NULL);
+
+    _eptr = m_lpNext(zl, *sptr);
+    if (_eptr != NULL) {
+        _sptr = m_lpNext(zl, _eptr);
+        assert(_sptr != NULL);
+    } else {
+        /* No next entry. */
+        _sptr = NULL;
+    }
+
+    *eptr = _eptr;
+    *sptr = _sptr;
+}
+
+/* Move to the previous entry based on the values in eptr and sptr. Both are
+ * set to NULL when there is no previous entry. */
+void m_zzlPrev(unsigned char *zl, unsigned char **eptr, unsigned char **sptr) {
+    unsigned char *_eptr, *_sptr;
+    assert(*eptr != NULL && *sptr != NULL);
+
+    _sptr = m_lpPrev(zl, *eptr);
+    if (_sptr != NULL) {
+        _eptr = m_lpPrev(zl, _sptr);
+        assert(_eptr != NULL);
+    } else {
+        /* No previous entry. */
+        _eptr = NULL;
+    }
+
+    *eptr = _eptr;
+    *sptr = _sptr;
+}
+
+int m_zzlValueGteMin(unsigned char *sptr, m_zrangespec *spec) {
+    int cmp = m_zzlScoreCmp(sptr, spec->min, spec->types);
+    return spec->minex ? (cmp > 0) : (cmp >= 0);
+}
+
+int m_zzlValueLteMax(unsigned char *sptr, m_zrangespec *spec) {
+    int cmp = m_zzlScoreCmp(sptr, spec->max, spec->types);
+    return spec->maxex ? (cmp < 0) : (cmp <= 0);
+}
+
+/* Returns if there is a part of the zset is in range. Should only be used
+ * internally by m_zzlFirstInRange and m_zzlLastInRange. */
+int m_zzlIsInRange(unsigned char *zl, m_zrangespec *range) {
+    unsigned char *p;
+
+    /* Test for ranges that will always be empty. */
+    int cmp = mscoreCmp(range->min, range->max, range->types);
+    if (cmp > 0 || (cmp == 0 && (range->minex || range->maxex)))
+        return 0;
+
+    p = m_lpLast(zl); /* Last score. */
+    if (p == NULL) return 0; /* Empty sorted set */
+    if (!m_zzlValueGteMin(p, range)) return 0;
+
+    p = m_lpSeek(zl, 1); /* First score. */
+    assert(p != NULL);
+    if (!m_zzlValueLteMax(p, range)) return 0;
+    return 1;
+}
+
+/* Find pointer to the first element contained in the specified range.
+ * Returns NULL when no element is contained in the range. */
+unsigned char *m_zzlFirstInRange(unsigned char *zl, m_zrangespec *range) {
+    unsigned char *eptr = m_lpFirst(zl), *sptr;
+
+    /* If everything is out of range, return early. */
+    if (!m_zzlIsInRange(zl, range)) return NULL;
+
+    while (eptr != NULL) {
+        sptr = m_lpNext(zl, eptr);
+        assert(sptr != NULL);
+
+        if (m_zzlValueGteMin(sptr, range)) {
+            /* Check if score <= max. */
+            if (m_zzlValueLteMax(sptr, range)) return eptr;
+            return NULL;
+        }
+
+        /* Move to next element. */
+        eptr = m_lpNext(zl, sptr);
+    }
+
+    return NULL;
+}
+
+/* Find pointer to the last element contained in the specified range.
+ * Returns NULL when no element is contained in the range. */
+unsigned char *m_zzlLastInRange(unsigned char *zl, m_zrangespec *range) {
+    unsigned char *eptr = m_lpSeek(zl, -2), *sptr;
+
+    /* If everything is out of range, return early. */
+    if (!m_zzlIsInRange(zl, range)) return NULL;
+
+    while (eptr != NULL) {
+        sptr = m_lpNext(zl, eptr);
+        assert(sptr != NULL);
+
+        if (m_zzlValueLteMax(sptr, range)) {
+            /* Check if score >= min. */
+            if (m_zzlValueGteMin(sptr, range)) return eptr;
+            return NULL;
+        }
+
+        /* Move to previous element by moving to the score of previous element.
+         * When this returns NULL, we know there also is no element. */
+        sptr = m_lpPrev(zl, eptr);
+        if (sptr != NULL) {
+            eptr = m_lpPrev(zl, sptr);
+            assert(eptr != NULL);
+        } else {
+            eptr = NULL;
+        }
+    }
+
+    return NULL;
+}
+
+/* Compare the member stored at 'p' with a lex range bound, handling
+ * shared_minstring and shared_maxstring as -inf and +inf. */
+static int m_zzlLexCmp(unsigned char *p, sds bound) {
+    if (bound == shared_minstring) return 1;
+    if (bound == shared_maxstring) return -1;
+    return m_zzlCompareElements(p, bound, sdslen(bound));
+}
+
+int m_zzlLexValueGteMin(unsigned char *p, m_zlexrangespec *spec) {
+    int cmp = m_zzlLexCmp(p, spec->min);
+    return spec->minex ? (cmp > 0) : (cmp >= 0);
+}
+
+int m_zzlLexValueLteMax(unsigned char *p, m_zlexrangespec *spec) {
+    int cmp = m_zzlLexCmp(p, spec->max);
+    return spec->maxex ? (cmp < 0) : (cmp <= 0);
+}
+
+/* Returns if there is a part of the zset is in range. Should only be used
+ * internally by m_zzlFirstInLexRange and m_zzlLastInLexRange. */
+int m_zzlIsInLexRange(unsigned char *zl, m_zlexrangespec *range) {
+    unsigned char *p;
+
+    /* Test for ranges that will always be empty. */
+    int cmp = m_mscmplex(range->min, range->max);
+    if (cmp > 0 || (cmp == 0 && (range->minex || range->maxex)))
+        return 0;
+
+    p = m_lpSeek(zl, -2); /* Last element. */
+    if (p == NULL) return 0;
+    if (!m_zzlLexValueGteMin(p, range)) return 0;
+
+    p = m_lpSeek(zl, 0); /* First element. */
+    assert(p != NULL);
+    if (!m_zzlLexValueLteMax(p, range)) return 0;
+    return 1;
+}
+
+/* Find pointer to the first element contained in the specified lex range.
+ * Returns NULL when no element is contained in the range. */
+unsigned char *m_zzlFirstInLexRange(unsigned char *zl, m_zlexrangespec *range) {
+    unsigned char *eptr = m_lpFirst(zl), *sptr;
+
+    /* If everything is out of range, return early. */
+    if (!m_zzlIsInLexRange(zl, range)) return NULL;
+
+    while (eptr != NULL) {
+        if (m_zzlLexValueGteMin(eptr, range)) {
+            /* Check if the element is <= max. */
+            if (m_zzlLexValueLteMax(eptr, range)) return eptr;
+            return NULL;
+        }
+
+        /* Move to next element. */
+        sptr = m_lpNext(zl, eptr); /* This element score. Skip it. */
+        assert(sptr != NULL);
+        eptr = m_lpNext(zl, sptr); /* Next element. */
+    }
+
+    return NULL;
+}
+
+/* Find pointer to the last element contained in the specified lex range.
+ * Returns NULL when no element is contained in the range. */
+unsigned char *m_zzlLastInLexRange(unsigned char *zl, m_zlexrangespec *range) {
+    unsigned char *eptr = m_lpSeek(zl, -2), *sptr;
+
+    /* If everything is out of range, return early. */
+    if (!m_zzlIsInLexRange(zl, range)) return NULL;
+
+    while (eptr != NULL) {
+        if (m_zzlLexValueLteMax(eptr, range)) {
+            /* Check if the element is >= min. */
+            if (m_zzlLexValueGteMin(eptr, range)) return eptr;
+            return NULL;
+        }
+
+        /* Move to previous element by moving to the score of previous element.
+         * When this returns NULL, we know there also is no element. */
+        sptr = m_lpPrev(zl, eptr);
+        if (sptr != NULL) {
+            eptr = m_lpPrev(zl, sptr);
+            assert(eptr != NULL);
+        } else {
+            eptr = NULL;
+        }
+    }
+
+    return NULL;
+}
+
+/* Find the element 'ele' and return a pointer to its member entry, or NULL
+ * when it is not found. When 'score' is not NULL its value is filled. */
+unsigned char *m_zzlFind(unsigned char *zl, const char *ele, size_t elelen, scoretype *score) {
+    unsigned char *eptr, *sptr;
+
+    if ((eptr = m_lpFirst(zl)) == NULL) return NULL;
+    while (eptr != NULL) {
+        sptr = m_lpNext(zl, eptr);
+        assert(sptr != NULL);
+
+        if (m_zzlCompareElements(eptr, ele, elelen) == 0) {
+            /* Matching element, pull out score. */
+            if (score != NULL) m_zzlGetScore(sptr, score);
+            return eptr;
+        }
+
+        /* Move to next element. */
+        eptr = m_lpNext(zl, sptr);
+    }
+    return NULL;
+}
+
+/* Delete (element,score) pair from listpack. Use local copy of eptr because
+ * we don't want to modify the one given as argument. */
+unsigned char *m_zzlDelete(unsigned char *zl, unsigned char *eptr) {
+    unsigned char *p = eptr;
+
+    zl = m_lpDelete(zl, p, &p);
+    zl = m_lpDelete(zl, p, &p);
+    return zl;
+}
+
+/* Insert (element,score) pair in listpack before 'eptr', or at the tail when
+ * 'eptr' is NULL. */
+unsigned char *m_zzlInsertAt(unsigned char *zl, unsigned char *eptr, const char *ele, size_t elelen, scoretype *score) {
+    unsigned char *sptr;
+    uint32_t scorelen = score->score_num * sizeof(double);
+
+    if (eptr == NULL) {
+        zl = m_lpAppend(zl, (const unsigned char *)ele, elelen);
+        zl = m_lpAppend(zl, (const unsigned char *)score->scores, scorelen);
+    } else {
+        /* Insert member before the element 'eptr'. */
+        zl = m_lpInsertString(zl, (const unsigned char *)ele, elelen, eptr, LP_BEFORE, &sptr);
+
+        /* Insert score after the member. */
+        zl = m_lpInsertString(zl, (const unsigned char *)score->scores, scorelen, sptr, LP_AFTER, NULL);
+    }
+    return zl;
+}
+
+/* Insert (element,score) pair in listpack. This function assumes the element
+ * is not yet present in the list. */
+unsigned char *m_zzlInsert(unsigned char *zl, const char *elebuf, size_t elelen, scoretype *score,
+                           const unsigned char *types) {
+    unsigned char *eptr = m_lpFirst(zl), *sptr;
+    int cmp;
+
+    while (eptr != NULL) {
+        sptr = m_lpNext(zl, eptr);
+        assert(sptr != NULL);
+
+        cmp = m_zzlScoreCmp(sptr, score, types);
+        if (cmp > 0) {
+            /* First element with score larger than score for element to be
+             * inserted. This means we should take its spot in the list to
+             * maintain ordering. */
+            break;
+        } else if (cmp == 0) {
+            /* Ensure lexicographical ordering for elements. */
+            if (m_zzlCompareElements(eptr, elebuf, elelen) > 0) break;
+        }
+
+        /* Move to next element. */
+        eptr = m_lpNext(zl, sptr);
+    }
+
+    return m_zzlInsertAt(zl, eptr, elebuf, elelen, score);
+}
+
+/* Delete all the elements with score in the specified range. */
+unsigned char *m_zzlDeleteRangeByScore(unsigned char *zl, m_zrangespec *range, unsigned long *deleted) {
+    unsigned char *eptr, *sptr;
+    unsigned long num = 0;
+
+    if (deleted != NULL) *deleted = 0;
+
+    eptr = m_zzlFirstInRange(zl, range);
+    if (eptr == NULL) return zl;
+
+    /* When the tail of the listpack is deleted, eptr will be NULL. */
+    while (eptr && (sptr = m_lpNext(zl, eptr)) != NULL) {
+        if (m_zzlValueLteMax(sptr, range)) {
+            /* Delete both the element and the score. */
+            zl = m_lpDelete(zl, eptr, &eptr);
+            zl = m_lpDelete(zl, eptr, &eptr);
+            num++;
+        } else {
+            /* No longer in range. */
+            break;
+        }
+    }
+
+    if (deleted != NULL) *deleted = num;
+    return zl;
+}
+
+/* Delete all the elements in the specified lex range. */
+unsigned char *m_zzlDeleteRangeByLex(unsigned char *zl, m_zlexrangespec *range, unsigned long *deleted) {
+    unsigned char *eptr;
+    unsigned long num = 0;
+
+    if (deleted != NULL) *deleted = 0;
+
+    eptr = m_zzlFirstInLexRange(zl, range);
+    if (eptr == NULL) return zl;
+
+    /* When the tail of the listpack is deleted, eptr will be NULL. */
+    while (eptr && m_zzlLexValueLteMax(eptr, range)) {
+        /* Delete both the element and the score. */
+        zl = m_lpDelete(zl, eptr, &eptr);
+        zl = m_lpDelete(zl, eptr, &eptr);
+        num++;
+    }
+
+    if (deleted != NULL) *deleted = num;
+    return zl;
+}
+
+/* Delete all the elements with rank between start and end from the listpack.
+ * Start and end are inclusive. Note that start and end need to be 1-based */
+unsigned char *m_zzlDeleteRangeByRank(unsigned char *zl, unsigned int start, unsigned int end, unsigned long *deleted) {
+    unsigned int num = (end - start) + 1;
+    if (deleted) *deleted = num;
+    zl = m_lpDeleteRange(zl, 2 * (start - 1), 2 * num);
+    return zl;
+}
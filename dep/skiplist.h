@@ -1,11 +1,18 @@
 #pragma once
 
+#include <stdint.h>
+#include <string.h>
+
 #include "../src/redismodule.h"
 #include "sds.h"
 #include "dict.h"
+#include "zindex.h"
+#include "listpack.h"
 
 #define ZSKIPLIST_MAXLEVEL 64 /* Should be enough for 2^64 elements */
 #define ZSKIPLIST_P 0.25      /* Skiplist P = 1/4 */
+#define ZSKIPLIST_FINGER_LEVELS 4     /* Levels climbed from the tail by an insert */
+#define ZSKIPLIST_FINGER_DISTANCE 128 /* Inserts this close to the tail start from it */
 
 /* Input flags. */
 #define ZADD_NONE 0
@@ -18,56 +25,126 @@
 #define ZADD_NAN (1 << 4)     /* Only touch elements already existing. */
 #define ZADD_ADDED (1 << 5)   /* The element was new and was added. */
 #define ZADD_UPDATED (1 << 6) /* The element already existed, score updated. */
+#define ZADD_RANGE (1 << 7)   /* The resulting score does not fit the schema. */
 
 /* Flags only used by the ZADD command but not by zsetAdd() API: */
-#define ZADD_CH (1 << 16) /* Return num of elements added or updated. */
+#define ZADD_CH (1 << 16)          /* Return num of elements added or updated. */
+#define ZADD_WITHRANK (1 << 17)    /* Also reply with the rank of the element. */
+#define ZADD_WITHREVRANK (1 << 18) /* Also reply with its reverse rank. */
 
 #define SCORE_DELIMITER '#'
 #define MAX_SCORE_NUM 255
+
+/* Types of the dimensions of a score, see mscoreParseSchema(). Every
+ * dimension takes the 8 bytes of a double whatever its type: an int
+ * dimension holds the bits of an int64_t (see mscoreGetInt()), the other
+ * ones a double, and the type changes how it is parsed, updated and printed. */
+#define MSCORE_TYPE_DOUBLE 0
+#define MSCORE_TYPE_INT 1   /* Exact 64 bit signed integer. */
+#define MSCORE_TYPE_FLOAT 2 /* Rounded to single precision. */
+#define MSCORE_TYPES 3      /* Number of types above. */
+
+/* Room for a dimension printed by mscoreFormat() and for a whole score. */
+#define MSCORE_MAX_DIM_CHARS 32
+#define MSCORE_MAX_CHARS (MAX_SCORE_NUM * (MSCORE_MAX_DIM_CHARS + 1))
 typedef struct scoretype {
     unsigned char score_num;
     double scores[0];
 } scoretype;
+
+/* Read and write an int dimension of a score vector. */
+static inline int64_t mscoreGetInt(const double *d) {
+    int64_t v;
+    memcpy(&v, d, sizeof(v));
+    return v;
+}
+
+static inline void mscoreSetInt(double *d, int64_t v) {
+    memcpy(d, &v, sizeof(v));
+}
+
+/* Every skiplist node stores, right after its score vector, the score key:
+ * one uint64_t per dimension, encoded so that comparing the keys as unsigned
+ * integers, one word after the other, gives the same order as mscoreCmp(). */
 typedef struct m_zskiplistNode {
-    RedisModuleString *ele;
-    scoretype *score;
-    struct m_zskiplistNode *backward;
+    sds ele; /* Embedded in the node, right after the score key. */
+    scoretype *score; /* Points into the node itself, right after level[]. */
+    struct m_zskiplistNode *hnext; /* Next node in the same m_zindex bucket. */
     struct zskiplistLevel {
         struct m_zskiplistNode *forward;
+        struct m_zskiplistNode *backward; /* NULL when the previous node is the header. */
         unsigned long span;
     } level[];
 } m_zskiplistNode;
 
+/* Score vector kernels specialized for a given schema, see
+ * m_zscoreGetOps(). Both arguments of every kernel must have the schema the
+ * kernels were selected for, which is not checked again, and 'types' is the
+ * schema itself, only used by the kernels of schemas with typed dimensions. */
+typedef struct m_zscoreOps {
+    int (*cmp)(scoretype *s1, scoretype *s2, const unsigned char *types);
+    int (*add)(scoretype *s1, scoretype *s2, const unsigned char *types);
+    void (*addIgnoreNan)(scoretype *s1, scoretype *s2, const unsigned char *types);
+    void (*mulWithWeight)(scoretype *dst, scoretype *base, double weight, const unsigned char *types);
+    void (*assign)(scoretype *target, scoretype *src);
+    /* Compare two score keys (see m_zscoreToKey()) of 'n' words. */
+    int (*keycmp)(const uint64_t *k1, const uint64_t *k2, size_t n);
+} m_zscoreOps;
+
+/* The header is a node without score nor member, it only has the levels in
+ * use (header_level, grown by the insertions) instead of ZSKIPLIST_MAXLEVEL,
+ * so it can be reallocated: no node links to the header, see 'backward'. */
 typedef struct m_zskiplist {
     struct m_zskiplistNode *header, *tail;
+    const m_zscoreOps *ops; /* Kernels for the schema, set by m_zslCreate(). */
+    const unsigned char *types; /* Schema, NULL if all doubles, owned by the caller. */
     unsigned long length;
     int level;
-    size_t score_num;  // schema
+    unsigned char header_level; /* Levels allocated in the header, >= level. */
+    unsigned char score_num;    /* schema */
+    unsigned char near_tail;    /* The last insert landed close to the tail. */
 } m_zskiplist;
 
 typedef struct {
     scoretype *min, *max;
+    const unsigned char *types; /* Schema the bounds were parsed with. */
     int minex, maxex; /* are min or max exclusive? */
 } m_zrangespec;
 
 typedef struct {
-    RedisModuleString *min, *max; /* May be set to shared.(minstring|maxstring) */
+    sds min, max; /* May be set to shared.(minstring|maxstring) */
     int minex, maxex;             /* are min or max exclusive? */
 } m_zlexrangespec;
 
-extern RedisModuleString *shared_minstring;
-extern RedisModuleString *shared_maxstring;
+extern sds shared_minstring;
+extern sds shared_maxstring;
 
-m_zskiplist *m_zslCreate(unsigned char score_num);
+m_zskiplist *m_zslCreate(unsigned char score_num, const unsigned char *types);
+m_zskiplistNode *m_zslCreateNode(int level, unsigned char score_num, const unsigned char *types, scoretype *score,
+                                 const char *ele, size_t elelen);
+void m_zslFreeNode(m_zskiplistNode *node);
+int m_zslRandomLevel(void);
+int m_zslRandomLevelR(uint64_t *seed);
 void m_zslFree(m_zskiplist *zsl);
-m_zskiplistNode *m_zslInsert(m_zskiplist *zsl, scoretype *score, RedisModuleString *ele);
-unsigned char *m_zzlInsert(unsigned char *zl, RedisModuleString *ele, scoretype *score);
-int m_zslDelete(m_zskiplist *zsl, scoretype *score, RedisModuleString *ele, m_zskiplistNode **node);
-unsigned long m_zslGetRank(m_zskiplist *zsl, scoretype *score, RedisModuleString *ele);
+m_zskiplistNode *m_zslInsert(m_zskiplist *zsl, scoretype *score, const char *ele, size_t elelen);
+m_zskiplistNode *m_zslInsertWithRank(m_zskiplist *zsl, scoretype *score, const char *ele, size_t elelen,
+                                     unsigned long *rank);
+m_zskiplistNode *m_zslInsertHead(m_zskiplist *zsl, scoretype *score, const char *ele, size_t elelen);
+void m_zslInsertNodeHead(m_zskiplist *zsl, m_zskiplistNode *x);
+void m_zslInsertNodes(m_zskiplist *zsl, m_zskiplistNode **nodes, unsigned long count);
+void m_zslSetNodeScore(m_zskiplist *zsl, m_zskiplistNode *x, scoretype *score);
+int m_zslDelete(m_zskiplist *zsl, scoretype *score, sds ele, m_zskiplistNode **node);
+unsigned long m_zslGetRank(m_zskiplist *zsl, scoretype *score, sds ele);
+unsigned long m_zslGetRankByNode(m_zskiplist *zsl, m_zskiplistNode *x);
+m_zskiplistNode *m_zslSkipNodes(m_zskiplist *zsl, m_zskiplistNode *x, long n);
 unsigned long m_zslGetRankByScore(m_zskiplist *zsl, scoretype *score);
-m_zskiplistNode *m_zslUpdateScore(m_zskiplist *zsl, scoretype *curscore, RedisModuleString *ele, scoretype *newscore);
+m_zskiplistNode *m_zslLastBefore(m_zskiplist *zsl, scoretype *score, const char *ele, size_t elelen, int inclusive,
+                                 unsigned long *rank);
+void m_zslUpdateScore(m_zskiplist *zsl, m_zskiplistNode *x, scoretype *newscore, unsigned long *rank);
+void m_zslDeleteByNode(m_zskiplist *zsl, m_zskiplistNode *x);
 m_zskiplistNode *m_zslGetElementByRank(m_zskiplist *zsl, unsigned long rank);
-int m_zslParseRange(RedisModuleString *min, RedisModuleString *max, m_zrangespec *spec);
+int m_zslParseRange(RedisModuleString *min, RedisModuleString *max, const unsigned char *types, int score_num,
+                    m_zrangespec *spec);
 void m_zslFreeLexRange(m_zlexrangespec *spec);
 int m_zslParseLexRange(RedisModuleString *min, RedisModuleString *max, m_zlexrangespec *spec);
 int m_zslValueGteMin(scoretype *value, m_zrangespec *spec);
@@ -75,20 +152,54 @@ int m_zslValueLteMax(scoretype *value, m_zrangespec *spec);
 int m_zslIsInRange(m_zskiplist *zsl, m_zrangespec *range);
 m_zskiplistNode *m_zslFirstInRange(m_zskiplist *zsl, m_zrangespec *range);
 m_zskiplistNode *m_zslLastInRange(m_zskiplist *zsl, m_zrangespec *range);
-int m_zslLexValueLteMax(RedisModuleString *value, m_zlexrangespec *spec);
-int m_zslLexValueGteMin(RedisModuleString *value, m_zlexrangespec *spec);
+int m_zslLexValueLteMax(sds value, m_zlexrangespec *spec);
+int m_zslLexValueGteMin(sds value, m_zlexrangespec *spec);
 m_zskiplistNode *m_zslLastInLexRange(m_zskiplist *zsl, m_zlexrangespec *range);
 m_zskiplistNode *m_zslFirstInLexRange(m_zskiplist *zsl, m_zlexrangespec *range);
-unsigned long m_zslDeleteRangeByScore(m_zskiplist *zsl, m_zrangespec *range, dict *dict);
-unsigned long m_zslDeleteRangeByRank(m_zskiplist *zsl, unsigned int start, unsigned int end, dict *dict);
-unsigned long m_zslDeleteRangeByLex(m_zskiplist *zsl, m_zlexrangespec *range, dict *dict);
+unsigned long m_zslDeleteRangeByScore(m_zskiplist *zsl, m_zrangespec *range, m_zindex *zi);
+unsigned long m_zslDeleteRangeByRank(m_zskiplist *zsl, unsigned int start, unsigned int end, m_zindex *zi);
+unsigned long m_zslDeleteRangeByLex(m_zskiplist *zsl, m_zlexrangespec *range, m_zindex *zi);
+
+void m_zzlGetScore(unsigned char *sptr, scoretype *score);
+int m_zzlScoreCmp(unsigned char *sptr, scoretype *score, const unsigned char *types);
+int m_zzlCompareElements(unsigned char *eptr, const char *cstr, size_t clen);
+unsigned int m_zzlLength(unsigned char *zl);
+void m_zzlNext(unsigned char *zl, unsigned char **eptr, unsigned char **sptr);
+void m_zzlPrev(unsigned char *zl, unsigned char **eptr, unsigned char **sptr);
+int m_zzlValueGteMin(unsigned char *sptr, m_zrangespec *spec);
+int m_zzlValueLteMax(unsigned char *sptr, m_zrangespec *spec);
+unsigned char *m_zzlFirstInRange(unsigned char *zl, m_zrangespec *range);
+unsigned char *m_zzlLastInRange(unsigned char *zl, m_zrangespec *range);
+int m_zzlLexValueGteMin(unsigned char *p, m_zlexrangespec *spec);
+int m_zzlLexValueLteMax(unsigned char *p, m_zlexrangespec *spec);
+unsigned char *m_zzlFirstInLexRange(unsigned char *zl, m_zlexrangespec *range);
+unsigned char *m_zzlLastInLexRange(unsigned char *zl, m_zlexrangespec *range);
+unsigned char *m_zzlFind(unsigned char *zl, const char *ele, size_t elelen, scoretype *score);
+unsigned char *m_zzlDelete(unsigned char *zl, unsigned char *eptr);
+unsigned char *m_zzlInsertAt(unsigned char *zl, unsigned char *eptr, const char *ele, size_t elelen, scoretype *score);
+unsigned char *m_zzlInsert(unsigned char *zl, const char *ele, size_t elelen, scoretype *score,
+                           const unsigned char *types);
+unsigned char *m_zzlDeleteRangeByScore(unsigned char *zl, m_zrangespec *range, unsigned long *deleted);
+unsigned char *m_zzlDeleteRangeByLex(unsigned char *zl, m_zlexrangespec *range, unsigned long *deleted);
+unsigned char *m_zzlDeleteRangeByRank(unsigned char *zl, unsigned int start, unsigned int end, unsigned long *deleted);
 
 int mscoreGetNum(const char *s, size_t slen);
-int mscoreParse(const char *s, size_t slen, scoretype **score);
-int mscoreCmp(scoretype *s1, scoretype *s2);
-sds mscore2String(scoretype *score);
-int mscoreAdd(scoretype *s1, scoretype *s2);
-void mscoreAddIgnoreNan(scoretype *s1, scoretype *s2);
+int mscoreParseTo(const char *s, size_t slen, const unsigned char *types, int max, double *scores);
+int mscoreParseBinary(const char *s, size_t slen, const unsigned char *types, int max, double *scores);
+int mscoreParse(const char *s, size_t slen, const unsigned char *types, int max, scoretype **score);
+int mscoreParseBound(const char *s, size_t slen, const unsigned char *types, int max, scoretype **score);
+int mscoreParseSchema(const char *s, size_t slen, unsigned char **types);
+sds mscoreSchema2String(const unsigned char *types, int score_num);
+int mscoreFitSchema(scoretype *score, const unsigned char *types);
+void mscoreIntToDouble(scoretype *score, const unsigned char *types);
+void mscoreDoubleToInt(scoretype *score, const unsigned char *types);
+int mscoreCmp(scoretype *s1, scoretype *s2, const unsigned char *types);
+size_t mscoreFormat(char *buf, scoretype *score, const unsigned char *types);
+sds mscore2String(scoretype *score, const unsigned char *types);
+int mscoreAdd(scoretype *s1, scoretype *s2, const unsigned char *types);
+void mscoreAddIgnoreNan(scoretype *s1, scoretype *s2, const unsigned char *types);
 scoretype *mnewScore(int score_num);
-void mscoreMulWithWeight(scoretype *dst, scoretype *base, double weight);
-void mscoreAssign(scoretype *target, scoretype *src);
\ No newline at end of file
+void mscoreMulWithWeight(scoretype *dst, scoretype *base, double weight, const unsigned char *types);
+void mscoreAssign(scoretype *target, scoretype *src);
+const m_zscoreOps *m_zscoreGetOps(unsigned char score_num, const unsigned char *types);
+void m_zscoreToKey(scoretype *score, const unsigned char *types, uint64_t *key);
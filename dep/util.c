@@ -1,4 +1,5 @@
 #include "util.h"
+#include "fpconv_dtoa.h"
 
 #include <ctype.h>
 #include <errno.h>
@@ -425,7 +426,9 @@ int m_string2d(const char *s, size_t slen, double *dp) {
 }
 
 /* Convert a double to a string representation. Returns the number of bytes
- * required. The representation should always be parsable by strtod(3).
+ * required. The representation should always be parsable by strtod(3), it
+ * is printed with the least digits reading back as the same double, see
+ * fpconv_dtoa.h.
  * This function does not support human-friendly formatting like m_ld2string
  * does. It is intended mainly to be used inside t_zset.c when writing scores
  * into a ziplist representing a sorted set. */
@@ -460,7 +463,16 @@ int m_d2string(char *buf, size_t len, double value) {
             len = m_ll2string(buf, len, (long long)value);
         else
 #endif
-            len = snprintf(buf, len, "%.17g", value);
+        {
+            char digits[FPCONV_MAX_CHARS];
+            int n = m_fpconv_dtoa(value, digits);
+            if (len) {
+                size_t copy = (size_t)n < len ? (size_t)n : len - 1;
+                memcpy(buf, digits, copy);
+                buf[copy] = '\0';
+            }
+            len = n;
+        }
     }
 
     return len;
@@ -0,0 +1,375 @@
+/* Member index of the skiplist encoded TairZset, see zindex.h.
+ *
+ * The rehashing, sampling and scanning algorithms are the ones of dict.c,
+ * adapted to chain the skiplist nodes themselves instead of dictEntry
+ * structures. */
+
+#include "zindex.h"
+
+#include <assert.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dict.h"
+#include "skiplist.h"
+
+static inline uint64_t zindexHash(const char *ele, size_t elelen) {
+    return m_dictGenHashFunction(ele, (int)elelen);
+}
+
+/* The hash of a member, for m_zindexAddHashed(). */
+uint64_t m_zindexHash(const char *ele, size_t elelen) {
+    return zindexHash(ele, elelen);
+}
+
+static inline int zindexNodeIs(struct m_zskiplistNode *node, const char *ele, size_t elelen) {
+    return sdslen(node->ele) == elelen && memcmp(node->ele, ele, elelen) == 0;
+}
+
+static void zindexResetTable(m_zindex *zi, int table) {
+    zi->table[table] = NULL;
+    zi->size[table] = 0;
+    zi->used[table] = 0;
+}
+
+/* Our hash table capability is a power of two */
+static unsigned long zindexNextPower(unsigned long size) {
+    unsigned long i = ZINDEX_INITIAL_SIZE;
+
+    if (size >= LONG_MAX) return LONG_MAX + 1LU;
+    while (i < size) i *= 2;
+    return i;
+}
+
+/* Create an empty index, the first table is allocated by the first add. */
+m_zindex *m_zindexCreate(void) {
+    m_zindex *zi = RedisModule_Alloc(sizeof(*zi));
+
+    zindexResetTable(zi, 0);
+    zindexResetTable(zi, 1);
+    zi->rehashidx = -1;
+    return zi;
+}
+
+/* Release the index. The indexed nodes are owned by the skiplist and are
+ * not touched. */
+void m_zindexRelease(m_zindex *zi) {
+    RedisModule_Free(zi->table[0]);
+    RedisModule_Free(zi->table[1]);
+    RedisModule_Free(zi);
+}
+
+/* Expand or create the hash table, returns DICT_ERR when the index is
+ * rehashing or the requested size is useless. */
+int m_zindexExpand(m_zindex *zi, unsigned long size) {
+    if (zindexIsRehashing(zi) || zi->used[0] > size) return DICT_ERR;
+
+    unsigned long realsize = zindexNextPower(size);
+    if (realsize == zi->size[0]) return DICT_ERR;
+
+    struct m_zskiplistNode **table = RedisModule_Calloc(realsize, sizeof(*table));
+
+    /* First initialization, there is nothing to rehash. */
+    if (zi->table[0] == NULL) {
+        zi->table[0] = table;
+        zi->size[0] = realsize;
+        return DICT_OK;
+    }
+
+    zi->table[1] = table;
+    zi->size[1] = realsize;
+    zi->used[1] = 0;
+    zi->rehashidx = 0;
+    return DICT_OK;
+}
+
+/* Shrink the table to the minimal size that contains all the members. */
+int m_zindexResize(m_zindex *zi) {
+    unsigned long minimal = zi->used[0];
+
+    if (zindexIsRehashing(zi)) return DICT_ERR;
+    if (minimal < ZINDEX_INITIAL_SIZE) minimal = ZINDEX_INITIAL_SIZE;
+    return m_zindexExpand(zi, minimal);
+}
+
+int m_zindexNeedsResize(m_zindex *zi) {
+    unsigned long size = zindexSlots(zi), used = zindexSize(zi);
+    return size > ZINDEX_INITIAL_SIZE && used * 100 / size < ZINDEX_MIN_FILL;
+}
+
+/* Move one bucket from the old to the new table, visiting at most ten
+ * empty buckets, like _dictRehashStep(). */
+static void zindexRehashStep(m_zindex *zi) {
+    int empty_visits = 10;
+
+    if (zi->used[0] != 0) {
+        assert(zi->size[0] > (unsigned long)zi->rehashidx);
+        while (zi->table[0][zi->rehashidx] == NULL) {
+            zi->rehashidx++;
+            if (--empty_visits == 0) return;
+        }
+
+        struct m_zskiplistNode *node = zi->table[0][zi->rehashidx], *next;
+        unsigned long mask = zi->size[1] - 1;
+        while (node) {
+            uint64_t idx = zindexHash(node->ele, sdslen(node->ele)) & mask;
+
+            next = node->hnext;
+            node->hnext = zi->table[1][idx];
+            zi->table[1][idx] = node;
+            zi->used[0]--;
+            zi->used[1]++;
+            node = next;
+        }
+        zi->table[0][zi->rehashidx] = NULL;
+        zi->rehashidx++;
+    }
+
+    /* Check if we already rehashed the whole table... */
+    if (zi->used[0] == 0) {
+        RedisModule_Free(zi->table[0]);
+        zi->table[0] = zi->table[1];
+        zi->size[0] = zi->size[1];
+        zi->used[0] = zi->used[1];
+        zindexResetTable(zi, 1);
+        zi->rehashidx = -1;
+    }
+}
+
+/* Return the node holding 'ele', or NULL if the member is not indexed. */
+struct m_zskiplistNode *m_zindexFind(m_zindex *zi, const char *ele, size_t elelen) {
+    if (zindexSize(zi) == 0) return NULL;
+    return m_zindexFindHashed(zi, ele, elelen, zindexHash(ele, elelen));
+}
+
+/* Like m_zindexFind(), with the hash of the member already computed by
+ * m_zindexHash(). */
+struct m_zskiplistNode *m_zindexFindHashed(m_zindex *zi, const char *ele, size_t elelen, uint64_t hash) {
+    struct m_zskiplistNode *node;
+    int table;
+
+    if (zindexSize(zi) == 0) return NULL;
+    if (zindexIsRehashing(zi)) zindexRehashStep(zi);
+
+    for (table = 0; table <= 1; table++) {
+        node = zi->table[table][hash & (zi->size[table] - 1)];
+        while (node) {
+            if (zindexNodeIs(node, ele, elelen)) return node;
+            node = node->hnext;
+        }
+        if (!zindexIsRehashing(zi)) break;
+    }
+    return NULL;
+}
+
+/* Prefetch the bucket of 'hash', so that a batch of lookups can hash all
+ * the members first and then find them without waiting on each bucket. */
+void m_zindexPrefetch(m_zindex *zi, uint64_t hash) {
+    if (zi->size[0]) __builtin_prefetch(&zi->table[0][hash & (zi->size[0] - 1)]);
+    if (zi->size[1]) __builtin_prefetch(&zi->table[1][hash & (zi->size[1] - 1)]);
+}
+
+/* Index 'node'. Its member must not be indexed already (up to the caller to
+ * enforce that, usually with a previous m_zindexFind()). */
+void m_zindexAdd(m_zindex *zi, struct m_zskiplistNode *node) {
+    m_zindexAddHashed(zi, node, zindexHash(node->ele, sdslen(node->ele)));
+}
+
+/* Like m_zindexAdd(), with the hash of the member already computed by
+ * m_zindexHash(), possibly by another thread. */
+void m_zindexAddHashed(m_zindex *zi, struct m_zskiplistNode *node, uint64_t hash) {
+    if (zindexIsRehashing(zi)) {
+        zindexRehashStep(zi);
+    } else if (zi->size[0] == 0) {
+        m_zindexExpand(zi, ZINDEX_INITIAL_SIZE);
+    } else if (zi->used[0] >= zi->size[0]) {
+        m_zindexExpand(zi, zi->used[0] * 2);
+    }
+
+    /* While rehashing new members always go to the new table. */
+    int table = zindexIsRehashing(zi) ? 1 : 0;
+    uint64_t idx = hash & (zi->size[table] - 1);
+    node->hnext = zi->table[table][idx];
+    zi->table[table][idx] = node;
+    zi->used[table]++;
+}
+
+/* Remove 'node' from the index, the node itself is left untouched apart
+ * from its chain pointer. Returns DICT_ERR if the node was not indexed. */
+int m_zindexDelete(m_zindex *zi, struct m_zskiplistNode *node) {
+    struct m_zskiplistNode **link;
+    uint64_t h;
+    int table;
+
+    if (zindexSize(zi) == 0) return DICT_ERR;
+    if (zindexIsRehashing(zi)) zindexRehashStep(zi);
+
+    h = zindexHash(node->ele, sdslen(node->ele));
+    for (table = 0; table <= 1; table++) {
+        link = &zi->table[table][h & (zi->size[table] - 1)];
+        while (*link) {
+            if (*link == node) {
+                *link = node->hnext;
+                node->hnext = NULL;
+                zi->used[table]--;
+                return DICT_OK;
+            }
+            link = &(*link)->hnext;
+        }
+        if (!zindexIsRehashing(zi)) break;
+    }
+    return DICT_ERR;
+}
+
+/* Return a node from a random non empty bucket, see m_dictGetRandomKey(). */
+static struct m_zskiplistNode *zindexGetRandomNode(m_zindex *zi) {
+    struct m_zskiplistNode *node, *orignode;
+    unsigned long h;
+    int listlen, listele;
+
+    if (zindexIsRehashing(zi)) {
+        do {
+            /* We are sure there are no members in indexes from 0
+             * to rehashidx-1 */
+            h = zi->rehashidx + (random() % (zi->size[0] + zi->size[1] - zi->rehashidx));
+            node = (h >= zi->size[0]) ? zi->table[1][h - zi->size[0]] : zi->table[0][h];
+        } while (node == NULL);
+    } else {
+        do {
+            h = random() & (zi->size[0] - 1);
+            node = zi->table[0][h];
+        } while (node == NULL);
+    }
+
+    listlen = 0;
+    orignode = node;
+    while (node) {
+        node = node->hnext;
+        listlen++;
+    }
+    listele = random() % listlen;
+    node = orignode;
+    while (listele--) node = node->hnext;
+    return node;
+}
+
+/* Sample up to 'count' nodes from contiguous buckets starting at a random
+ * position, see m_dictGetSomeKeys(). */
+static unsigned int zindexGetSomeNodes(m_zindex *zi, struct m_zskiplistNode **nodes, unsigned int count) {
+    unsigned long j, tables, stored = 0, maxsizemask, maxsteps;
+
+    if (zindexSize(zi) < count) count = zindexSize(zi);
+    maxsteps = count * 10;
+
+    tables = zindexIsRehashing(zi) ? 2 : 1;
+    maxsizemask = zi->size[0] - 1;
+    if (tables > 1 && maxsizemask < zi->size[1] - 1) maxsizemask = zi->size[1] - 1;
+
+    unsigned long i = random() & maxsizemask;
+    unsigned long emptylen = 0;
+    while (stored < count && maxsteps--) {
+        for (j = 0; j < tables; j++) {
+            if (tables == 2 && j == 0 && i < (unsigned long)zi->rehashidx) {
+                if (i >= zi->size[1])
+                    i = zi->rehashidx;
+                else
+                    continue;
+            }
+            if (i >= zi->size[j]) continue;
+            struct m_zskiplistNode *node = zi->table[j][i];
+
+            if (node == NULL) {
+                emptylen++;
+                if (emptylen >= 5 && emptylen > count) {
+                    i = random() & maxsizemask;
+                    emptylen = 0;
+                }
+            } else {
+                emptylen = 0;
+                while (node) {
+                    nodes[stored++] = node;
+                    if (stored == count) return stored;
+                    node = node->hnext;
+                }
+            }
+        }
+        i = (i + 1) & maxsizemask;
+    }
+    return stored;
+}
+
+/* Return a random node with a better distribution than picking a random
+ * bucket, see m_dictGetFairRandomKey(). The index must not be empty. */
+#define ZINDEX_GETFAIR_NUM_NODES 15
+struct m_zskiplistNode *m_zindexGetFairRandomNode(m_zindex *zi) {
+    struct m_zskiplistNode *nodes[ZINDEX_GETFAIR_NUM_NODES];
+
+    assert(zindexSize(zi) != 0);
+    unsigned int count = zindexGetSomeNodes(zi, nodes, ZINDEX_GETFAIR_NUM_NODES);
+    if (count == 0) return zindexGetRandomNode(zi);
+    return nodes[random() % count];
+}
+
+/* Function to reverse bits. Algorithm from:
+ * http://graphics.stanford.edu/~seander/bithacks.html#ReverseParallel */
+static unsigned long rev(unsigned long v) {
+    unsigned long s = 8 * sizeof(v);
+    unsigned long mask = ~0;
+    while ((s >>= 1) > 0) {
+        mask ^= (mask << s);
+        v = ((v >> s) & mask) | ((v << s) & ~mask);
+    }
+    return v;
+}
+
+static void zindexScanBucket(struct m_zskiplistNode *node, m_zindexScanFunction *fn, void *privdata) {
+    struct m_zskiplistNode *next;
+
+    while (node) {
+        next = node->hnext;
+        fn(privdata, node);
+        node = next;
+    }
+}
+
+/* Iterate the index with the reverse binary cursor of m_dictScan(), which
+ * documents the guarantees: every member present for the whole iteration is
+ * returned at least once, even if the table is resized between calls. */
+unsigned long m_zindexScan(m_zindex *zi, unsigned long v, m_zindexScanFunction *fn, void *privdata) {
+    unsigned long m0, m1;
+    int t0, t1;
+
+    if (zindexSize(zi) == 0) return 0;
+
+    if (!zindexIsRehashing(zi)) {
+        m0 = zi->size[0] - 1;
+        zindexScanBucket(zi->table[0][v & m0], fn, privdata);
+
+        v |= ~m0;
+        v = rev(v);
+        v++;
+        v = rev(v);
+    } else {
+        /* Make sure t0 is the smaller and t1 is the bigger table */
+        t0 = zi->size[0] > zi->size[1];
+        t1 = !t0;
+        m0 = zi->size[t0] - 1;
+        m1 = zi->size[t1] - 1;
+
+        zindexScanBucket(zi->table[t0][v & m0], fn, privdata);
+
+        /* Iterate over indices in larger table that are the expansion
+         * of the index pointed to by the cursor in the smaller table */
+        do {
+            zindexScanBucket(zi->table[t1][v & m1], fn, privdata);
+
+            v |= ~m1;
+            v = rev(v);
+            v++;
+            v = rev(v);
+        } while (v & (m0 ^ m1));
+    }
+
+    return v;
+}
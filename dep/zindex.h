@@ -0,0 +1,48 @@
+/* Member index of the skiplist encoded TairZset.
+ *
+ * A chained hash table mapping members to skiplist nodes. The table is
+ * intrusive: the chain pointer is the 'hnext' field of m_zskiplistNode and
+ * the key is the member embedded in the node, so indexing a member costs no
+ * allocation besides the bucket array.
+ *
+ * Like dict.c the table size is a power of two, the table is rehashed
+ * incrementally (two tables are used while rehashing) and it can be scanned
+ * with a stateless reverse binary cursor. */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct m_zskiplistNode;
+
+typedef struct m_zindex {
+    struct m_zskiplistNode **table[2];
+    unsigned long size[2]; /* Zero or a power of two. */
+    unsigned long used[2];
+    long rehashidx; /* Rehashing not in progress if rehashidx == -1 */
+} m_zindex;
+
+typedef void m_zindexScanFunction(void *privdata, struct m_zskiplistNode *node);
+
+#define ZINDEX_INITIAL_SIZE 4
+#define ZINDEX_MIN_FILL 10 /* Minimal fill in percent before shrinking */
+
+#define zindexSize(zi) ((zi)->used[0] + (zi)->used[1])
+#define zindexSlots(zi) ((zi)->size[0] + (zi)->size[1])
+#define zindexIsRehashing(zi) ((zi)->rehashidx != -1)
+
+m_zindex *m_zindexCreate(void);
+void m_zindexRelease(m_zindex *zi);
+int m_zindexExpand(m_zindex *zi, unsigned long size);
+int m_zindexResize(m_zindex *zi);
+int m_zindexNeedsResize(m_zindex *zi);
+struct m_zskiplistNode *m_zindexFind(m_zindex *zi, const char *ele, size_t elelen);
+struct m_zskiplistNode *m_zindexFindHashed(m_zindex *zi, const char *ele, size_t elelen, uint64_t hash);
+void m_zindexPrefetch(m_zindex *zi, uint64_t hash);
+uint64_t m_zindexHash(const char *ele, size_t elelen);
+void m_zindexAdd(m_zindex *zi, struct m_zskiplistNode *node);
+void m_zindexAddHashed(m_zindex *zi, struct m_zskiplistNode *node, uint64_t hash);
+int m_zindexDelete(m_zindex *zi, struct m_zskiplistNode *node);
+struct m_zskiplistNode *m_zindexGetFairRandomNode(m_zindex *zi);
+unsigned long m_zindexScan(m_zindex *zi, unsigned long v, m_zindexScanFunction *fn, void *privdata);
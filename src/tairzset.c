@@ -22,6 +22,7 @@
 #include <errno.h>
 #include <limits.h>
 #include <math.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -29,26 +30,143 @@
 #include <strings.h>
 
 #define TAIRZSET_ENCVER_VER_1 0
+#define TAIRZSET_ENCVER_VER_2 1 /* Adds the schema of typed dimensions. */
+#define TAIRZSET_ENCVER_VER_3 2 /* Elements saved in blocks, see exZsetRdbWriter. */
+#define TAIRZSET_ENCVER_VER_4 3 /* Int dimensions saved as int64_t instead of doubles. */
+
+/* Not defined by the redismodule.h of older servers, which never set it. */
+#ifndef REDISMODULE_CTX_FLAGS_RESP3
+#define REDISMODULE_CTX_FLAGS_RESP3 (1 << 22)
+#endif
 
 static RedisModuleType *TairZsetType;
 
-static struct TairZsetObj *createTairZsetTypeObject(int score_num) {
+/* Sorted sets with at most tairzset_max_listpack_entries elements, none of
+ * them longer than tairzset_max_listpack_value bytes, use the compact
+ * listpack encoding. Both can be changed with module load arguments. */
+static long long tairzset_max_listpack_entries = 128;
+static long long tairzset_max_listpack_value = 64;
+
+/* Threads decoding the RDB blocks of a TairZset with at least
+ * tairzset_rdb_load_threads_min_elements elements, see
+ * exZsetRdbLoadBlocksThreaded(), 0 or 1 to decode on the main thread. */
+static long long tairzset_rdb_load_threads = 4;
+static long long tairzset_rdb_load_threads_min_elements = 64 * 1024;
+
+/* The object takes the ownership of the schema 'types' (NULL when every
+ * dimension is a double). */
+static struct TairZsetObj *createTairZsetTypeObject(int score_num, unsigned char *types) {
     TairZsetObj *obj = RedisModule_Calloc(1, sizeof(TairZsetObj));
-    obj->dict = m_dictCreate(&tairZsetDictType, NULL);
-    obj->zsl = m_zslCreate(score_num);
+    obj->encoding = TAIRZSET_ENCODING_SKIPLIST;
+    obj->score_num = score_num;
+    obj->types = types;
+    obj->index = m_zindexCreate();
+    obj->zsl = m_zslCreate(score_num, types);
     return obj;
 }
 
+static struct TairZsetObj *createTairZsetListpackObject(int score_num, unsigned char *types) {
+    TairZsetObj *obj = RedisModule_Calloc(1, sizeof(TairZsetObj));
+    obj->encoding = TAIRZSET_ENCODING_LISTPACK;
+    obj->score_num = score_num;
+    obj->types = types;
+    obj->zl = m_lpNew(0);
+    return obj;
+}
+
+/* Create a TairZset object choosing the encoding from the expected number
+ * of elements and the length of the biggest member. */
+static struct TairZsetObj *exZsetTypeCreate(int score_num, unsigned char *types, size_t size_hint,
+                                            size_t value_len_hint) {
+    if (size_hint <= (size_t)tairzset_max_listpack_entries && value_len_hint <= (size_t)tairzset_max_listpack_value) {
+        return createTairZsetListpackObject(score_num, types);
+    }
+    return createTairZsetTypeObject(score_num, types);
+}
+
 static void TairZsetTypeReleaseObject(struct TairZsetObj *obj) {
     if (!obj) {
         return;
     }
 
-    m_dictRelease(obj->dict);
-    m_zslFree(obj->zsl);
+    if (obj->encoding == TAIRZSET_ENCODING_LISTPACK) {
+        m_lpFree(obj->zl);
+    } else {
+        m_zindexRelease(obj->index);
+        m_zslFree(obj->zsl);
+    }
+    RedisModule_Free(obj->types);
     RedisModule_Free(obj);
 }
 
+/* Convert the sorted set object to the specified encoding, the object must
+ * not be empty when converting to a listpack is requested by the caller. */
+static void exZsetConvert(TairZsetObj *zobj, int encoding) {
+    if (zobj->encoding == encoding) return;
+
+    if (encoding == TAIRZSET_ENCODING_SKIPLIST) {
+        unsigned char *zl = zobj->zl;
+        unsigned char *eptr, *sptr, *vstr;
+        uint32_t vlen;
+
+        zobj->index = m_zindexCreate();
+        zobj->zsl = m_zslCreate(zobj->score_num, zobj->types);
+        m_zindexExpand(zobj->index, m_zzlLength(zl));
+
+        eptr = m_lpSeek(zl, 0);
+        if (eptr != NULL) {
+            sptr = m_lpNext(zl, eptr);
+            assert(sptr != NULL);
+        }
+
+        scoretype *score = mnewScore(zobj->score_num);
+        while (eptr != NULL) {
+            m_zzlGetScore(sptr, score);
+            vstr = m_lpGet(eptr, &vlen);
+
+            m_zskiplistNode *node = m_zslInsert(zobj->zsl, score, (const char *)vstr, vlen);
+            m_zindexAdd(zobj->index, node);
+            m_zzlNext(zl, &eptr, &sptr);
+        }
+        RedisModule_Free(score);
+
+        m_lpFree(zl);
+        zobj->zl = NULL;
+        zobj->encoding = TAIRZSET_ENCODING_SKIPLIST;
+    } else {
+        unsigned char *zl = m_lpNew(0);
+        m_zskiplistNode *node = zobj->zsl->header->level[0].forward;
+
+        while (node) {
+            zl = m_zzlInsertAt(zl, NULL, node->ele, sdslen(node->ele), node->score);
+            node = node->level[0].forward;
+        }
+
+        m_zindexRelease(zobj->index);
+        m_zslFree(zobj->zsl);
+        zobj->index = NULL;
+        zobj->zsl = NULL;
+        zobj->zl = zl;
+        zobj->encoding = TAIRZSET_ENCODING_LISTPACK;
+    }
+}
+
+/* Convert the sorted set object into a listpack if it is not already a listpack
+ * and if the number of elements and the maximum element size are within the
+ * expected ranges. Used for the destination of the STORE commands, which are
+ * always built as a skiplist. */
+static void exZsetConvertToListpackIfNeeded(TairZsetObj *zobj) {
+    if (zobj->encoding == TAIRZSET_ENCODING_LISTPACK) return;
+    if (zobj->zsl->length == 0 || zobj->zsl->length > (unsigned long)tairzset_max_listpack_entries) return;
+
+    m_zskiplistNode *node = zobj->zsl->header->level[0].forward;
+    while (node) {
+        if (sdslen(node->ele) > (size_t)tairzset_max_listpack_value) return;
+        node = node->level[0].forward;
+    }
+    exZsetConvert(zobj, TAIRZSET_ENCODING_LISTPACK);
+}
+
 static int mstringcasecmp(const RedisModuleString *rs1, const char *s2) {
     size_t n1 = strlen(s2);
     size_t n2;
@@ -60,9 +178,57 @@ static int mstringcasecmp(const RedisModuleString *rs1, const char *s2) {
 }
 
 static unsigned long exZsetLength(const TairZsetObj *zobj) {
+    if (zobj->encoding == TAIRZSET_ENCODING_LISTPACK) {
+        return m_zzlLength(zobj->zl);
+    }
     return zobj->zsl->length;
 }
 
+/* Parse a score range with the schema of the TairZset stored at 'key'. The
+ * range is parsed as doubles when the key holds no TairZset, the commands
+ * then reply before using it. */
+static int exZsetParseRange(RedisModuleKey *key, RedisModuleString *min, RedisModuleString *max, m_zrangespec *range) {
+    if (RedisModule_KeyType(key) == REDISMODULE_KEYTYPE_MODULE && RedisModule_ModuleTypeGetType(key) == TairZsetType) {
+        TairZsetObj *zobj = RedisModule_ModuleTypeGetValue(key);
+        if (zobj->types) return m_zslParseRange(min, max, zobj->types, zobj->score_num, range);
+    }
+    return m_zslParseRange(min, max, NULL, MAX_SCORE_NUM, range);
+}
+
+/* Reply with 'score', printed according to the schema of 'zobj'. RESP3
+ * clients get native types instead: a double, or an array with a double per
+ * dimension for multi dimensional scores, and integers for the int
+ * dimensions of a schema. */
+static void exZsetReplyWithScore(RedisModuleCtx *ctx, const TairZsetObj *zobj, scoretype *score) {
+    if (RedisModule_GetContextFlags(ctx) & REDISMODULE_CTX_FLAGS_RESP3) {
+        if (score->score_num > 1) RedisModule_ReplyWithArray(ctx, score->score_num);
+        for (int i = 0; i < score->score_num; i++) {
+            if (zobj->types && zobj->types[i] == MSCORE_TYPE_INT)
+                RedisModule_ReplyWithLongLong(ctx, mscoreGetInt(&score->scores[i]));
+            else
+                RedisModule_ReplyWithDouble(ctx, score->scores[i]);
+        }
+        return;
+    }
+
+    char buf[MSCORE_MAX_CHARS];
+    RedisModule_ReplyWithStringBuffer(ctx, buf, mscoreFormat(buf, score, zobj->types));
+}
+
+/* Reply with the member stored at 'eptr' of a listpack encoded sorted set. */
+static void exZzlReplyWithMember(RedisModuleCtx *ctx, unsigned char *eptr) {
+    uint32_t vlen;
+    unsigned char *vstr = m_lpGet(eptr, &vlen);
+    RedisModule_ReplyWithStringBuffer(ctx, (const char *)vstr, vlen);
+}
+
+/* Reply with the score stored at 'sptr' of a listpack encoded sorted set,
+ * 'score' is a scratch score sized for the schema of the sorted set. */
+static void exZzlReplyWithScore(RedisModuleCtx *ctx, const TairZsetObj *zobj, unsigned char *sptr, scoretype *score) {
+    m_zzlGetScore(sptr, score);
+    exZsetReplyWithScore(ctx, zobj, score);
+}
+
 
 /* ========================= "tairzset" set operations =======================*/
 
@@ -81,9 +247,18 @@ static unsigned long exZsetLength(const TairZsetObj *zobj) {
 typedef struct {
     TairZsetObj *subject;
     double weight;
+    /* Schema of 'subject' when its int dimensions are converted to doubles,
+     * see exZunionInterSchema(), NULL otherwise. */
+    const unsigned char *types;
     struct _zset_iter {
         TairZsetObj *zs;
         m_zskiplistNode *node;
+        /* Listpack encoding, 'ele' and 'score' hold the current element
+         * and are overwritten by the next call. 'score' is also used by the
+         * skiplist encoding when the scores are converted. */
+        unsigned char *eptr, *sptr;
+        sds ele;
+        scoretype *score;
     } zset_iter;
 } zsetopsrc;
 
@@ -101,7 +276,7 @@ typedef struct _zset_iter iterzset;
 
 /* Store value retrieved from the iterator. */
 typedef struct {
-    RedisModuleString *ele;
+    sds ele;
     scoretype *score;
 } zsetopval;
 
@@ -128,7 +303,30 @@ void exZuidInitIterator(zsetopsrc *op) {
     }
     iterzset *it = &op->zset_iter;
     it->zs = op->subject;
-    it->node = it->zs->zsl->tail;
+    if (it->zs->encoding == TAIRZSET_ENCODING_LISTPACK) {
+        it->eptr = m_lpSeek(it->zs->zl, -2);
+        it->sptr = it->eptr ? m_lpNext(it->zs->zl, it->eptr) : NULL;
+        it->ele = m_sdsempty();
+        it->score = mnewScore(it->zs->score_num);
+    } else {
+        it->node = it->zs->zsl->tail;
+        it->score = op->types ? mnewScore(it->zs->score_num) : NULL;
+    }
+}
+
+void exZuidClearIterator(zsetopsrc *op) {
+    if (op->subject == NULL) {
+        return;
+    }
+    iterzset *it = &op->zset_iter;
+    if (it->zs->encoding == TAIRZSET_ENCODING_LISTPACK) {
+        m_sdsfree(it->ele);
+        it->ele = NULL;
+    }
+    if (it->score) {
+        RedisModule_Free(it->score);
+        it->score = NULL;
+    }
 }
 
 /* Check if the current value is valid. If so, store it in the passed structure
@@ -140,23 +338,47 @@ int exZuidNext(zsetopsrc *op, zsetopval *val) {
     }
     memset(val, 0, sizeof(zsetopval));
     iterzset *it = &op->zset_iter;
+    if (it->zs->encoding == TAIRZSET_ENCODING_LISTPACK) {
+        uint32_t vlen;
+        unsigned char *vstr;
+
+        if (it->eptr == NULL)
+            return 0;
+        vstr = m_lpGet(it->eptr, &vlen);
+        it->ele = m_sdscpylen(it->ele, (const char *)vstr, vlen);
+        m_zzlGetScore(it->sptr, it->score);
+        mscoreIntToDouble(it->score, op->types);
+        val->ele = it->ele;
+        val->score = it->score;
+
+        /* Move to next element. (going backwards, see exZuidInitIterator) */
+        m_zzlPrev(it->zs->zl, &it->eptr, &it->sptr);
+        return 1;
+    }
+
     if (it->node == NULL)
         return 0;
     val->ele = it->node->ele;
     val->score = it->node->score;
+    if (op->types) {
+        mscoreAssign(it->score, val->score);
+        mscoreIntToDouble(it->score, op->types);
+        val->score = it->score;
+    }
 
     /* Move to next element. (going backwards, see exZuidInitIterator) */
-    it->node = it->node->backward;
+    it->node = it->node->level[0].backward;
     return 1;
 }
 
-inline static void exZunionInterAggregate(scoretype *target, scoretype *score, int aggregate) {
+inline static void exZunionInterAggregate(const m_zscoreOps *ops, const unsigned char *types, scoretype *target,
+                                          scoretype *score, int aggregate) {
     if (aggregate == AGGR_SUM) {
-        mscoreAddIgnoreNan(target, score);
-    } else if (aggregate == AGGR_MIN && mscoreCmp(target, score) > 0) {
-        mscoreAssign(target, score);   
-    } else if (aggregate == AGGR_MAX && mscoreCmp(target, score) < 0) {
-        mscoreAssign(target, score);   
+        ops->addIgnoreNan(target, score, types);
+    } else if (aggregate == AGGR_MIN && ops->cmp(target, score, types) > 0) {
+        ops->assign(target, score);
+    } else if (aggregate == AGGR_MAX && ops->cmp(target, score, types) < 0) {
+        ops->assign(target, score);
     }
 }
 
@@ -170,26 +392,73 @@ int exZuidFind(zsetopsrc *op, zsetopval *val, scoretype *score) {
     }
 
     TairZsetObj *zobj = op->subject;
-    m_dictEntry *de;
-    if ((de = m_dictFind(zobj->dict, val->ele)) != NULL) {
-        mscoreAssign(score, dictGetVal(de));
+    if (zobj->encoding == TAIRZSET_ENCODING_LISTPACK) {
+        if (m_zzlFind(zobj->zl, val->ele, sdslen(val->ele), score) == NULL) return 0;
+        mscoreIntToDouble(score, op->types);
+        return 1;
+    }
+
+    m_zskiplistNode *node;
+    if ((node = m_zindexFind(zobj->index, val->ele, sdslen(val->ele))) != NULL) {
+        mscoreAssign(score, node->score);
+        mscoreIntToDouble(score, op->types);
         return 1;
     } 
     return 0;
 }
 
+/* Return a copy of the schema of the result of a set operation, which is the
+ * one of the sources when they share it (of the first one for a diff, whose
+ * result only has its elements), NULL otherwise: the result is then made of
+ * doubles and the sources having int dimensions are marked to be converted. */
+static unsigned char *exZunionInterSchema(zsetopsrc *src, long setnum, int score_num, int op) {
+    const unsigned char *types = NULL;
+    int first = 1;
+    long i;
+
+    for (i = 0; i < (op == SET_OP_DIFF ? 1 : setnum); i++) {
+        if (src[i].subject == NULL) continue;
+        if (first) {
+            types = src[i].subject->types;
+            first = 0;
+        } else if ((types == NULL) != (src[i].subject->types == NULL) ||
+                   (types && memcmp(types, src[i].subject->types, score_num))) {
+            for (i = 0; i < setnum; i++) {
+                if (src[i].subject) src[i].types = src[i].subject->types;
+            }
+            return NULL;
+        }
+    }
+    if (types == NULL) return NULL;
+
+    unsigned char *copy = RedisModule_Alloc(score_num);
+    memcpy(copy, types, score_num);
+    return copy;
+}
+
 /* ========================= "tairzset" common functions =======================*/
-static int exZsetScore(TairZsetObj *obj, RedisModuleString *member, scoretype **score) {
+/* Look up 'member' and copy its score into 'score', which must be sized for
+ * the schema of the sorted set. */
+static int exZsetScore(TairZsetObj *obj, RedisModuleString *member, scoretype *score) {
     if (!obj || !member) {
         return C_ERR;
     }
 
-    m_dictEntry *de = m_dictFind(obj->dict, member);
-    if (de == NULL) {
+    size_t elelen;
+    const char *ele = RedisModule_StringPtrLen(member, &elelen);
+    if (obj->encoding == TAIRZSET_ENCODING_LISTPACK) {
+        if (m_zzlFind(obj->zl, ele, elelen, score) == NULL) {
+            return C_ERR;
+        }
+        return C_OK;
+    }
+
+    m_zskiplistNode *node = m_zindexFind(obj->index, ele, elelen);
+    if (node == NULL) {
         return C_ERR;
     }
 
-    *score = (scoretype *)dictGetVal(de);
+    mscoreAssign(score, node->score);
 
     return C_OK;
 }
@@ -224,6 +493,7 @@ void exGenericZrangebylexCommand(RedisModuleCtx *ctx, RedisModuleString **argv,
             if (remaining >= 3 && !mstringcasecmp(argv[pos], "limit")) {
                 if ((RedisModule_StringToLongLong(argv[pos + 1], (long long *)&offset) != REDISMODULE_OK) || 
                 (RedisModule_StringToLongLong(argv[pos + 2], (long long *)&limit) != REDISMODULE_OK)) {
+                    m_zslFreeLexRange(&range);
                     RedisModule_ReplyWithError(ctx, "ERR value is out of range");
                     return;
                 }
@@ -241,17 +511,68 @@ void exGenericZrangebylexCommand(RedisModuleCtx *ctx, RedisModuleString **argv,
     real_key = RedisModule_OpenKey(ctx, key, REDISMODULE_READ);
     int type = RedisModule_KeyType(real_key);
     if (REDISMODULE_KEYTYPE_EMPTY != type && RedisModule_ModuleTypeGetType(real_key) != TairZsetType) {
+        m_zslFreeLexRange(&range);
         RedisModule_ReplyWithError(ctx, REDISMODULE_ERRORMSG_WRONGTYPE);
         return;
     }
 
     if (type == REDISMODULE_KEYTYPE_EMPTY) {
+        m_zslFreeLexRange(&range);
         RedisModule_ReplyWithArray(ctx, 0);
         return;
     } else {
         zobj = RedisModule_ModuleTypeGetValue(real_key);
     }
 
+    if (zobj->encoding == TAIRZSET_ENCODING_LISTPACK) {
+        unsigned char *zl = zobj->zl;
+        unsigned char *eptr, *sptr;
+
+        if (reverse) {
+            eptr = m_zzlLastInLexRange(zl, &range);
+        } else {
+            eptr = m_zzlFirstInLexRange(zl, &range);
+        }
+
+        if (eptr == NULL) {
+            RedisModule_ReplyWithArray(ctx, 0);
+            m_zslFreeLexRange(&range);
+            return;
+        }
+
+        sptr = m_lpNext(zl, eptr);
+        RedisModule_ReplyWithArray(ctx, REDISMODULE_POSTPONED_ARRAY_LEN);
+
+        while (eptr && offset--) {
+            if (reverse) {
+                m_zzlPrev(zl, &eptr, &sptr);
+            } else {
+                m_zzlNext(zl, &eptr, &sptr);
+            }
+        }
+
+        while (eptr && limit--) {
+            if (reverse) {
+                if (!m_zzlLexValueGteMin(eptr, &range)) break;
+            } else {
+                if (!m_zzlLexValueLteMax(eptr, &range)) break;
+            }
+
+            rangelen++;
+            exZzlReplyWithMember(ctx, eptr);
+
+            if (reverse) {
+                m_zzlPrev(zl, &eptr, &sptr);
+            } else {
+                m_zzlNext(zl, &eptr, &sptr);
+            }
+        }
+
+        m_zslFreeLexRange(&range);
+        RedisModule_ReplySetArrayLength(ctx, rangelen);
+        return;
+    }
+
     m_zskiplist *zsl = zobj->zsl;
     m_zskiplistNode *ln;
 
@@ -269,12 +590,12 @@ void exGenericZrangebylexCommand(RedisModuleCtx *ctx, RedisModuleString **argv,
 
     RedisModule_ReplyWithArray(ctx, REDISMODULE_POSTPONED_ARRAY_LEN);
 
-    while (ln && offset--) {
-        if (reverse) {
-            ln = ln->backward;
-        } else {
-            ln = ln->level[0].forward;
-        }
+    /* Skip the offset by rank rather than node by node, a negative offset
+     * gives an empty reply. */
+    if (offset < 0) {
+        ln = NULL;
+    } else if (offset > 0) {
+        ln = m_zslSkipNodes(zsl, ln, reverse ? -offset : offset);
     }
 
     while (ln && limit--) {
@@ -285,10 +606,10 @@ void exGenericZrangebylexCommand(RedisModuleCtx *ctx, RedisModuleString **argv,
         }
 
         rangelen++;
-        RedisModule_ReplyWithString(ctx, ln->ele);
+        RedisModule_ReplyWithStringBuffer(ctx, ln->ele, sdslen(ln->ele));
 
         if (reverse) {
-            ln = ln->backward;
+            ln = ln->level[0].backward;
         } else {
             ln = ln->level[0].forward;
         }
@@ -298,15 +619,65 @@ void exGenericZrangebylexCommand(RedisModuleCtx *ctx, RedisModuleString **argv,
     RedisModule_ReplySetArrayLength(ctx, rangelen);
 }
 
+/* Parse the score of an AFTER <score> <member> keyset pagination token with
+ * the schema of 'zobj'. Returns the score, to be freed by the caller, or NULL
+ * after replying with an error. */
+static scoretype *exZsetParseToken(RedisModuleCtx *ctx, TairZsetObj *zobj, RedisModuleString *score) {
+    size_t slen;
+    const char *s = RedisModule_StringPtrLen(score, &slen);
+    scoretype *token;
+    int score_num = mscoreParse(s, slen, zobj->types, zobj->score_num, &token);
+
+    if (score_num != zobj->score_num) {
+        if (score_num > 0) RedisModule_Free(token);
+        RedisModule_ReplyWithError(ctx, "ERR score is not a valid format");
+        return NULL;
+    }
+    return token;
+}
+
+/* Compare the listpack element at 'eptr'/'sptr' of a sorted set of schema
+ * 'types' with the token element. */
+static int exZzlTokenCmp(unsigned char *eptr, unsigned char *sptr, const unsigned char *types, scoretype *score,
+                         const char *ele, size_t elelen) {
+    int cmp = m_zzlScoreCmp(sptr, score, types);
+    return cmp ? cmp : m_zzlCompareElements(eptr, ele, elelen);
+}
+
+/* Return the number of elements a page resuming from the token (score, ele)
+ * skips, in the order given by 'reverse': the ones up to the token included,
+ * whether the token element is still in the set or not. */
+static unsigned long exZsetTokenSkip(TairZsetObj *zobj, scoretype *score, RedisModuleString *ele, int reverse) {
+    size_t elelen;
+    const char *elebuf = RedisModule_StringPtrLen(ele, &elelen);
+    unsigned long before = 0; /* Elements sorting before the token (or equal to it when !reverse). */
+
+    if (zobj->encoding == TAIRZSET_ENCODING_LISTPACK) {
+        unsigned char *zl = zobj->zl;
+        unsigned char *eptr = m_lpSeek(zl, 0), *sptr = eptr ? m_lpNext(zl, eptr) : NULL;
+
+        while (eptr && exZzlTokenCmp(eptr, sptr, zobj->types, score, elebuf, elelen) < (reverse ? 0 : 1)) {
+            before++;
+            m_zzlNext(zl, &eptr, &sptr);
+        }
+    } else {
+        m_zslLastBefore(zobj->zsl, score, elebuf, elelen, !reverse, &before);
+    }
+    return reverse ? exZsetLength(zobj) - before : before;
+}
+
 /* This command implements ZRANGEBYSCORE, ZREVRANGEBYSCORE. */
 static void exGenericZrangebyscoreCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc, int reverse) {
     m_zrangespec range;
     RedisModuleString *key = argv[1];
     TairZsetObj *zobj = NULL;
     long offset = 0, limit = -1;
-    int withscores = 0;
+    int withscores = 0, after = 0;
     unsigned long rangelen = 0;
     int minidx, maxidx;
+    scoretype *token = NULL;
+    const char *tokenele = NULL;
+    size_t tokenlen = 0;
 
     if (reverse) {
         maxidx = 2;
@@ -319,7 +690,8 @@ static void exGenericZrangebyscoreCommand(RedisModuleCtx *ctx, RedisModuleString
     range.max = NULL;
     range.min = NULL;
 
-    if (m_zslParseRange(argv[minidx], argv[maxidx], &range) != C_OK) {
+    RedisModuleKey *real_key = RedisModule_OpenKey(ctx, key, REDISMODULE_READ);
+    if (exZsetParseRange(real_key, argv[minidx], argv[maxidx], &range) != C_OK) {
         RedisModule_ReplyWithError(ctx, "ERR min or max is not a float");
         goto fee_range;
     }
@@ -340,6 +712,10 @@ static void exGenericZrangebyscoreCommand(RedisModuleCtx *ctx, RedisModuleString
                     goto fee_range;
                 }
 
+                pos += 3;
+                remaining -= 3;
+            } else if (remaining >= 3 && !mstringcasecmp(argv[pos], "after")) {
+                after = pos + 1;
                 pos += 3;
                 remaining -= 3;
             } else {
@@ -349,8 +725,6 @@ static void exGenericZrangebyscoreCommand(RedisModuleCtx *ctx, RedisModuleString
         }
     }
 
-    RedisModuleKey *real_key = NULL;
-    real_key = RedisModule_OpenKey(ctx, key, REDISMODULE_READ);
     int type = RedisModule_KeyType(real_key);
     if (REDISMODULE_KEYTYPE_EMPTY != type && RedisModule_ModuleTypeGetType(real_key) != TairZsetType) {
         RedisModule_ReplyWithError(ctx, REDISMODULE_ERRORMSG_WRONGTYPE);
@@ -364,11 +738,84 @@ static void exGenericZrangebyscoreCommand(RedisModuleCtx *ctx, RedisModuleString
         zobj = RedisModule_ModuleTypeGetValue(real_key);
     }
 
-    if (range.max->score_num != zobj->zsl->score_num || range.min->score_num != zobj->zsl->score_num) {
+    if (range.max->score_num != zobj->score_num || range.min->score_num != zobj->score_num) {
         RedisModule_ReplyWithError(ctx, "ERR score is not a valid format");
         goto fee_range;
     }
 
+    if (after) {
+        if ((token = exZsetParseToken(ctx, zobj, argv[after])) == NULL) goto fee_range;
+        tokenele = RedisModule_StringPtrLen(argv[after + 1], &tokenlen);
+    }
+
+    if (zobj->encoding == TAIRZSET_ENCODING_LISTPACK) {
+        unsigned char *zl = zobj->zl;
+        unsigned char *eptr, *sptr;
+
+        if (reverse) {
+            eptr = m_zzlLastInRange(zl, &range);
+        } else {
+            eptr = m_zzlFirstInRange(zl, &range);
+        }
+
+        /* Resume after the token, which may be inside the range. */
+        sptr = eptr ? m_lpNext(zl, eptr) : NULL;
+        while (token && eptr) {
+            int cmp = exZzlTokenCmp(eptr, sptr, zobj->types, token, tokenele, tokenlen);
+            if (reverse ? cmp < 0 : cmp > 0) break;
+            if (reverse) {
+                m_zzlPrev(zl, &eptr, &sptr);
+            } else {
+                m_zzlNext(zl, &eptr, &sptr);
+            }
+        }
+
+        if (eptr == NULL) {
+            RedisModule_ReplyWithArray(ctx, 0);
+            goto fee_range;
+        }
+
+        sptr = m_lpNext(zl, eptr);
+        scoretype *score = mnewScore(zobj->score_num);
+        RedisModule_ReplyWithArray(ctx, REDISMODULE_POSTPONED_ARRAY_LEN);
+
+        while (eptr && offset--) {
+            if (reverse) {
+                m_zzlPrev(zl, &eptr, &sptr);
+            } else {
+                m_zzlNext(zl, &eptr, &sptr);
+            }
+        }
+
+        while (eptr && limit--) {
+            if (reverse) {
+                if (!m_zzlValueGteMin(sptr, &range)) break;
+            } else {
+                if (!m_zzlValueLteMax(sptr, &range)) break;
+            }
+
+            rangelen++;
+            exZzlReplyWithMember(ctx, eptr);
+
+            if (withscores) {
+                exZzlReplyWithScore(ctx, zobj, sptr, score);
+            }
+
+            if (reverse) {
+                m_zzlPrev(zl, &eptr, &sptr);
+            } else {
+                m_zzlNext(zl, &eptr, &sptr);
+            }
+        }
+
+        RedisModule_Free(score);
+        if (withscores) {
+            rangelen *= 2;
+        }
+        RedisModule_ReplySetArrayLength(ctx, rangelen);
+        goto fee_range;
+    }
+
     m_zskiplist *zsl = zobj->zsl;
     m_zskiplistNode *ln;
 
@@ -378,6 +825,18 @@ static void exGenericZrangebyscoreCommand(RedisModuleCtx *ctx, RedisModuleString
         ln = m_zslFirstInRange(zsl, &range);
     }
 
+    /* Resume after the token with a single descent, unless the range
+     * starts after the token anyway. */
+    if (token && ln) {
+        m_zskiplistNode *next = m_zslLastBefore(zsl, token, tokenele, tokenlen, !reverse, NULL);
+        if (!reverse) next = next ? next->level[0].forward : zsl->header->level[0].forward;
+        if (next == NULL) {
+            ln = NULL;
+        } else if (reverse ? m_zslValueLteMax(next->score, &range) : m_zslValueGteMin(next->score, &range)) {
+            ln = next;
+        }
+    }
+
     if (ln == NULL) {
         RedisModule_ReplyWithArray(ctx, 0);
         goto fee_range;
@@ -385,12 +844,12 @@ static void exGenericZrangebyscoreCommand(RedisModuleCtx *ctx, RedisModuleString
 
     RedisModule_ReplyWithArray(ctx, REDISMODULE_POSTPONED_ARRAY_LEN);
 
-    while (ln && offset--) {
-        if (reverse) {
-            ln = ln->backward;
-        } else {
-            ln = ln->level[0].forward;
-        }
+    /* Skip the offset by rank rather than node by node, a negative offset
+     * gives an empty reply. */
+    if (offset < 0) {
+        ln = NULL;
+    } else if (offset > 0) {
+        ln = m_zslSkipNodes(zsl, ln, reverse ? -offset : offset);
     }
 
     while (ln && limit--) {
@@ -401,16 +860,14 @@ static void exGenericZrangebyscoreCommand(RedisModuleCtx *ctx, RedisModuleString
         }
 
         rangelen++;
-        RedisModule_ReplyWithString(ctx, ln->ele);
+        RedisModule_ReplyWithStringBuffer(ctx, ln->ele, sdslen(ln->ele));
 
         if (withscores) {
-            sds score_str = mscore2String(ln->score);
-            RedisModule_ReplyWithStringBuffer(ctx, score_str, sdslen(score_str));
-            m_sdsfree(score_str);
+            exZsetReplyWithScore(ctx, zobj, ln->score);
         }
 
         if (reverse) {
-            ln = ln->backward;
+            ln = ln->level[0].backward;
         } else {
             ln = ln->level[0].forward;
         }
@@ -425,56 +882,136 @@ static void exGenericZrangebyscoreCommand(RedisModuleCtx *ctx, RedisModuleString
 fee_range:
     RedisModule_Free(range.max);
     RedisModule_Free(range.min);
+    if (token) RedisModule_Free(token);
 }
 
-static int exZsetAdd(TairZsetObj *obj, scoretype *score, RedisModuleString *ele, int *flags, scoretype **newscore) {
+/* Add a new element or update the score of an existing element in a sorted
+ * set, regardless of its encoding. The score is copied into the listpack or
+ * the skiplist node, 'score' stays owned by the caller but is overwritten by
+ * the result of ZADD_INCR. When 'newscore' is not NULL the resulting score
+ * is copied into it (used by ZADD_INCR).
+ *
+ * When 'rank' is not NULL and the key is skiplist encoded, the 0-based rank
+ * of the element after the operation is stored there (-1 if it is not in
+ * the set), taken from the search done by the write itself. A listpack is
+ * short enough for the caller to walk it with exZsetRank(). */
+static int exZsetAdd(TairZsetObj *obj, scoretype *score, RedisModuleString *ele, int *flags, scoretype *newscore,
+                     long *rank) {
     int incr = (*flags & ZADD_INCR) != 0;
     int nx = (*flags & ZADD_NX) != 0;
     int xx = (*flags & ZADD_XX) != 0;
     *flags = 0; 
     scoretype *curscore;
+    size_t elelen;
+    const char *elebuf = RedisModule_StringPtrLen(ele, &elelen);
+
+    if (obj->encoding == TAIRZSET_ENCODING_LISTPACK) {
+        unsigned char *eptr, *sptr;
 
+        if ((eptr = m_zzlFind(obj->zl, elebuf, elelen, NULL)) != NULL) {
+            if (nx) {
+                *flags |= ZADD_NOP;
+                return 1;
+            }
+
+            sptr = m_lpNext(obj->zl, eptr);
+            if (incr) {
+                curscore = mnewScore(obj->score_num);
+                m_zzlGetScore(sptr, curscore);
+                int ret = mscoreAdd(score, curscore, obj->types);
+                RedisModule_Free(curscore);
+                if (ret < 0) {
+                    *flags |= ZADD_NAN;
+                    return 0;
+                }
+                if (ret > 0 || mscoreFitSchema(score, obj->types) != 0) {
+                    *flags |= ZADD_RANGE;
+                    return 0;
+                }
+                if (newscore) {
+                    mscoreAssign(newscore, score);
+                }
+            }
+
+            /* Remove and re-insert when score changed. */
+            if (m_zzlScoreCmp(sptr, score, obj->types) != 0) {
+                obj->zl = m_zzlDelete(obj->zl, eptr);
+                obj->zl = m_zzlInsert(obj->zl, elebuf, elelen, score, obj->types);
+                *flags |= ZADD_UPDATED;
+            }
+            return 1;
+        } else if (!xx) {
+            /* Check if the element is too large or the list
+             * becomes too long *before* executing m_zzlInsert. */
+            if (m_zzlLength(obj->zl) + 1 > (unsigned long long)tairzset_max_listpack_entries ||
+                elelen > (size_t)tairzset_max_listpack_value ||
+                !m_lpSafeToAdd(obj->zl, elelen + obj->score_num * sizeof(double))) {
+                exZsetConvert(obj, TAIRZSET_ENCODING_SKIPLIST);
+            } else {
+                obj->zl = m_zzlInsert(obj->zl, elebuf, elelen, score, obj->types);
+                if (newscore) {
+                    mscoreAssign(newscore, score);
+                }
+                *flags |= ZADD_ADDED;
+                return 1;
+            }
+        } else {
+            *flags |= ZADD_NOP;
+            return 1;
+        }
+    }
+
+    /* Note that the above block handling listpack would have either returned or
+     * converted the key to skiplist. */
     m_zskiplistNode *znode;
+    unsigned long zrank;
 
-    m_dictEntry *de;
-    de = m_dictFind(obj->dict, ele);
-    if (de != NULL) {
+    if (rank) *rank = -1;
+    znode = m_zindexFind(obj->index, elebuf, elelen);
+    if (znode != NULL) {
         if (nx) {
+            if (rank) *rank = m_zslGetRankByNode(obj->zsl, znode) - 1;
             *flags |= ZADD_NOP;
             return 1;
         }
 
-        curscore = (scoretype *)dictGetVal(de);
+        curscore = znode->score;
 
         if (incr) {
-            int ret = mscoreAdd(score, curscore);
-            if (ret) {
+            int ret = obj->zsl->ops->add(score, curscore, obj->types);
+            if (ret < 0) {
                 *flags |= ZADD_NAN;
                 return 0;
             }
+            if (ret > 0 || mscoreFitSchema(score, obj->types) != 0) {
+                *flags |= ZADD_RANGE;
+                return 0;
+            }
             if (newscore) {
-                *newscore = score;
+                obj->zsl->ops->assign(newscore, score);
             }
         }
 
-        if (mscoreCmp(score, curscore) != 0) {
-            znode = m_zslUpdateScore(obj->zsl, curscore, ele, score);
-            dictGetVal(de) = znode->score;  
+        if (obj->zsl->ops->cmp(score, curscore, obj->types) != 0) {
+            m_zslUpdateScore(obj->zsl, znode, score, rank ? &zrank : NULL);
             *flags |= ZADD_UPDATED;
-        } else {
-            RedisModule_Free(score);
-            if (incr && newscore) {
-                *newscore = curscore;
-            }
+        } else if (rank) {
+            zrank = m_zslGetRankByNode(obj->zsl, znode);
         }
+        if (rank) *rank = zrank - 1;
         return 1;
     } else if (!xx) {
-        ele = RedisModule_CreateStringFromString(NULL, ele);
-        znode = m_zslInsert(obj->zsl, score, ele);
-        assert(m_dictAdd(obj->dict, ele, znode->score) == DICT_OK);
+        if (newscore) {
+            obj->zsl->ops->assign(newscore, score);
+        }
+        if (rank) {
+            znode = m_zslInsertWithRank(obj->zsl, score, elebuf, elelen, &zrank);
+            *rank = zrank - 1;
+        } else {
+            znode = m_zslInsert(obj->zsl, score, elebuf, elelen);
+        }
+        m_zindexAdd(obj->index, znode);
         *flags |= ZADD_ADDED;
-        if (newscore)
-            *newscore = score;
         return 1;
     } else {
         *flags |= ZADD_NOP;
@@ -484,18 +1021,83 @@ static int exZsetAdd(TairZsetObj *obj, scoretype *score, RedisModuleString *ele,
     return 0; 
 }
 
-static int exZsetRemoveFromSkiplist(TairZsetObj *zobj, RedisModuleString *ele) {
-    m_dictEntry *de;
-    de = m_dictUnlink(zobj->dict, ele);
-    if (de != NULL) {
-        scoretype *score = (scoretype *)dictGetVal(de);
-        m_dictFreeUnlinkedEntry(zobj->dict, de);
-        int retval = m_zslDelete(zobj->zsl, score, ele, NULL);
-        assert(retval);
+/* Below this number of pairs EXZADD adds the elements one by one. */
+#define ZADD_BATCH_MIN_ELEMENTS 16
+
+/* Like calling exZsetAdd() for each of the 'elements' score/member pairs of
+ * 'pairs' (without ZADD_INCR, so that no pair can fail), for a skiplist
+ * encoded 'obj'. 'scores' holds the parsed scores, 'stride' bytes each.
+ *
+ * The members are hashed and their buckets prefetched first, then looked up.
+ * Existing members are updated in place, while the new ones are indexed at
+ * once but linked in the skiplist only at the end, sorted, by a single
+ * m_zslInsertNodes() sweep. A member repeated in the batch finds its node in
+ * the index, pending or not, so the result is the one of the sequential
+ * adds, counters included. */
+static void exZsetAddBatch(TairZsetObj *obj, char *scores, size_t stride, RedisModuleString **pairs, int elements,
+                           int flags, int *added, int *updated, int *processed) {
+    int nx = (flags & ZADD_NX) != 0;
+    int xx = (flags & ZADD_XX) != 0;
+    m_zskiplist *zsl = obj->zsl;
+    m_zskiplistNode **pending = RedisModule_Alloc(sizeof(*pending) * elements), *znode;
+    uint64_t *hashes = RedisModule_Alloc(sizeof(*hashes) * elements);
+    unsigned long npending = 0;
+    const char *elebuf;
+    size_t elelen;
+    int j;
+
+    for (j = 0; j < elements; j++) {
+        elebuf = RedisModule_StringPtrLen(pairs[j * 2 + 1], &elelen);
+        hashes[j] = m_zindexHash(elebuf, elelen);
+        m_zindexPrefetch(obj->index, hashes[j]);
+    }
 
-        if (m_htNeedsResize(zobj->dict)) {
-            m_dictResize(zobj->dict);
+    for (j = 0; j < elements; j++) {
+        scoretype *score = (scoretype *)(scores + j * stride);
+
+        elebuf = RedisModule_StringPtrLen(pairs[j * 2 + 1], &elelen);
+        znode = m_zindexFindHashed(obj->index, elebuf, elelen, hashes[j]);
+        if (znode != NULL) {
+            if (nx) continue;
+            (*processed)++;
+            if (zsl->ops->cmp(score, znode->score, zsl->types) == 0) continue;
+
+            /* A node still pending has no predecessor, nor is it the first. */
+            if (znode->level[0].backward == NULL && zsl->header->level[0].forward != znode) {
+                m_zslSetNodeScore(zsl, znode, score);
+            } else {
+                m_zslUpdateScore(zsl, znode, score, NULL);
+            }
+            (*updated)++;
+        } else if (!xx) {
+            znode = m_zslCreateNode(m_zslRandomLevel(), zsl->score_num, zsl->types, score, elebuf, elelen);
+            znode->level[0].backward = NULL;
+            m_zindexAddHashed(obj->index, znode, hashes[j]);
+            pending[npending++] = znode;
+            (*processed)++;
+            (*added)++;
         }
+    }
+
+    m_zslInsertNodes(zsl, pending, npending);
+    RedisModule_Free(hashes);
+    RedisModule_Free(pending);
+}
+
+/* Unlink 'node' from both the member index and the skiplist, and free it. */
+static void exZsetDeleteNode(TairZsetObj *zobj, m_zskiplistNode *node) {
+    m_zindexDelete(zobj->index, node);
+    m_zslDeleteByNode(zobj->zsl, node);
+
+    if (m_zindexNeedsResize(zobj->index)) {
+        m_zindexResize(zobj->index);
+    }
+}
+
+static int exZsetRemoveFromSkiplist(TairZsetObj *zobj, const char *ele, size_t elelen) {
+    m_zskiplistNode *node = m_zindexFind(zobj->index, ele, elelen);
+    if (node != NULL) {
+        exZsetDeleteNode(zobj, node);
         return 1;
     }
 
@@ -503,7 +1105,17 @@ static int exZsetRemoveFromSkiplist(TairZsetObj *zobj, RedisModuleString *ele) {
 }
 
 int exZsetDel(TairZsetObj *zobj, RedisModuleString *ele) {
-    if (exZsetRemoveFromSkiplist(zobj, ele)) {
+    size_t elelen;
+    const char *elebuf = RedisModule_StringPtrLen(ele, &elelen);
+
+    if (zobj->encoding == TAIRZSET_ENCODING_LISTPACK) {
+        unsigned char *eptr;
+
+        if ((eptr = m_zzlFind(zobj->zl, elebuf, elelen, NULL)) != NULL) {
+            zobj->zl = m_zzlDelete(zobj->zl, eptr);
+            return 1;
+        }
+    } else if (exZsetRemoveFromSkiplist(zobj, elebuf, elelen)) {
         return 1;
     }
 
@@ -514,11 +1126,12 @@ void exZrangeGenericCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int a
     RedisModuleString *key = argv[1];
     TairZsetObj *zobj = NULL;
 
-    int withscores = 0;
+    int withscores = 0, after = 0, j;
     long start;
     long end;
     long llen;
     long rangelen;
+    long skip = 0;
 
     if ((RedisModule_StringToLongLong(argv[2], (long long *)&start) != REDISMODULE_OK) || 
     (RedisModule_StringToLongLong(argv[3], (long long *)&end) != REDISMODULE_OK)) {
@@ -526,11 +1139,16 @@ void exZrangeGenericCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int a
         return;
     }
 
-    if (argc == 5 && !mstringcasecmp(argv[4], "withscores")) {
-        withscores = 1;
-    } else if (argc >= 5) {
-        RedisModule_ReplyWithError(ctx, "ERR syntax error");
-        return;
+    for (j = 4; j < argc; j++) {
+        if (!mstringcasecmp(argv[j], "withscores")) {
+            withscores = 1;
+        } else if (j + 2 < argc && !mstringcasecmp(argv[j], "after")) {
+            after = j + 1;
+            j += 2;
+        } else {
+            RedisModule_ReplyWithError(ctx, "ERR syntax error");
+            return;
+        }
     }
 
     RedisModuleKey *real_key = NULL;
@@ -548,7 +1166,16 @@ void exZrangeGenericCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int a
         zobj = RedisModule_ModuleTypeGetValue(real_key);
     }
 
-    llen = exZsetLength(zobj);
+    /* With AFTER the indexes are the ones of the elements following the
+     * token, which are the whole set minus the 'skip' first ones. */
+    if (after) {
+        scoretype *token = exZsetParseToken(ctx, zobj, argv[after]);
+        if (token == NULL) return;
+        skip = exZsetTokenSkip(zobj, token, argv[after + 1], reverse);
+        RedisModule_Free(token);
+    }
+
+    llen = exZsetLength(zobj) - skip;
     if (start < 0) start = llen + start;
     if (end < 0) end = llen + end;
     if (start < 0) start = 0;
@@ -559,12 +1186,43 @@ void exZrangeGenericCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int a
     }
     if (end >= llen) end = llen - 1;
     rangelen = (end - start) + 1;
+    start += skip;
+    llen += skip;
 
     RedisModule_ReplyWithArray(ctx, withscores ? (rangelen * 2) : rangelen);
 
+    if (zobj->encoding == TAIRZSET_ENCODING_LISTPACK) {
+        unsigned char *zl = zobj->zl;
+        unsigned char *eptr, *sptr;
+        scoretype *score = withscores ? mnewScore(zobj->score_num) : NULL;
+
+        if (reverse)
+            eptr = m_lpSeek(zl, -2 - (2 * start));
+        else
+            eptr = m_lpSeek(zl, 2 * start);
+
+        assert(eptr != NULL);
+        sptr = m_lpNext(zl, eptr);
+
+        while (rangelen--) {
+            assert(eptr != NULL && sptr != NULL);
+            exZzlReplyWithMember(ctx, eptr);
+            if (withscores) {
+                exZzlReplyWithScore(ctx, zobj, sptr, score);
+            }
+            if (reverse)
+                m_zzlPrev(zl, &eptr, &sptr);
+            else
+                m_zzlNext(zl, &eptr, &sptr);
+        }
+
+        if (score) RedisModule_Free(score);
+        return;
+    }
+
     m_zskiplist *zsl = zobj->zsl;
     m_zskiplistNode *ln;
-    RedisModuleString *ele;
+    sds ele;
 
     if (reverse) {
         ln = zsl->tail;
@@ -578,24 +1236,133 @@ void exZrangeGenericCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int a
 
     while (rangelen--) {
         ele = ln->ele;
-        RedisModule_ReplyWithString(ctx, ele);
+        RedisModule_ReplyWithStringBuffer(ctx, ele, sdslen(ele));
         if (withscores) {
-            sds score_str = mscore2String(ln->score);
-            RedisModule_ReplyWithStringBuffer(ctx, score_str, sdslen(score_str));
-            m_sdsfree(score_str);
+            exZsetReplyWithScore(ctx, zobj, ln->score);
+        }
+        ln = reverse ? ln->level[0].backward : ln->level[0].forward;
+    }
+}
+
+/* EXZRANGEAROUND key member before after [REV] [WITHSCORES]
+ *
+ * Reply with the window of up to 'before' elements, the member itself and up
+ * to 'after' elements around 'member' (empty if it is not in the set), in
+ * the order given by REV. A skiplist node is found through the index and the
+ * window walked from it, so no rank is needed at all. A listpack is short,
+ * its window is sought from the rank of the member. */
+void exZrangeAroundGenericCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    long long before, after;
+    int j, reverse = 0, withscores = 0;
+    TairZsetObj *zobj;
+    long rangelen = 0;
+
+    if (RedisModule_StringToLongLong(argv[3], &before) != REDISMODULE_OK ||
+        RedisModule_StringToLongLong(argv[4], &after) != REDISMODULE_OK || before < 0 || after < 0) {
+        RedisModule_ReplyWithError(ctx, "ERR value is out of range");
+        return;
+    }
+
+    for (j = 5; j < argc; j++) {
+        if (!mstringcasecmp(argv[j], "rev")) {
+            reverse = 1;
+        } else if (!mstringcasecmp(argv[j], "withscores")) {
+            withscores = 1;
+        } else {
+            RedisModule_ReplyWithError(ctx, "ERR syntax error");
+            return;
         }
-        ln = reverse ? ln->backward : ln->level[0].forward;
     }
+
+    RedisModuleKey *real_key = RedisModule_OpenKey(ctx, argv[1], REDISMODULE_READ);
+    int type = RedisModule_KeyType(real_key);
+    if (REDISMODULE_KEYTYPE_EMPTY != type && RedisModule_ModuleTypeGetType(real_key) != TairZsetType) {
+        RedisModule_ReplyWithError(ctx, REDISMODULE_ERRORMSG_WRONGTYPE);
+        return;
+    }
+
+    if (type == REDISMODULE_KEYTYPE_EMPTY) {
+        RedisModule_ReplyWithArray(ctx, 0);
+        return;
+    }
+    zobj = RedisModule_ModuleTypeGetValue(real_key);
+
+    if (zobj->encoding == TAIRZSET_ENCODING_LISTPACK) {
+        unsigned char *zl = zobj->zl;
+        unsigned char *eptr, *sptr;
+        long llen = exZsetLength(zobj), start, end;
+        long rank = exZsetRank(zobj, argv[2], reverse, 0, NULL);
+
+        if (rank < 0) {
+            RedisModule_ReplyWithArray(ctx, 0);
+            return;
+        }
+        start = rank > before ? rank - before : 0;
+        end = llen - 1 - rank > after ? rank + after : llen - 1;
+        rangelen = end - start + 1;
+        RedisModule_ReplyWithArray(ctx, withscores ? rangelen * 2 : rangelen);
+
+        scoretype *score = withscores ? mnewScore(zobj->score_num) : NULL;
+        eptr = m_lpSeek(zl, reverse ? -2 - (2 * start) : 2 * start);
+        sptr = m_lpNext(zl, eptr);
+        while (rangelen--) {
+            assert(eptr != NULL && sptr != NULL);
+            exZzlReplyWithMember(ctx, eptr);
+            if (withscores) {
+                exZzlReplyWithScore(ctx, zobj, sptr, score);
+            }
+            if (reverse)
+                m_zzlPrev(zl, &eptr, &sptr);
+            else
+                m_zzlNext(zl, &eptr, &sptr);
+        }
+        if (score) RedisModule_Free(score);
+        return;
+    }
+
+    size_t elelen;
+    const char *elebuf = RedisModule_StringPtrLen(argv[2], &elelen);
+    m_zskiplistNode *ln = m_zindexFind(zobj->index, elebuf, elelen), *prev;
+
+    if (ln == NULL) {
+        RedisModule_ReplyWithArray(ctx, 0);
+        return;
+    }
+
+    /* Walk back to the first element of the window, then reply forward. */
+    while (before-- && (prev = reverse ? ln->level[0].forward : ln->level[0].backward) != NULL) {
+        ln = prev;
+        rangelen++;
+    }
+    if (after > (long long)zobj->zsl->length) after = zobj->zsl->length;
+    rangelen += 1 + after;
+
+    long replied = 0;
+    RedisModule_ReplyWithArray(ctx, REDISMODULE_POSTPONED_ARRAY_LEN);
+    while (ln && replied < rangelen) {
+        RedisModule_ReplyWithStringBuffer(ctx, ln->ele, sdslen(ln->ele));
+        if (withscores) {
+            exZsetReplyWithScore(ctx, zobj, ln->score);
+        }
+        ln = reverse ? ln->level[0].backward : ln->level[0].forward;
+        replied++;
+    }
+    RedisModule_ReplySetArrayLength(ctx, withscores ? replied * 2 : replied);
 }
 
 static void exZaddGenericCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc, int flags) {
     static char *nanerr = "ERR resulting score is not a number (NaN)";
+    static char *rangeerr = "ERR resulting score is out of range for its type";
 
     RedisModuleString *ele;
-    scoretype *score;
-    scoretype **scores;
-    int j, elements;
+    scoretype *score, *newscore = NULL;
+    char *scores = NULL; /* All the scores, 'stride' bytes each. */
+    size_t stride = 0;
+    double dims[MAX_SCORE_NUM];
+    unsigned char *schema = NULL, *types;
+    int j, elements = 0, schema_num = 0, binary = 0;
     int scoreidx = 0;
+    long rank = -1;
 
     int added = 0;     /* Number of new elements added. */
     int updated = 0;   /* Number of elements with updated score. */
@@ -613,7 +1380,20 @@ static void exZaddGenericCommand(RedisModuleCtx *ctx, RedisModuleString **argv,
             flags |= ZADD_CH;
         else if (!mstringcasecmp(opt, "incr"))
             flags |= ZADD_INCR;
-        else
+        else if (!mstringcasecmp(opt, "binary"))
+            binary = 1;
+        else if (!mstringcasecmp(opt, "withrank"))
+            flags |= ZADD_WITHRANK;
+        else if (!mstringcasecmp(opt, "withrevrank"))
+            flags |= ZADD_WITHREVRANK;
+        else if (!mstringcasecmp(opt, "schema") && scoreidx + 1 < argc && !schema) {
+            size_t slen;
+            const char *s = RedisModule_StringPtrLen(argv[++scoreidx], &slen);
+            if ((schema_num = mscoreParseSchema(s, slen, &schema)) <= 0) {
+                RedisModule_ReplyWithError(ctx, "ERR schema is not a valid format");
+                return;
+            }
+        } else
             break;
         scoreidx++;
     }
@@ -622,93 +1402,144 @@ static void exZaddGenericCommand(RedisModuleCtx *ctx, RedisModuleString **argv,
     int nx = (flags & ZADD_NX) != 0;
     int xx = (flags & ZADD_XX) != 0;
     int ch = (flags & ZADD_CH) != 0;
+    int withrank = (flags & (ZADD_WITHRANK | ZADD_WITHREVRANK)) != 0;
 
     int step = 2;
 
     elements = argc - scoreidx;
     if (elements % step || !elements) {
         RedisModule_ReplyWithError(ctx, "ERR syntax error");
-        return;
+        elements = 0;
+        goto cleanup;
     }
     elements /= step; 
 
     if (nx && xx) {
         RedisModule_ReplyWithError(ctx, "ERR XX and NX options at the same time are not compatible");
-        return;
+        elements = 0;
+        goto cleanup;
     }
 
     if (incr && elements > 1) {
         RedisModule_ReplyWithError(ctx, "ERR INCR option supports a single increment-element pair");
-        return;
+        elements = 0;
+        goto cleanup;
+    }
+
+    if ((flags & ZADD_WITHRANK) && (flags & ZADD_WITHREVRANK)) {
+        RedisModule_ReplyWithError(ctx, "ERR WITHRANK and WITHREVRANK options at the same time are not compatible");
+        elements = 0;
+        goto cleanup;
     }
 
-    int score_num = 0, last_score_num = 0;
+    if (withrank && elements > 1) {
+        RedisModule_ReplyWithError(ctx, "ERR WITHRANK option supports a single score-element pair");
+        elements = 0;
+        goto cleanup;
+    }
+
+    RedisModuleKey *key = RedisModule_OpenKey(ctx, argv[1], REDISMODULE_READ | REDISMODULE_WRITE);
+    int type = RedisModule_KeyType(key);
+    if (REDISMODULE_KEYTYPE_EMPTY != type && RedisModule_ModuleTypeGetType(key) != TairZsetType) {
+        RedisModule_ReplyWithError(ctx, REDISMODULE_ERRORMSG_WRONGTYPE);
+        elements = 0;
+        goto cleanup;
+    }
+
+    /* The scores are parsed with the schema of the key, or the one given
+     * with SCHEMA when the key is created, which must match otherwise. */
+    TairZsetObj *tair_zset_obj = NULL;
+    int score_num = 0, last_score_num = schema_num;
+    types = schema;
+    if (type != REDISMODULE_KEYTYPE_EMPTY) {
+        tair_zset_obj = RedisModule_ModuleTypeGetValue(key);
+        if (schema_num && (schema_num != tair_zset_obj->score_num || (schema == NULL) != (tair_zset_obj->types == NULL) ||
+                           (schema && memcmp(schema, tair_zset_obj->types, schema_num)))) {
+            RedisModule_ReplyWithError(ctx, "ERR schema does not match the existing key");
+            elements = 0;
+            goto cleanup;
+        }
+        types = tair_zset_obj->types;
+        last_score_num = tair_zset_obj->score_num;
+    }
+
+    /* Parse all the scores into a single allocation, sized once the first
+     * score gives the number of dimensions. */
     size_t tmp_score_len;
     const char *tmp_score;
-    scores = RedisModule_Calloc(1, sizeof(scoretype *) * elements);
     for (j = 0; j < elements; j++) {
         tmp_score = RedisModule_StringPtrLen(argv[scoreidx + j * step], &tmp_score_len);
-        if ((score_num = mscoreParse(tmp_score, tmp_score_len, &scores[j])) <= 0) {
+        if (binary)
+            score_num = mscoreParseBinary(tmp_score, tmp_score_len, types, last_score_num ? last_score_num : MAX_SCORE_NUM, dims);
+        else
+            score_num = mscoreParseTo(tmp_score, tmp_score_len, types, last_score_num ? last_score_num : MAX_SCORE_NUM, dims);
+        if (score_num <= 0 || (last_score_num != 0 && last_score_num != score_num)) {
             RedisModule_ReplyWithError(ctx, "ERR score is not a valid format");
             goto cleanup;
         }
 
-        if (last_score_num != 0 && last_score_num != score_num) {
-            RedisModule_ReplyWithError(ctx, "ERR score is not a valid format");
-            goto cleanup;
+        if (scores == NULL) {
+            stride = sizeof(scoretype) + score_num * sizeof(double);
+            scores = RedisModule_Alloc(stride * elements);
         }
-
+        score = (scoretype *)(scores + j * stride);
+        score->score_num = score_num;
+        memcpy(score->scores, dims, score_num * sizeof(double));
         last_score_num = score_num;
     }
 
-    RedisModuleKey *key = RedisModule_OpenKey(ctx, argv[1], REDISMODULE_READ | REDISMODULE_WRITE);
-    int type = RedisModule_KeyType(key);
-    if (REDISMODULE_KEYTYPE_EMPTY != type && RedisModule_ModuleTypeGetType(key) != TairZsetType) {
-        RedisModule_ReplyWithError(ctx, REDISMODULE_ERRORMSG_WRONGTYPE);
-        goto cleanup;
-    }
-
-    TairZsetObj *tair_zset_obj = NULL;
     if (type == REDISMODULE_KEYTYPE_EMPTY) {
-        if (xx) {
-            for (int i = 0; i < elements; i++) {
-                RedisModule_Free(scores[i]);
-            }
-            goto reply_to_client; 
-        }
+        if (xx) goto reply_to_client; 
 
-        tair_zset_obj = createTairZsetTypeObject(last_score_num);
+        size_t maxelelen = 0, elelen;
+        for (j = 0; j < elements; j++) {
+            RedisModule_StringPtrLen(argv[scoreidx + 1 + j * step], &elelen);
+            if (elelen > maxelelen) maxelelen = elelen;
+        }
+        tair_zset_obj = exZsetTypeCreate(last_score_num, schema, elements, maxelelen);
+        schema = NULL; /* Owned by the new key. */
         RedisModule_ModuleTypeSetValue(key, TairZsetType, tair_zset_obj);
     } else {
-        tair_zset_obj = RedisModule_ModuleTypeGetValue(key);
-        if (tair_zset_obj->zsl->score_num != last_score_num) {
+        if (tair_zset_obj->score_num != last_score_num) {
             RedisModule_ReplyWithError(ctx, "ERR score is not a valid format");
             goto cleanup;
         }
     }
 
-    for (j = 0; j < elements; j++) {
-        scoretype *new_score = NULL;
-        score = scores[j];
-        int retflags = flags;
+    if (incr) {
+        newscore = mnewScore(last_score_num);
+    }
+
+    if (!incr && elements >= ZADD_BATCH_MIN_ELEMENTS && tair_zset_obj->encoding == TAIRZSET_ENCODING_SKIPLIST) {
+        exZsetAddBatch(tair_zset_obj, scores, stride, argv + scoreidx, elements, flags, &added, &updated, &processed);
+    } else {
+        for (j = 0; j < elements; j++) {
+            score = (scoretype *)(scores + j * stride);
+            int retflags = flags;
 
-        ele = argv[scoreidx + 1 + j * step];
+            ele = argv[scoreidx + 1 + j * step];
 
-        int retval = exZsetAdd(tair_zset_obj, score, ele, &retflags, &new_score);
-        if (retval == 0) {
-            RedisModule_ReplyWithError(ctx, nanerr);
-            goto cleanup;
+            int retval = exZsetAdd(tair_zset_obj, score, ele, &retflags, newscore, withrank ? &rank : NULL);
+            if (retval == 0) {
+                RedisModule_ReplyWithError(ctx, (retflags & ZADD_RANGE) ? rangeerr : nanerr);
+                goto cleanup;
+            }
+            if (retflags & ZADD_ADDED)
+                added++;
+            if (retflags & ZADD_UPDATED)
+                updated++;
+            if (!(retflags & ZADD_NOP))
+                processed++;
         }
-        if (retflags & ZADD_ADDED)
-            added++;
-        if (retflags & ZADD_UPDATED)
-            updated++;
-        if (!(retflags & ZADD_NOP))
-            processed++;
-        if (retflags & ZADD_NOP) {
-            RedisModule_Free(score);
+    }
+
+    if (withrank) {
+        if (tair_zset_obj->encoding == TAIRZSET_ENCODING_LISTPACK) {
+            rank = exZsetRank(tair_zset_obj, argv[scoreidx + 1], 0, 0, NULL);
+        }
+        if (rank >= 0 && (flags & ZADD_WITHREVRANK)) {
+            rank = (long)exZsetLength(tair_zset_obj) - 1 - rank;
         }
-        score = new_score;
     }
 
     RedisModule_ReplicateVerbatim(ctx);
@@ -718,60 +1549,111 @@ static void exZaddGenericCommand(RedisModuleCtx *ctx, RedisModuleString **argv,
     }
 
 reply_to_client:
+    if (withrank) {
+        RedisModule_ReplyWithArray(ctx, 2);
+    }
     if (incr) { 
         if (processed) {
-            sds score_str = mscore2String(score);
-            RedisModule_ReplyWithStringBuffer(ctx, score_str, sdslen(score_str));
-            m_sdsfree(score_str);
+            exZsetReplyWithScore(ctx, tair_zset_obj, newscore);
         } else {
             RedisModule_ReplyWithNull(ctx);
         }
     } else { 
         RedisModule_ReplyWithLongLong(ctx, ch ? added + updated : added);
     }
-
-    RedisModule_Free(scores);
-    return;
+    if (withrank) {
+        if (rank >= 0) {
+            RedisModule_ReplyWithLongLong(ctx, rank);
+        } else {
+            RedisModule_ReplyWithNull(ctx);
+        }
+    }
 
 cleanup:
-    for (int i = 0; i < elements; i++) {
-        RedisModule_Free(scores[i]);
-    }
     RedisModule_Free(scores);
+    RedisModule_Free(schema);
+    if (newscore) RedisModule_Free(newscore);
 }
 
-long exZsetRank(TairZsetObj *zobj, RedisModuleString *ele, int reverse, int byscore, scoretype **return_score) {
+/* Return the 0-based rank of 'ele' in the sorted set, or -1 if it does not
+ * exist. With 'byscore' the element is parsed as a score and the number of
+ * elements with a lower score is returned instead. When 'return_score' is
+ * not NULL the score of the element is copied into it. */
+long exZsetRank(TairZsetObj *zobj, RedisModuleString *ele, int reverse, int byscore, scoretype *return_score) {
     unsigned long llen;
     unsigned long rank;
 
     llen = exZsetLength(zobj);
-    m_zskiplist *zsl = zobj->zsl;
 
     if (byscore) {
         size_t slen;
         int score_num;
         scoretype *score;
         const char *s = RedisModule_StringPtrLen(ele, &slen);
-        if ((score_num = mscoreParse(s, slen, &score) <= 0)) {
+        if ((score_num = mscoreParseBound(s, slen, zobj->types, zobj->score_num, &score)) <= 0) {
+            return -1;
+        }
+        if (score_num != zobj->score_num) {
+            RedisModule_Free(score);
             return -1;
         }
-        rank = m_zslGetRankByScore(zsl, score);
+
+        if (zobj->encoding == TAIRZSET_ENCODING_LISTPACK) {
+            unsigned char *zl = zobj->zl;
+            unsigned char *eptr = m_lpSeek(zl, 0), *sptr;
+
+            rank = 0;
+            sptr = eptr ? m_lpNext(zl, eptr) : NULL;
+            while (eptr != NULL && m_zzlScoreCmp(sptr, score, zobj->types) < 0) {
+                rank++;
+                m_zzlNext(zl, &eptr, &sptr);
+            }
+        } else {
+            rank = m_zslGetRankByScore(zobj->zsl, score);
+        }
         RedisModule_Free(score);
         if (reverse)
             return llen - rank;
         else
             return rank;
     } else {
-        m_dictEntry *de;
-        de = m_dictFind(zobj->dict, ele);
-        if (de != NULL) {
-            scoretype *score = (scoretype *)dictGetVal(de);
-            rank = m_zslGetRank(zsl, score, ele);
+        if (zobj->encoding == TAIRZSET_ENCODING_LISTPACK) {
+            unsigned char *zl = zobj->zl;
+            unsigned char *eptr, *sptr;
+            size_t elelen;
+            const char *elebuf = RedisModule_StringPtrLen(ele, &elelen);
+
+            eptr = m_lpSeek(zl, 0);
+            assert(eptr != NULL);
+            sptr = m_lpNext(zl, eptr);
+            assert(sptr != NULL);
+
+            rank = 1;
+            while (eptr != NULL) {
+                if (m_zzlCompareElements(eptr, elebuf, elelen) == 0) break;
+                rank++;
+                m_zzlNext(zl, &eptr, &sptr);
+            }
+
+            if (eptr == NULL) {
+                return -1;
+            }
             if (return_score != NULL) {
-                *return_score = score;
+                m_zzlGetScore(sptr, return_score);
             }
         } else {
-            return -1;
+            m_zskiplistNode *node;
+            size_t elelen;
+            const char *elebuf = RedisModule_StringPtrLen(ele, &elelen);
+            node = m_zindexFind(zobj->index, elebuf, elelen);
+            if (node != NULL) {
+                rank = m_zslGetRank(zobj->zsl, node->score, node->ele);
+                if (return_score != NULL) {
+                    mscoreAssign(return_score, node->score);
+                }
+            } else {
+                return -1;
+            }
         }
         if (reverse)
             return llen - rank;
@@ -810,10 +1692,9 @@ void exZrankGenericCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int ar
     }
 
     if (withscore) {
-        rank = exZsetRank(tair_zset_obj, argv[2], reverse, byscore, &score);
-    } else {
-        rank = exZsetRank(tair_zset_obj, argv[2], reverse, byscore, NULL);
+        score = mnewScore(tair_zset_obj->score_num);
     }
+    rank = exZsetRank(tair_zset_obj, argv[2], reverse, byscore, score);
 
     if (rank >= 0) {
         if (withscore) {
@@ -821,13 +1702,12 @@ void exZrankGenericCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int ar
         }
         RedisModule_ReplyWithLongLong(ctx, rank);
         if (withscore) {
-            sds score_str = mscore2String(score);
-            RedisModule_ReplyWithStringBuffer(ctx, score_str, sdslen(score_str));
-            m_sdsfree(score_str);
+            exZsetReplyWithScore(ctx, tair_zset_obj, score);
         }
     } else {
         RedisModule_ReplyWithNull(ctx);
     }
+    if (score) RedisModule_Free(score);
 }
 
 /* Implements ZREMRANGEBYRANK, ZREMRANGEBYSCORE, ZREMRANGEBYLEX commands. */
@@ -852,8 +1732,11 @@ void exZremrangeGenericCommand(RedisModuleCtx *ctx, RedisModuleString **argv, in
             RedisModule_ReplyWithError(ctx, "ERR value is out of range");
             goto cleanup;
         }
-    } else if (rangetype == ZRANGE_SCORE) {
-        if (m_zslParseRange(argv[2], argv[3], &range) != C_OK) {
+    }
+
+    RedisModuleKey *key = RedisModule_OpenKey(ctx, argv[1], REDISMODULE_READ | REDISMODULE_WRITE);
+    if (rangetype == ZRANGE_SCORE) {
+        if (exZsetParseRange(key, argv[2], argv[3], &range) != C_OK) {
             RedisModule_ReplyWithError(ctx, "ERR min or max is not a float");
             goto cleanup;
         }
@@ -864,7 +1747,6 @@ void exZremrangeGenericCommand(RedisModuleCtx *ctx, RedisModuleString **argv, in
         }
     }
 
-    RedisModuleKey *key = RedisModule_OpenKey(ctx, argv[1], REDISMODULE_READ | REDISMODULE_WRITE);
     int type = RedisModule_KeyType(key);
     if (REDISMODULE_KEYTYPE_EMPTY != type && RedisModule_ModuleTypeGetType(key) != TairZsetType) {
         RedisModule_ReplyWithError(ctx, REDISMODULE_ERRORMSG_WRONGTYPE);
@@ -879,7 +1761,7 @@ void exZremrangeGenericCommand(RedisModuleCtx *ctx, RedisModuleString **argv, in
     }
 
     if (rangetype == ZRANGE_SCORE) {
-        if (range.max->score_num != zobj->zsl->score_num || range.min->score_num != zobj->zsl->score_num) {
+        if (range.max->score_num != zobj->score_num || range.min->score_num != zobj->score_num) {
             RedisModule_ReplyWithError(ctx, "score is not a valid format");
             goto cleanup;
         }
@@ -895,25 +1777,40 @@ void exZremrangeGenericCommand(RedisModuleCtx *ctx, RedisModuleString **argv, in
             RedisModule_ReplyWithLongLong(ctx, 0);
             goto cleanup;
         }
-        if (end >= llen) end = llen - 1;
-    }
+        if (end >= llen) end = llen - 1;
+    }
+
+    if (zobj->encoding == TAIRZSET_ENCODING_LISTPACK) {
+        switch (rangetype) {
+            case ZRANGE_RANK:
+                zobj->zl = m_zzlDeleteRangeByRank(zobj->zl, start + 1, end + 1, &deleted);
+                break;
+            case ZRANGE_SCORE:
+                zobj->zl = m_zzlDeleteRangeByScore(zobj->zl, &range, &deleted);
+                break;
+            case ZRANGE_LEX:
+                zobj->zl = m_zzlDeleteRangeByLex(zobj->zl, &lexrange, &deleted);
+                break;
+        }
+    } else {
+        switch (rangetype) {
+            case ZRANGE_RANK:
+                deleted = m_zslDeleteRangeByRank(zobj->zsl, start + 1, end + 1, zobj->index);
+                break;
+            case ZRANGE_SCORE:
+                deleted = m_zslDeleteRangeByScore(zobj->zsl, &range, zobj->index);
+                break;
+            case ZRANGE_LEX:
+                deleted = m_zslDeleteRangeByLex(zobj->zsl, &lexrange, zobj->index);
+                break;
+        }
 
-    switch (rangetype) {
-        case ZRANGE_RANK:
-            deleted = m_zslDeleteRangeByRank(zobj->zsl, start + 1, end + 1, zobj->dict);
-            break;
-        case ZRANGE_SCORE:
-            deleted = m_zslDeleteRangeByScore(zobj->zsl, &range, zobj->dict);
-            break;
-        case ZRANGE_LEX:
-            deleted = m_zslDeleteRangeByLex(zobj->zsl, &lexrange, zobj->dict);
-            break;
+        if (m_zindexNeedsResize(zobj->index)) {
+            m_zindexResize(zobj->index);
+        }
     }
 
-    if (m_htNeedsResize(zobj->dict)) {
-        m_dictResize(zobj->dict);
-    }
-    if (dictSize(zobj->dict) == 0) {
+    if (exZsetLength(zobj) == 0) {
         RedisModule_DeleteKey(key);
     }
 
@@ -931,12 +1828,64 @@ cleanup:
  * 'ele' will be set to hold the element.
  * The memory in `ele` is not to be freed or modified by the caller.
  * 'score' can be NULL in which case it's not extracted. */
-void exZsetRandomElement(TairZsetObj *zobj, RedisModuleString **ele, scoretype **score) {
-    m_dictEntry *de =  m_dictGetFairRandomKey(zobj->dict);
-    *ele = (RedisModuleString*)dictGetKey(de);
+void exZsetRandomElement(TairZsetObj *zobj, sds *ele, scoretype **score) {
+    m_zskiplistNode *node = m_zindexGetFairRandomNode(zobj->index);
+    *ele = node->ele;
     if (score) {
-        *score = (scoretype*)dictGetVal(de);
+        *score = node->score;
+    }
+}
+
+/* EXZRANDMEMBER with count for a listpack encoded sorted set. The listpack is
+ * small, so instead of the dict based strategies used for the skiplist we
+ * collect the entry pointers once (non unique case) or do a single selection
+ * sampling pass (unique case, which keeps the elements in order). */
+static void exZzlRandMemberWithCount(RedisModuleCtx *ctx, TairZsetObj *zobj, unsigned long count, int uniq, int withscores) {
+    unsigned char *zl = zobj->zl;
+    unsigned char *eptr, *sptr;
+    unsigned long size = m_zzlLength(zl), i;
+    scoretype *score = withscores ? mnewScore(zobj->score_num) : NULL;
+
+    if (!uniq || count == 1) {
+        unsigned char **entries = RedisModule_Alloc(sizeof(unsigned char *) * size);
+
+        eptr = m_lpSeek(zl, 0);
+        sptr = m_lpNext(zl, eptr);
+        for (i = 0; i < size; i++) {
+            entries[i] = eptr;
+            m_zzlNext(zl, &eptr, &sptr);
+        }
+
+        RedisModule_ReplyWithArray(ctx, withscores ? count * 2 : count);
+        while (count--) {
+            eptr = entries[random() % size];
+            exZzlReplyWithMember(ctx, eptr);
+            if (withscores) {
+                exZzlReplyWithScore(ctx, zobj, m_lpNext(zl, eptr), score);
+            }
+        }
+        RedisModule_Free(entries);
+    } else {
+        unsigned long reply_size = count < size ? count : size;
+        unsigned long remaining = reply_size;
+
+        RedisModule_ReplyWithArray(ctx, withscores ? reply_size * 2 : reply_size);
+        eptr = m_lpSeek(zl, 0);
+        sptr = m_lpNext(zl, eptr);
+        for (i = 0; remaining && i < size; i++) {
+            /* Select the current element with probability remaining/(size-i). */
+            if ((unsigned long)random() % (size - i) < remaining) {
+                exZzlReplyWithMember(ctx, eptr);
+                if (withscores) {
+                    exZzlReplyWithScore(ctx, zobj, sptr, score);
+                }
+                remaining--;
+            }
+            m_zzlNext(zl, &eptr, &sptr);
+        }
     }
+
+    if (score) RedisModule_Free(score);
 }
 
 /* How many times bigger should be the zset compared to the requested size
@@ -969,6 +1918,11 @@ void exZrandMemberWithCountCommand(RedisModuleCtx *ctx, TairZsetObj *zobj, long
         return;
     }
 
+    if (zobj->encoding == TAIRZSET_ENCODING_LISTPACK) {
+        exZzlRandMemberWithCount(ctx, zobj, count, uniq, withscores);
+        return;
+    }
+
     /* CASE 1: The count was negative, so the extraction method is just:
      * "return N random elements" sampling the whole set every time.
      * This case is trivial and can be served without auxiliary data
@@ -981,13 +1935,10 @@ void exZrandMemberWithCountCommand(RedisModuleCtx *ctx, TairZsetObj *zobj, long
             RedisModule_ReplyWithArray(ctx, count);
 
         while (count--) {
-            m_dictEntry *de = m_dictGetFairRandomKey(zobj->dict);
-            RedisModuleString *key = dictGetKey(de);
-            RedisModule_ReplyWithString(ctx, key);
+            m_zskiplistNode *node = m_zindexGetFairRandomNode(zobj->index);
+            RedisModule_ReplyWithStringBuffer(ctx, node->ele, sdslen(node->ele));
             if (withscores) {
-                sds score_str = mscore2String(dictGetVal(de));
-                RedisModule_ReplyWithStringBuffer(ctx, score_str, sdslen(score_str));
-                m_sdsfree(score_str);
+                exZsetReplyWithScore(ctx, zobj, node->score);
             }
         }
         return;
@@ -995,7 +1946,7 @@ void exZrandMemberWithCountCommand(RedisModuleCtx *ctx, TairZsetObj *zobj, long
 
     m_zskiplist *zsl = zobj->zsl;
     m_zskiplistNode *ln;
-    RedisModuleString *ele;
+    sds ele;
 
     /* Initiate reply count. */
     long reply_size = count < size ? count : size;
@@ -1011,11 +1962,9 @@ void exZrandMemberWithCountCommand(RedisModuleCtx *ctx, TairZsetObj *zobj, long
         ln = zsl->header->level[0].forward;
         while (reply_size--) {
             ele = ln->ele;
-            RedisModule_ReplyWithString(ctx, ele);
+            RedisModule_ReplyWithStringBuffer(ctx, ele, sdslen(ele));
             if (withscores) {
-                sds score_str = mscore2String(ln->score);
-                RedisModule_ReplyWithStringBuffer(ctx, score_str, sdslen(score_str));
-                m_sdsfree(score_str);
+                exZsetReplyWithScore(ctx, zobj, ln->score);
             }
             ln = ln->level[0].forward;
         }
@@ -1060,11 +2009,10 @@ void exZrandMemberWithCountCommand(RedisModuleCtx *ctx, TairZsetObj *zobj, long
         m_dictEntry *de;
         di = m_dictGetIterator(d);
         while ((de = m_dictNext(di)) != NULL) {
-            RedisModule_ReplyWithString(ctx, dictGetKey(de));
+            sds key = dictGetKey(de);
+            RedisModule_ReplyWithStringBuffer(ctx, key, sdslen(key));
             if (withscores) {
-                sds score_str = mscore2String(dictGetVal(de));
-                RedisModule_ReplyWithStringBuffer(ctx, score_str, sdslen(score_str));
-                m_sdsfree(score_str);
+                exZsetReplyWithScore(ctx, zobj, dictGetVal(de));
             }
         }
 
@@ -1083,7 +2031,7 @@ void exZrandMemberWithCountCommand(RedisModuleCtx *ctx, TairZsetObj *zobj, long
         m_dictExpand(d, count);
 
         while (added < count) {
-            RedisModuleString *key;
+            sds key;
             scoretype *score;
             exZsetRandomElement(zobj, &key, &score);
 
@@ -1095,11 +2043,9 @@ void exZrandMemberWithCountCommand(RedisModuleCtx *ctx, TairZsetObj *zobj, long
             }
             added++;
 
-            RedisModule_ReplyWithString(ctx, key);
+            RedisModule_ReplyWithStringBuffer(ctx, key, sdslen(key));
             if (withscores) { 
-                sds score_str = mscore2String(score);
-                RedisModule_ReplyWithStringBuffer(ctx, score_str, sdslen(score_str));
-                m_sdsfree(score_str);
+                exZsetReplyWithScore(ctx, zobj, score);
             }
         }
         /* Release memory */
@@ -1108,15 +2054,13 @@ void exZrandMemberWithCountCommand(RedisModuleCtx *ctx, TairZsetObj *zobj, long
 }
 
 /* This callback is used by exZscanGernericCommand in order to collect elements
- * returned by the dictionary iterator into a list. */
-void dictScanCallback(void *privdata, const m_dictEntry *de) {
+ * returned by the member index iterator into a list. */
+void zindexScanCallback(void *privdata, m_zskiplistNode *node) {
     void **pd = (void**) privdata;
     list *keys = pd[0];
-    RedisModuleString *key = dictGetKey(de);
-    scoretype *val = dictGetVal(de);
 
-    m_listAddNodeTail(keys, key);
-    if (val) m_listAddNodeTail(keys, val);
+    m_listAddNodeTail(keys, node->ele);
+    m_listAddNodeTail(keys, node->score);
 }
 
 /* This command implements EXZSCAN commands.
@@ -1131,7 +2075,7 @@ void exZscanGernericCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int a
     const char *pat = NULL;
     size_t patlen;
     int use_pattern = 0;
-    dict *ht;
+    m_zindex *zi;
 
     while (i < argc) {
         j = argc - i;
@@ -1161,8 +2105,34 @@ void exZscanGernericCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int a
         }
     }
 
-    /* Step 2: Iterate the collection. */
-    ht = zobj->dict;
+    /* Step 2: Iterate the collection. A listpack encoded sorted set is small
+     * enough to be returned in a single call, with a zero cursor. */
+    if (zobj->encoding == TAIRZSET_ENCODING_LISTPACK) {
+        unsigned char *zl = zobj->zl;
+        unsigned char *eptr = m_lpSeek(zl, 0), *sptr;
+        scoretype *score = mnewScore(zobj->score_num);
+        long replylen = 0;
+        uint32_t vlen;
+
+        sptr = eptr ? m_lpNext(zl, eptr) : NULL;
+        RedisModule_ReplyWithArray(ctx, 2);
+        RedisModule_ReplyWithCString(ctx, "0");
+        RedisModule_ReplyWithArray(ctx, REDISMODULE_POSTPONED_ARRAY_LEN);
+        while (eptr != NULL) {
+            unsigned char *vstr = m_lpGet(eptr, &vlen);
+            if (!use_pattern || m_stringmatchlen(pat, patlen, (const char *)vstr, vlen, 0)) {
+                RedisModule_ReplyWithStringBuffer(ctx, (const char *)vstr, vlen);
+                exZzlReplyWithScore(ctx, zobj, sptr, score);
+                replylen += 2;
+            }
+            m_zzlNext(zl, &eptr, &sptr);
+        }
+        RedisModule_ReplySetArrayLength(ctx, replylen);
+        RedisModule_Free(score);
+        goto cleanup;
+    }
+
+    zi = zobj->index;
     count *= 2;
 
     void *privdata[1];
@@ -1177,7 +2147,7 @@ void exZscanGernericCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int a
      * it is possible to fetch more data in a type-dependent way. */
     privdata[0] = keys;
     do {
-        cursor = m_dictScan(ht, cursor, dictScanCallback, NULL, privdata);
+        cursor = m_zindexScan(zi, cursor, zindexScanCallback, privdata);
     } while (cursor &&
             maxiterations-- &&
             listLength(keys) < (unsigned long)count);
@@ -1185,16 +2155,14 @@ void exZscanGernericCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int a
     /* Step 3: Filter elements. */
     node = listFirst(keys);
     while (node) {
-        RedisModuleString *member = listNodeValue(node);
+        sds member = listNodeValue(node);
         nextnode = listNextNode(node);
         int filter = 0;
-        size_t member_str_len;
-        const char * member_str = RedisModule_StringPtrLen(member, &member_str_len);
         
         /* Filter element if it does not match the pattern. */
         if (!filter && 
             use_pattern && 
-            !m_stringmatchlen(pat, patlen, member_str, member_str_len, 0)) {
+            !m_stringmatchlen(pat, patlen, member, sdslen(member), 0)) {
             filter = 1; 
         }
 
@@ -1221,16 +2189,14 @@ void exZscanGernericCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int a
     RedisModule_ReplyWithArray(ctx, listLength(keys));
     while ((node = listFirst(keys)) != NULL) {
         /* member */
-        RedisModuleString *member = listNodeValue(node);
-        RedisModule_ReplyWithString(ctx, member);
+        sds member = listNodeValue(node);
+        RedisModule_ReplyWithStringBuffer(ctx, member, sdslen(member));
         m_listDelNode(keys, node);
 
         /* score */
         node = listFirst(keys);
         scoretype *score = listNodeValue(node);
-        sds score_str = mscore2String(score);
-        RedisModule_ReplyWithStringBuffer(ctx, score_str, sdslen(score_str));
-        m_sdsfree(score_str);
+        exZsetReplyWithScore(ctx, zobj, score);
         m_listDelNode(keys, node);
     }
 
@@ -1289,7 +2255,6 @@ static void exZdiffAlgorithm1(zsetopsrc *src, long setnum, TairZsetObj *dstzset)
     int j;
     zsetopval zval;
     m_zskiplistNode *znode;
-    RedisModuleString *tmp;
 
     /* With algorithm 1 it is better to order the sets to subtract
      * by decreasing size, so that we are more likely to find
@@ -1297,9 +2262,8 @@ static void exZdiffAlgorithm1(zsetopsrc *src, long setnum, TairZsetObj *dstzset)
     qsort(src + 1, setnum - 1, sizeof(zsetopsrc), exZuidCompareByCardinality);
     memset(&zval, 0, sizeof(zval));
     exZuidInitIterator(&src[0]);
+    scoretype *score = mnewScore(dstzset->score_num); /* Scratch for exZuidFind() */
     while (exZuidNext(&src[0], &zval)) {
-        scoretype *score = mnewScore(zval.score->score_num);
-        mscoreAssign(score, zval.score);
         int exists = 0;
 
         for (j = 1; j < setnum; j++) {
@@ -1316,13 +2280,12 @@ static void exZdiffAlgorithm1(zsetopsrc *src, long setnum, TairZsetObj *dstzset)
         }
 
         if (!exists) {
-            tmp = RedisModule_CreateStringFromString(NULL, zval.ele);
-            znode = m_zslInsert(dstzset->zsl, score, tmp);
-            m_dictAdd(dstzset->dict, tmp, znode->score);
-        } else {
-            RedisModule_Free(score);
+            znode = m_zslInsert(dstzset->zsl, zval.score, zval.ele, sdslen(zval.ele));
+            m_zindexAdd(dstzset->index, znode);
         }
     }
+    exZuidClearIterator(&src[0]);
+    RedisModule_Free(score);
 }
 
 
@@ -1346,8 +2309,6 @@ static void exZdiffAlgorithm2(zsetopsrc *src, long setnum, TairZsetObj *dstzset)
     int cardinality = 0;
     zsetopval zval;
     m_zskiplistNode *znode;
-    RedisModuleString *tmp;
-    scoretype *score;
     for (j = 0; j < setnum; j++) {
         if (exZuidLength(&src[j]) == 0) continue;
 
@@ -1355,14 +2316,11 @@ static void exZdiffAlgorithm2(zsetopsrc *src, long setnum, TairZsetObj *dstzset)
         exZuidInitIterator(&src[j]);
         while (exZuidNext(&src[j], &zval)) {
             if (j == 0) {
-                score = mnewScore(zval.score->score_num);
-                mscoreAssign(score, zval.score);
-                tmp = RedisModule_CreateStringFromString(NULL, zval.ele);
-                znode = m_zslInsert(dstzset->zsl, score, tmp);
-                m_dictAdd(dstzset->dict, tmp, znode->score);
+                znode = m_zslInsert(dstzset->zsl, zval.score, zval.ele, sdslen(zval.ele));
+                m_zindexAdd(dstzset->index, znode);
                 cardinality++;
             } else {
-                if (exZsetRemoveFromSkiplist(dstzset, zval.ele)) {
+                if (exZsetRemoveFromSkiplist(dstzset, zval.ele, sdslen(zval.ele))) {
                     cardinality--;
                 }
             }
@@ -1371,12 +2329,13 @@ static void exZdiffAlgorithm2(zsetopsrc *src, long setnum, TairZsetObj *dstzset)
              * of elements will have no effect. */
             if (cardinality == 0) break;
         }
+        exZuidClearIterator(&src[j]);
 
         if (cardinality == 0) break;
     }
 
-    /* Redize dict if needed after removing multiple elements */
-    if (m_htNeedsResize(dstzset->dict)) m_dictResize(dstzset->dict);
+    /* Resize the index if needed after removing multiple elements */
+    if (m_zindexNeedsResize(dstzset->index)) m_zindexResize(dstzset->index);
 }
 
 static void exZdiff(zsetopsrc *src, long setnum, TairZsetObj *dstzset) {
@@ -1409,9 +2368,11 @@ void exZunionInterDiffGenericCommand(RedisModuleCtx *ctx, RedisModuleString **ar
     int scorenum = -1;
     zsetopsrc *src;
     zsetopval zval;
-    RedisModuleString *tmp;
+    sds tmp;
     scoretype *score;
     TairZsetObj *dstzobj;
+    const m_zscoreOps *ops;
+    const unsigned char *types;
     m_zskiplistNode *znode;
     int withscores = 0;
     unsigned long cardinality = 0;
@@ -1447,8 +2408,8 @@ void exZunionInterDiffGenericCommand(RedisModuleCtx *ctx, RedisModuleString **ar
         if (type != REDISMODULE_KEYTYPE_EMPTY) {
             tair_zset_obj = RedisModule_ModuleTypeGetValue(key);
             if (scorenum == -1) {
-                scorenum = tair_zset_obj->zsl->score_num;
-            } else if (tair_zset_obj->zsl->score_num != scorenum) {
+                scorenum = tair_zset_obj->score_num;
+            } else if (tair_zset_obj->score_num != scorenum) {
                 RedisModule_Free(src);
                 RedisModule_ReplyWithError(ctx, "ERR score is not a valid format");
                 return;
@@ -1457,6 +2418,7 @@ void exZunionInterDiffGenericCommand(RedisModuleCtx *ctx, RedisModuleString **ar
         src[i].subject = tair_zset_obj;
         /* Default all weights to 1. */
         src[i].weight = 1.0;
+        src[i].types = NULL;
     }
 
     /* parse optional extra arguments */
@@ -1526,7 +2488,9 @@ void exZunionInterDiffGenericCommand(RedisModuleCtx *ctx, RedisModuleString **ar
         qsort(src, setnum, sizeof(zsetopsrc), exZuidCompareByCardinality);
     }
 
-    dstzobj = createTairZsetTypeObject(scorenum);
+    dstzobj = createTairZsetTypeObject(scorenum, exZunionInterSchema(src, setnum, scorenum, op));
+    ops = dstzobj->zsl->ops;
+    types = dstzobj->types;
     memset(&zval, 0, sizeof(zsetopval));
 
     if (op == SET_OP_UNION) {
@@ -1547,26 +2511,26 @@ void exZunionInterDiffGenericCommand(RedisModuleCtx *ctx, RedisModuleString **ar
             while (exZuidNext(&src[i], &zval)) {
                 /* Initialize value */
                 score = mnewScore(scorenum);
-                mscoreMulWithWeight(score, zval.score, src[i].weight);
+                ops->mulWithWeight(score, zval.score, src[i].weight, types);
 
                 /* Search for this element in the accumulating dictionary. */
                 de = m_dictAddRaw(accumulator, zval.ele, &existing);
                 /* If we don't have it, we need to create a new entry. */
                 if (!existing) {
-                    /* the first arg cannot be ctx, 
-                     * or the memory will be managed by Redis, we can't let this happen. 
-                     * If needed, it will be release by TairZsetTypeReleaseObject() later */
-                    tmp = RedisModule_CreateStringFromString(NULL, zval.ele);
+                    /* 'zval.ele' may be a scratch string of the iterator, so the
+                     * accumulator owns a copy, released in step 2. */
+                    tmp = m_sdsdup(zval.ele);
                     /* Update the element with its initial score. */
                     dictSetKey(accumulator, de, tmp);
                     dictSetVal(accumulator, de, score);
                 } else {
                     /* Update the score with the score of the new instance
                      * of the element found in the current sorted set. */
-                    exZunionInterAggregate(existing->v.val, score, aggregate);
+                    exZunionInterAggregate(ops, types, existing->v.val, score, aggregate);
                     RedisModule_Free(score);
                 }
             }
+            exZuidClearIterator(&src[i]);
         }
 
         /* Step 2: convert the dictionary into the final sorted set. */
@@ -1575,14 +2539,16 @@ void exZunionInterDiffGenericCommand(RedisModuleCtx *ctx, RedisModuleString **ar
         /* We now are aware of the final size of the resulting sorted set,
          * let's resize the dictionary embedded inside the sorted set to the
          * right size, in order to save rehashing time. */
-        m_dictExpand(dstzobj->dict, dictSize(accumulator));
+        m_zindexExpand(dstzobj->index, dictSize(accumulator));
 
         /* We don't use exZsetAdd() because we don't need to call m_dictFind() */
         while((de = m_dictNext(di)) != NULL) {
-            RedisModuleString *ele = dictGetKey(de);
+            sds ele = dictGetKey(de);
             scoretype *score = dictGetVal(de);
-            znode = m_zslInsert(dstzobj->zsl, score, ele);
-            m_dictAdd(dstzobj->dict, ele, znode->score);
+            znode = m_zslInsert(dstzobj->zsl, score, ele, sdslen(ele));
+            m_zindexAdd(dstzobj->index, znode);
+            m_sdsfree(ele);
+            RedisModule_Free(score);
         }
         m_dictReleaseIterator(di);
         m_dictRelease(accumulator);
@@ -1596,16 +2562,16 @@ void exZunionInterDiffGenericCommand(RedisModuleCtx *ctx, RedisModuleString **ar
             while (exZuidNext(&src[0], &zval)) {
                 /* Initialize value */
                 score = mnewScore(scorenum);    /* Store in the zset */   
-                mscoreMulWithWeight(score, zval.score, src[0].weight);
+                ops->mulWithWeight(score, zval.score, src[0].weight, types);
                 for (j = 1; j < setnum; j++) {
                     /* It is not safe to access the tair zset we are
                      * iterating, so explicitly check for equal object. */
                     if (src[j].subject == src[0].subject) {
-                        mscoreMulWithWeight(value, zval.score, src[j].weight);
-                        exZunionInterAggregate(score, value, aggregate);
+                        ops->mulWithWeight(value, zval.score, src[j].weight, types);
+                        exZunionInterAggregate(ops, types, score, value, aggregate);
                     } else if (exZuidFind(&src[j], &zval, value)) {
-                        mscoreMulWithWeight(value, value, src[j].weight);
-                        exZunionInterAggregate(score, value, aggregate);
+                        ops->mulWithWeight(value, value, src[j].weight, types);
+                        exZunionInterAggregate(ops, types, score, value, aggregate);
                     } else {
                         break;
                     }
@@ -1618,13 +2584,12 @@ void exZunionInterDiffGenericCommand(RedisModuleCtx *ctx, RedisModuleString **ar
                         break;
                     }
                 } else if (j == setnum) {
-                    tmp = RedisModule_CreateStringFromString(NULL, zval.ele);
-                    znode = m_zslInsert(dstzobj->zsl, score, tmp);
-                    m_dictAdd(dstzobj->dict, tmp, znode->score);
-                } else {
-                    RedisModule_Free(score);
+                    znode = m_zslInsert(dstzobj->zsl, score, zval.ele, sdslen(zval.ele));
+                    m_zindexAdd(dstzobj->index, znode);
                 }
+                RedisModule_Free(score);
             }
+            exZuidClearIterator(&src[0]);
             RedisModule_Free(value);
         }
     } else if (op == SET_OP_DIFF) {
@@ -1635,14 +2600,17 @@ void exZunionInterDiffGenericCommand(RedisModuleCtx *ctx, RedisModuleString **ar
         unsigned long length = dstzobj->zsl->length;
         /* overwrite if dstkey already exists */
         if (length) {
+            exZsetConvertToListpackIfNeeded(dstzobj);
             RedisModule_ModuleTypeSetValue(dstKey, TairZsetType, dstzobj);
         } else {
             RedisModule_DeleteKey(dstKey);
+            TairZsetTypeReleaseObject(dstzobj);
         }
         RedisModule_ReplyWithLongLong(ctx, length);
         RedisModule_ReplicateVerbatim(ctx);
     } else if (cardinality_only) {
         RedisModule_ReplyWithLongLong(ctx, cardinality);
+        TairZsetTypeReleaseObject(dstzobj);
     } else {
         unsigned long length = dstzobj->zsl->length;
         m_zskiplist *zsl = dstzobj->zsl;
@@ -1654,11 +2622,9 @@ void exZunionInterDiffGenericCommand(RedisModuleCtx *ctx, RedisModuleString **ar
             RedisModule_ReplyWithArray(ctx, length);
 
         while (zn != NULL) {
-            RedisModule_ReplyWithString(ctx, zn->ele);
+            RedisModule_ReplyWithStringBuffer(ctx, zn->ele, sdslen(zn->ele));
             if (withscores) {
-                sds score_str = mscore2String(zn->score);
-                RedisModule_ReplyWithStringBuffer(ctx, score_str, sdslen(score_str));
-                m_sdsfree(score_str);
+                exZsetReplyWithScore(ctx, dstzobj, zn->score);
             } 
             zn = zn->level[0].forward;
         }
@@ -1679,7 +2645,7 @@ void exZunionInterDiffGenericCommand(RedisModuleCtx *ctx, RedisModuleString **ar
  * */
 void exGenericZpopCommand(RedisModuleCtx *ctx, RedisModuleKey *key, int where, RedisModuleString *emitkey, long count) {
     TairZsetObj *tair_zset_obj = NULL;
-    RedisModuleString *ele;
+    sds ele;
     scoretype *score;
 
     tair_zset_obj = RedisModule_ModuleTypeGetValue(key);
@@ -1706,7 +2672,31 @@ void exGenericZpopCommand(RedisModuleCtx *ctx, RedisModuleKey *key, int where, R
         RedisModule_ReplyWithString(ctx, emitkey);
     }
     /* Remove the element. */
-    do {
+    if (tair_zset_obj->encoding == TAIRZSET_ENCODING_LISTPACK) {
+        unsigned char *zl = tair_zset_obj->zl;
+        unsigned char *eptr, *sptr;
+        score = mnewScore(tair_zset_obj->score_num);
+
+        /* Reply with the elements first, then drop them all at once. */
+        eptr = m_lpSeek(zl, where == POP_MAX ? -2 : 0);
+        sptr = m_lpNext(zl, eptr);
+        for (long i = 0; i < rangelen; i++) {
+            exZzlReplyWithMember(ctx, eptr);
+            exZzlReplyWithScore(ctx, tair_zset_obj, sptr, score);
+            if (where == POP_MAX)
+                m_zzlPrev(zl, &eptr, &sptr);
+            else
+                m_zzlNext(zl, &eptr, &sptr);
+        }
+        RedisModule_Free(score);
+
+        if (where == POP_MAX)
+            tair_zset_obj->zl = m_lpDeleteRange(zl, -2 * rangelen, 2 * rangelen);
+        else
+            tair_zset_obj->zl = m_lpDeleteRange(zl, 0, 2 * rangelen);
+        rangelen = 0;
+    }
+    while (rangelen) {
         m_zskiplist *zsl = tair_zset_obj->zsl;
         m_zskiplistNode *zln;       
         /* Get the first or last element in the sorted set. */
@@ -1715,12 +2705,11 @@ void exGenericZpopCommand(RedisModuleCtx *ctx, RedisModuleKey *key, int where, R
         ele = zln->ele;
         score = zln->score;
 
-        RedisModule_ReplyWithString(ctx, ele);
-        sds score_str = mscore2String(score);
-        RedisModule_ReplyWithStringBuffer(ctx, score_str, sdslen(score_str));
-        m_sdsfree(score_str);
-        exZsetDel(tair_zset_obj, ele);
-    } while (--rangelen);
+        RedisModule_ReplyWithStringBuffer(ctx, ele, sdslen(ele));
+        exZsetReplyWithScore(ctx, tair_zset_obj, score);
+        exZsetDeleteNode(tair_zset_obj, zln);
+        rangelen--;
+    }
     /* Remove the key, if indeed needed. */
     if (exZsetLength(tair_zset_obj) == 0) {
         RedisModule_DeleteKey(key);
@@ -1866,7 +2855,7 @@ int exBzpopMinMaxGenericCommand(RedisModuleCtx *ctx, RedisModuleString **argv, i
 
 /* ========================= "tairzset" type commands =======================*/
 
-/* EXZADD key [NX|XX] [CH] [INCR] score member [score member ...] */
+/* EXZADD key [NX|XX] [CH] [INCR] [BINARY] [WITHRANK|WITHREVRANK] [SCHEMA schema] score member [score member ...] */
 int TairZsetTypeZadd_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
     RedisModule_AutoMemory(ctx);
 
@@ -1878,14 +2867,27 @@ int TairZsetTypeZadd_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv,
     return REDISMODULE_OK;
 }
 
-/* EXZINCRBY key increment member */
+/* EXZINCRBY key increment member [WITHRANK|WITHREVRANK] */
 int TairZsetTypeZincrby_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
     RedisModule_AutoMemory(ctx);
-    if (argc != 4) {
+    int flags = ZADD_INCR;
+
+    if (argc != 4 && argc != 5) {
         return RedisModule_WrongArity(ctx);
     }
 
-    exZaddGenericCommand(ctx, argv, argc, ZADD_INCR);
+    if (argc == 5) {
+        if (!mstringcasecmp(argv[4], "withrank")) {
+            flags |= ZADD_WITHRANK;
+        } else if (!mstringcasecmp(argv[4], "withrevrank")) {
+            flags |= ZADD_WITHREVRANK;
+        } else {
+            RedisModule_ReplyWithError(ctx, "ERR syntax error");
+            return REDISMODULE_OK;
+        }
+    }
+
+    exZaddGenericCommand(ctx, argv, 4, flags);
     return REDISMODULE_OK;
 }
 
@@ -1913,17 +2915,17 @@ int TairZsetTypeZscore_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **arg
         tair_zset_obj = RedisModule_ModuleTypeGetValue(key);
     }
 
-    if (exZsetScore(tair_zset_obj, argv[2], &score) == C_ERR) {
+    score = mnewScore(tair_zset_obj->score_num);
+    if (exZsetScore(tair_zset_obj, argv[2], score) == C_ERR) {
         RedisModule_ReplyWithNull(ctx);
     } else {
-        sds score_str = mscore2String(score);
-        RedisModule_ReplyWithStringBuffer(ctx, score_str, sdslen(score_str));
-        m_sdsfree(score_str);
+        exZsetReplyWithScore(ctx, tair_zset_obj, score);
     }
+    RedisModule_Free(score);
     return REDISMODULE_OK;
 }
 
-/* EXZRANGE <key> <min> <max> [WITHSCORES] [LIMIT offset count] */
+/* EXZRANGE <key> <min> <max> [WITHSCORES] [AFTER score member] */
 int TairZsetTypeZrange_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
     RedisModule_AutoMemory(ctx);
     if (argc < 4) {
@@ -1934,7 +2936,7 @@ int TairZsetTypeZrange_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **arg
     return REDISMODULE_OK;
 }
 
-/* EXZREVRANGE <key> <min> <max> [WITHSCORES] */
+/* EXZREVRANGE <key> <min> <max> [WITHSCORES] [AFTER score member] */
 int TairZsetTypeZrevrange_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
     RedisModule_AutoMemory(ctx);
     if (argc < 4) {
@@ -1945,7 +2947,18 @@ int TairZsetTypeZrevrange_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **
     return REDISMODULE_OK;
 }
 
-/* EXZRANGEBYSCORE <key> <min> <max> [WITHSCORES] [LIMIT offset count] */
+/* EXZRANGEAROUND key member before after [REV] [WITHSCORES] */
+int TairZsetTypeZrangearound_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    RedisModule_AutoMemory(ctx);
+    if (argc < 5) {
+        return RedisModule_WrongArity(ctx);
+    }
+
+    exZrangeAroundGenericCommand(ctx, argv, argc);
+    return REDISMODULE_OK;
+}
+
+/* EXZRANGEBYSCORE <key> <min> <max> [WITHSCORES] [LIMIT offset count] [AFTER score member] */
 int TairZsetTypeZrangebyscore_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
     RedisModule_AutoMemory(ctx);
     if (argc < 4) {
@@ -1956,7 +2969,7 @@ int TairZsetTypeZrangebyscore_RedisCommand(RedisModuleCtx *ctx, RedisModuleStrin
     return REDISMODULE_OK;
 }
 
-/* EXZREVRANGEBYSCORE <key> <min> <max> [WITHSCORES] [LIMIT offset count] */
+/* EXZREVRANGEBYSCORE <key> <min> <max> [WITHSCORES] [LIMIT offset count] [AFTER score member] */
 int TairZsetTypeZrevrangebyscore_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
     RedisModule_AutoMemory(ctx);
     if (argc < 4) {
@@ -2145,12 +3158,12 @@ int TairZsetTypeZcount_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **arg
     range.min = NULL;
     unsigned long count = 0;
 
-    if (m_zslParseRange(argv[2], argv[3], &range) != C_OK) {
+    RedisModuleKey *key = RedisModule_OpenKey(ctx, argv[1], REDISMODULE_READ);
+    if (exZsetParseRange(key, argv[2], argv[3], &range) != C_OK) {
         RedisModule_ReplyWithError(ctx, "ERR min or max is not a float");
         goto free_range;
     }
 
-    RedisModuleKey *key = RedisModule_OpenKey(ctx, argv[1], REDISMODULE_READ);
     int type = RedisModule_KeyType(key);
     if (REDISMODULE_KEYTYPE_EMPTY != type && RedisModule_ModuleTypeGetType(key) != TairZsetType) {
         RedisModule_ReplyWithError(ctx, REDISMODULE_ERRORMSG_WRONGTYPE);
@@ -2165,11 +3178,29 @@ int TairZsetTypeZcount_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **arg
         tair_zset_obj = RedisModule_ModuleTypeGetValue(key);
     }
 
-    if (range.max->score_num != tair_zset_obj->zsl->score_num || range.min->score_num != tair_zset_obj->zsl->score_num) {
+    if (range.max->score_num != tair_zset_obj->score_num || range.min->score_num != tair_zset_obj->score_num) {
         RedisModule_ReplyWithError(ctx, "ERR score is not a valid format");
         goto free_range;
     }
 
+    if (tair_zset_obj->encoding == TAIRZSET_ENCODING_LISTPACK) {
+        unsigned char *zl = tair_zset_obj->zl;
+        unsigned char *eptr, *sptr;
+
+        /* Use the first element in range as the starting point */
+        eptr = m_zzlFirstInRange(zl, &range);
+        if (eptr != NULL) {
+            sptr = m_lpNext(zl, eptr);
+            /* Iterate over elements in range */
+            while (eptr && m_zzlValueLteMax(sptr, &range)) {
+                count++;
+                m_zzlNext(zl, &eptr, &sptr);
+            }
+        }
+        RedisModule_ReplyWithLongLong(ctx, count);
+        goto free_range;
+    }
+
     m_zskiplist *zsl = tair_zset_obj->zsl;
     m_zskiplistNode *zn;
     unsigned long rank;
@@ -2227,6 +3258,25 @@ int TairZsetTypeZlexcount_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **
         tair_zset_obj = RedisModule_ModuleTypeGetValue(key);
     }
 
+    if (tair_zset_obj->encoding == TAIRZSET_ENCODING_LISTPACK) {
+        unsigned char *zl = tair_zset_obj->zl;
+        unsigned char *eptr, *sptr;
+
+        /* Use the first element in range as the starting point */
+        eptr = m_zzlFirstInLexRange(zl, &range);
+        if (eptr != NULL) {
+            sptr = m_lpNext(zl, eptr);
+            /* Iterate over elements in range */
+            while (eptr && m_zzlLexValueLteMax(eptr, &range)) {
+                count++;
+                m_zzlNext(zl, &eptr, &sptr);
+            }
+        }
+        m_zslFreeLexRange(&range);
+        RedisModule_ReplyWithLongLong(ctx, count);
+        return REDISMODULE_OK;
+    }
+
     m_zskiplist *zsl = tair_zset_obj->zsl;
     m_zskiplistNode *zn;
     unsigned long rank;
@@ -2270,16 +3320,15 @@ int TairZsetTypeZmscore_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **ar
 
     RedisModule_ReplyWithArray(ctx, argc - 2);
 
-    scoretype *score;
+    scoretype *score = tair_zset_obj ? mnewScore(tair_zset_obj->score_num) : NULL;
     for (int j = 2; j < argc; j++) {
-        if (tair_zset_obj == NULL || exZsetScore(tair_zset_obj, argv[j], &score) == C_ERR) {
+        if (tair_zset_obj == NULL || exZsetScore(tair_zset_obj, argv[j], score) == C_ERR) {
             RedisModule_ReplyWithNull(ctx);
         } else {
-            sds score_str = mscore2String(score);
-            RedisModule_ReplyWithStringBuffer(ctx, score_str, sdslen(score_str));
-            m_sdsfree(score_str);
+            exZsetReplyWithScore(ctx, tair_zset_obj, score);
         }
     }
+    if (score) RedisModule_Free(score);
     return REDISMODULE_OK;
 }
 
@@ -2329,9 +3378,14 @@ int TairZsetTypeZrandmember_RedisCommand(RedisModuleCtx *ctx, RedisModuleString
         RedisModule_ReplyWithNull(ctx);
         return REDISMODULE_OK;
     }
-    RedisModuleString *ele;
+    if (tair_zset_obj->encoding == TAIRZSET_ENCODING_LISTPACK) {
+        unsigned long idx = random() % m_zzlLength(tair_zset_obj->zl);
+        exZzlReplyWithMember(ctx, m_lpSeek(tair_zset_obj->zl, 2 * idx));
+        return REDISMODULE_OK;
+    }
+    sds ele;
     exZsetRandomElement(tair_zset_obj, &ele, NULL);
-    RedisModule_ReplyWithString(ctx, ele);
+    RedisModule_ReplyWithStringBuffer(ctx, ele, sdslen(ele));
     return REDISMODULE_OK;
 }
 
@@ -2481,112 +3535,694 @@ int TairZsetTypeBzpopmax_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **a
 
 
 /* ========================== "exstrtype" type methods =======================*/
-void *TairZsetTypeRdbLoad(RedisModuleIO *rdb, int encver) {
-    REDISMODULE_NOT_USED(encver);
 
+/* Since TAIRZSET_ENCVER_VER_3 the elements are saved in blocks of up to
+ * TAIRZSET_RDB_BLOCK_ELEMENTS elements, instead of one string and score_num
+ * doubles per element. Every block is made of two string buffers:
+ *
+ * - The members, every one prefixed by its length as a varint.
+ * - The scores, one column per dimension. A column starts with its encoding
+ *   byte: TAIRZSET_RDB_COLUMN_RAW for little endian doubles, or
+ *   TAIRZSET_RDB_COLUMN_XOR where every double is XORed with the previous one
+ *   of the column and only the bytes between the leading and trailing zero
+ *   bytes of the result are saved, after a byte holding their two counts.
+ *   Elements are saved sorted, so the first dimension compresses well.
+ *
+ * The number of elements of the block is the number of members. */
+#define TAIRZSET_RDB_BLOCK_ELEMENTS 1024
+#define TAIRZSET_RDB_BLOCK_BYTES (64 * 1024)
+#define TAIRZSET_RDB_COLUMN_RAW 0
+#define TAIRZSET_RDB_COLUMN_XOR 1
+
+typedef struct exZsetRdbWriter {
+    RedisModuleIO *rdb;
+    size_t score_num;
+    size_t count;           /* Elements in the current block. */
+    sds members;            /* Members of the current block. */
+    double *scores;         /* Scores of the current block, row after row. */
+    unsigned char *columns; /* Encoded scores buffer. */
+} exZsetRdbWriter;
+
+static inline double exZsetRdbU64ToDouble(uint64_t u) {
+    double d;
+    memcpy(&d, &u, sizeof(d));
+    return d;
+}
+
+static inline uint64_t exZsetRdbDoubleToU64(double d) {
+    uint64_t u;
+    memcpy(&u, &d, sizeof(u));
+    return u;
+}
+
+static void exZsetRdbWriterInit(exZsetRdbWriter *w, RedisModuleIO *rdb, size_t score_num) {
+    w->rdb = rdb;
+    w->score_num = score_num;
+    w->count = 0;
+    w->members = m_sdsempty();
+    w->scores = RedisModule_Alloc(TAIRZSET_RDB_BLOCK_ELEMENTS * score_num * sizeof(double));
+    w->columns = RedisModule_Alloc(score_num * (1 + TAIRZSET_RDB_BLOCK_ELEMENTS * (sizeof(double) + 1)));
+}
+
+/* Encode the column 'dim' of the current block at 'p', returns the bytes
+ * used. The XOR encoding is only used when it is shorter. */
+static size_t exZsetRdbWriterEncodeColumn(exZsetRdbWriter *w, size_t dim, unsigned char *p) {
+    unsigned char *start = p;
+    uint64_t prev = 0, u, x;
+    size_t j;
+    int lz, tz, k;
+
+    *p++ = TAIRZSET_RDB_COLUMN_XOR;
+    for (j = 0; j < w->count; j++) {
+        u = exZsetRdbDoubleToU64(w->scores[j * w->score_num + dim]);
+        x = u ^ prev;
+        prev = u;
+        if (x == 0) {
+            *p++ = 8 << 4;
+            continue;
+        }
+        lz = __builtin_clzll(x) / 8;
+        tz = __builtin_ctzll(x) / 8;
+        *p++ = (unsigned char)(lz << 4 | tz);
+        for (k = 7 - lz; k >= tz; k--) *p++ = (unsigned char)(x >> (k * 8));
+    }
+    if ((size_t)(p - start) <= 1 + w->count * sizeof(double)) return p - start;
+
+    p = start;
+    *p++ = TAIRZSET_RDB_COLUMN_RAW;
+    for (j = 0; j < w->count; j++) {
+        u = exZsetRdbDoubleToU64(w->scores[j * w->score_num + dim]);
+        for (k = 0; k < 8; k++) *p++ = (unsigned char)(u >> (k * 8));
+    }
+    return p - start;
+}
+
+static void exZsetRdbWriterFlush(exZsetRdbWriter *w) {
+    size_t dim, len = 0;
+
+    if (w->count == 0) return;
+    for (dim = 0; dim < w->score_num; dim++) {
+        len += exZsetRdbWriterEncodeColumn(w, dim, w->columns + len);
+    }
+    RedisModule_SaveStringBuffer(w->rdb, w->members, sdslen(w->members));
+    RedisModule_SaveStringBuffer(w->rdb, (const char *)w->columns, len);
+    m_sdsclear(w->members);
+    w->count = 0;
+}
+
+static void exZsetRdbWriterAdd(exZsetRdbWriter *w, const char *ele, size_t elelen, const double *scores) {
+    unsigned char buf[10];
+    size_t n = 0;
+    uint64_t v = elelen;
+
+    do {
+        buf[n++] = (unsigned char)((v & 0x7f) | (v > 0x7f ? 0x80 : 0));
+        v >>= 7;
+    } while (v);
+    w->members = m_sdscatlen(w->members, buf, n);
+    w->members = m_sdscatlen(w->members, ele, elelen);
+    memcpy(w->scores + w->count * w->score_num, scores, w->score_num * sizeof(double));
+
+    if (++w->count == TAIRZSET_RDB_BLOCK_ELEMENTS || sdslen(w->members) >= TAIRZSET_RDB_BLOCK_BYTES) {
+        exZsetRdbWriterFlush(w);
+    }
+}
+
+static void exZsetRdbWriterRelease(exZsetRdbWriter *w) {
+    exZsetRdbWriterFlush(w);
+    m_sdsfree(w->members);
+    RedisModule_Free(w->scores);
+    RedisModule_Free(w->columns);
+}
+
+/* Read a varint written by exZsetRdbWriterAdd(), returns 0 if the buffer
+ * ends before it does. */
+static int exZsetRdbGetVarint(const unsigned char **p, const unsigned char *end, uint64_t *v) {
+    int shift;
+
+    *v = 0;
+    for (shift = 0; shift < 64 && *p < end; shift += 7) {
+        unsigned char b = *(*p)++;
+        *v |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) return 1;
+    }
+    return 0;
+}
+
+/* Decode a column encoded by exZsetRdbWriterEncodeColumn() into 'scores',
+ * with 'stride' doubles between two elements. Returns the position after
+ * the column, or NULL if the column is corrupted. */
+static const unsigned char *exZsetRdbDecodeColumn(const unsigned char *p, const unsigned char *end, size_t count, double *scores, size_t stride) {
+    uint64_t prev = 0, u;
+    size_t j;
+    int k;
+
+    if (p == end) return NULL;
+    if (*p == TAIRZSET_RDB_COLUMN_RAW) {
+        p++;
+        if ((size_t)(end - p) < count * sizeof(double)) return NULL;
+        for (j = 0; j < count; j++) {
+            for (u = 0, k = 0; k < 8; k++) u |= (uint64_t)*p++ << (k * 8);
+            scores[j * stride] = exZsetRdbU64ToDouble(u);
+        }
+        return p;
+    }
+    if (*p++ != TAIRZSET_RDB_COLUMN_XOR) return NULL;
+    for (j = 0; j < count; j++) {
+        if (p == end) return NULL;
+        int lz = *p >> 4, tz = *p & 0xf;
+        p++;
+        if (lz + tz > 8 || (lz < 8 && end - p < 8 - lz - tz)) return NULL;
+        u = 0;
+        for (k = 7 - lz; k >= tz; k--) u |= (uint64_t)*p++ << (k * 8);
+        prev ^= u;
+        scores[j * stride] = exZsetRdbU64ToDouble(prev);
+    }
+    return p;
+}
+
+/* Return the number of members of a block, 0 if the members buffer is
+ * corrupted. */
+static size_t exZsetRdbBlockCount(const char *mbuf, size_t mlen) {
+    const unsigned char *p = (const unsigned char *)mbuf, *end = p + mlen;
+    uint64_t elelen;
+    size_t count = 0;
+
+    while (p < end) {
+        if (!exZsetRdbGetVarint(&p, end, &elelen) || elelen > (uint64_t)(end - p)) return 0;
+        p += elelen;
+        count++;
+    }
+    return count;
+}
+
+/* Split the 'count' members of a block (see exZsetRdbBlockCount()) into
+ * 'eles' and 'elelens', and decode its scores into 'scores', one row of
+ * score_num doubles per element. Returns 0 if the columns are corrupted. */
+static int exZsetRdbParseBlock(const char *mbuf, const char *cbuf, size_t clen, size_t count, size_t score_num,
+                               const char **eles, size_t *elelens, double *scores) {
+    const unsigned char *p = (const unsigned char *)mbuf, *end;
+    uint64_t elelen;
+    size_t j, dim;
+
+    for (j = 0; j < count; j++) {
+        exZsetRdbGetVarint(&p, p + 10, &elelen);
+        eles[j] = (const char *)p;
+        elelens[j] = elelen;
+        p += elelen;
+    }
+
+    p = (const unsigned char *)cbuf;
+    end = p + clen;
+    for (dim = 0; dim < score_num; dim++) {
+        p = exZsetRdbDecodeColumn(p, end, count, scores + dim, score_num);
+        if (p == NULL) return 0;
+    }
+    return 1;
+}
+
+/* Add an element loaded from an RDB file to 'o', 'remaining' is the number
+ * of elements still to load after this one. */
+static void exZsetRdbLoadElement(TairZsetObj *o, const char *ele, size_t elelen, scoretype *score, unsigned long remaining) {
+    if (o->encoding == TAIRZSET_ENCODING_LISTPACK) {
+        if (elelen > (size_t)tairzset_max_listpack_value ||
+            !m_lpSafeToAdd(o->zl, elelen + o->score_num * sizeof(double))) {
+            exZsetConvert(o, TAIRZSET_ENCODING_SKIPLIST);
+            m_zindexExpand(o->index, exZsetLength(o) + remaining + 1);
+        } else {
+            /* Elements are saved from the tail, so this is a head insert. */
+            o->zl = m_zzlInsert(o->zl, ele, elelen, score, o->types);
+            return;
+        }
+    }
+
+    /* Elements are saved from the tail, so this is a head insert. */
+    m_zskiplistNode *znode = m_zslInsertHead(o->zsl, score, ele, elelen);
+    m_zindexAdd(o->index, znode);
+}
+
+/* Load the blocks of 'length' elements saved by exZsetRdbWriter. 'legacy'
+ * is the schema of 'o' when its int dimensions were saved as doubles, before
+ * TAIRZSET_ENCVER_VER_4, NULL otherwise. Returns 0 if a block is corrupted. */
+static int exZsetRdbLoadBlocks(RedisModuleIO *rdb, TairZsetObj *o, unsigned long length, scoretype *score,
+                               const unsigned char *legacy) {
+    size_t score_num = o->score_num, cap = 0, count, j;
+    const char **eles = NULL;
+    size_t *elelens = NULL;
+    double *scores = NULL;
+    int ok = 1;
+
+    while (length && ok) {
+        size_t mlen, clen;
+        char *mbuf = RedisModule_LoadStringBuffer(rdb, &mlen);
+        char *cbuf = RedisModule_LoadStringBuffer(rdb, &clen);
+
+        count = exZsetRdbBlockCount(mbuf, mlen);
+        if (count == 0 || count > length) {
+            ok = 0;
+        } else {
+            if (count > cap) {
+                cap = count;
+                eles = RedisModule_Realloc(eles, cap * sizeof(*eles));
+                elelens = RedisModule_Realloc(elelens, cap * sizeof(*elelens));
+                scores = RedisModule_Realloc(scores, cap * score_num * sizeof(double));
+            }
+            ok = exZsetRdbParseBlock(mbuf, cbuf, clen, count, score_num, eles, elelens, scores);
+        }
+
+        for (j = 0; ok && j < count; j++) {
+            memcpy(score->scores, scores + j * score_num, score_num * sizeof(double));
+            mscoreDoubleToInt(score, legacy);
+            exZsetRdbLoadElement(o, eles[j], elelens[j], score, --length);
+        }
+        RedisModule_Free(mbuf);
+        RedisModule_Free(cbuf);
+    }
+
+    RedisModule_Free(eles);
+    RedisModule_Free(elelens);
+    RedisModule_Free(scores);
+    return ok;
+}
+
+/* Big skiplists, with at least tairzset_rdb_load_threads_min_elements
+ * elements, are loaded by tairzset_rdb_load_threads threads, started once
+ * per key. The main thread reads the blocks into a ring of
+ * TAIRZSET_RDB_QUEUE_BLOCKS slots per thread, while the other threads
+ * decode them and create their nodes, computing the hashes of the members
+ * too. The main thread links the decoded blocks in saved order at the head
+ * of the skiplist and into the presized index, which is just a few pointer
+ * updates per node, and decodes blocks itself when it has nothing else to
+ * do, so the load completes even if no thread could be started. */
+#define TAIRZSET_RDB_QUEUE_BLOCKS 4
+#define TAIRZSET_RDB_MAX_LOAD_THREADS 64
+
+#define TAIRZSET_RDB_BLOCK_LOADED 0
+#define TAIRZSET_RDB_BLOCK_DECODED 1
+
+typedef struct exZsetRdbBlock {
+    char *mbuf, *cbuf; /* Buffers loaded from the RDB. */
+    size_t clen;
+    size_t count;            /* Set by the main thread. */
+    m_zskiplistNode **nodes; /* Set by the decoding thread, in saved order. */
+    uint64_t *hashes;
+    int ok;
+    int state; /* TAIRZSET_RDB_BLOCK_*, protected by the queue lock. */
+} exZsetRdbBlock;
+
+/* The blocks of sequence number 'seq' are in slot seq % nslots: the ones in
+ * [linked, loaded) are in the ring, those in [decoding, loaded) are still
+ * waiting for a thread. */
+typedef struct exZsetRdbQueue {
+    pthread_mutex_t lock;
+    pthread_cond_t loaded_cond, decoded_cond;
+    exZsetRdbBlock *blocks;
+    size_t nslots;
+    size_t linked, decoding, loaded;
+    int done; /* No more blocks will be loaded. */
+    unsigned char score_num;
+    const unsigned char *types;
+    const unsigned char *legacy; /* See exZsetRdbLoadBlocks(). */
+} exZsetRdbQueue;
+
+typedef struct exZsetRdbDecoder {
+    pthread_t tid;
+    int started;
+    exZsetRdbQueue *q;
+    uint64_t seed; /* See m_zslRandomLevelR(). */
+} exZsetRdbDecoder;
+
+static void exZsetRdbDecodeBlock(exZsetRdbDecoder *d, exZsetRdbBlock *b) {
+    size_t j, score_num = d->q->score_num;
+    const char **eles = RedisModule_Alloc(b->count * sizeof(*eles));
+    size_t *elelens = RedisModule_Alloc(b->count * sizeof(*elelens));
+    double *scores = RedisModule_Alloc(b->count * score_num * sizeof(double));
+
+    b->ok = exZsetRdbParseBlock(b->mbuf, b->cbuf, b->clen, b->count, score_num, eles, elelens, scores);
+    if (b->ok) {
+        scoretype *score = mnewScore(score_num);
+        b->nodes = RedisModule_Alloc(b->count * sizeof(*b->nodes));
+        b->hashes = RedisModule_Alloc(b->count * sizeof(*b->hashes));
+        for (j = 0; j < b->count; j++) {
+            memcpy(score->scores, scores + j * score_num, score_num * sizeof(double));
+            mscoreDoubleToInt(score, d->q->legacy);
+            b->nodes[j] = m_zslCreateNode(m_zslRandomLevelR(&d->seed), score_num, d->q->types, score, eles[j],
+                                          elelens[j]);
+            b->hashes[j] = m_zindexHash(eles[j], elelens[j]);
+        }
+        RedisModule_Free(score);
+    }
+    RedisModule_Free(eles);
+    RedisModule_Free(elelens);
+    RedisModule_Free(scores);
+}
+
+/* Take the oldest block waiting for a thread and decode it, called with the
+ * queue lock held. Returns 0 if no block is waiting. */
+static int exZsetRdbDecodeNext(exZsetRdbDecoder *d) {
+    exZsetRdbQueue *q = d->q;
+    exZsetRdbBlock *b;
+
+    if (q->decoding == q->loaded) return 0;
+    b = &q->blocks[q->decoding++ % q->nslots];
+    pthread_mutex_unlock(&q->lock);
+    exZsetRdbDecodeBlock(d, b);
+    pthread_mutex_lock(&q->lock);
+    b->state = TAIRZSET_RDB_BLOCK_DECODED;
+    pthread_cond_signal(&q->decoded_cond);
+    return 1;
+}
+
+static void *exZsetRdbDecoderMain(void *arg) {
+    exZsetRdbDecoder *d = arg;
+    exZsetRdbQueue *q = d->q;
+
+    pthread_mutex_lock(&q->lock);
+    while (1) {
+        if (exZsetRdbDecodeNext(d)) continue;
+        if (q->done) break;
+        pthread_cond_wait(&q->loaded_cond, &q->lock);
+    }
+    pthread_mutex_unlock(&q->lock);
+    return NULL;
+}
+
+static void exZsetRdbFreeBlock(exZsetRdbBlock *b) {
+    for (size_t j = 0; b->nodes && j < b->count; j++) m_zslFreeNode(b->nodes[j]);
+    RedisModule_Free(b->nodes);
+    RedisModule_Free(b->hashes);
+    RedisModule_Free(b->mbuf);
+    RedisModule_Free(b->cbuf);
+}
+
+/* Like exZsetRdbLoadBlocks(), decoding the blocks with 'nthreads' threads,
+ * for a skiplist encoded 'o' with a presized index. */
+static int exZsetRdbLoadBlocksThreaded(RedisModuleIO *rdb, TairZsetObj *o, unsigned long length, int nthreads,
+                                       const unsigned char *legacy) {
+    exZsetRdbQueue q = {.nslots = (size_t)nthreads * TAIRZSET_RDB_QUEUE_BLOCKS, .score_num = o->score_num,
+                        .types = o->types, .legacy = legacy};
+    exZsetRdbDecoder *decoders = RedisModule_Calloc(nthreads, sizeof(*decoders));
+    exZsetRdbDecoder *self = &decoders[0];
+    int ok = 1, t;
+    size_t j;
+
+    q.blocks = RedisModule_Calloc(q.nslots, sizeof(*q.blocks));
+    pthread_mutex_init(&q.lock, NULL);
+    pthread_cond_init(&q.loaded_cond, NULL);
+    pthread_cond_init(&q.decoded_cond, NULL);
+    for (t = 0; t < nthreads; t++) {
+        decoders[t].q = &q;
+        decoders[t].seed = ((uint64_t)random() << 32 | (uint64_t)random()) | 1;
+        if (t) decoders[t].started = pthread_create(&decoders[t].tid, NULL, exZsetRdbDecoderMain, &decoders[t]) == 0;
+    }
+
+    pthread_mutex_lock(&q.lock);
+    while (length || q.linked < q.loaded) {
+        exZsetRdbBlock *b;
+
+        /* Link the oldest block as soon as it is decoded. */
+        b = &q.blocks[q.linked % q.nslots];
+        if (q.linked < q.loaded && b->state == TAIRZSET_RDB_BLOCK_DECODED) {
+            pthread_mutex_unlock(&q.lock);
+            ok = b->ok;
+            for (j = 0; ok && j < b->count; j++) {
+                m_zslInsertNodeHead(o->zsl, b->nodes[j]);
+                m_zindexAddHashed(o->index, b->nodes[j], b->hashes[j]);
+            }
+            if (ok) {
+                RedisModule_Free(b->nodes);
+                b->nodes = NULL;
+            }
+            exZsetRdbFreeBlock(b);
+            pthread_mutex_lock(&q.lock);
+            q.linked++;
+            if (!ok) break;
+            continue;
+        }
+
+        /* Otherwise read the next block into a free slot, without holding
+         * the lock since no thread looks at the slots past 'loaded'. */
+        if (length && q.loaded - q.linked < q.nslots) {
+            size_t mlen;
+
+            b = &q.blocks[q.loaded % q.nslots];
+            pthread_mutex_unlock(&q.lock);
+            memset(b, 0, sizeof(*b));
+            b->mbuf = RedisModule_LoadStringBuffer(rdb, &mlen);
+            b->cbuf = RedisModule_LoadStringBuffer(rdb, &b->clen);
+            b->count = exZsetRdbBlockCount(b->mbuf, mlen);
+            ok = b->count != 0 && b->count <= length;
+            if (ok) length -= b->count;
+            else exZsetRdbFreeBlock(b);
+            pthread_mutex_lock(&q.lock);
+            if (!ok) break;
+            b->state = TAIRZSET_RDB_BLOCK_LOADED;
+            q.loaded++;
+            pthread_cond_signal(&q.loaded_cond);
+            continue;
+        }
+
+        /* Or help the threads, or wait for them. */
+        if (!exZsetRdbDecodeNext(self)) pthread_cond_wait(&q.decoded_cond, &q.lock);
+    }
+
+    /* After an error the blocks not taken by a thread yet are dropped. */
+    if (!ok) q.decoding = q.loaded;
+    q.done = 1;
+    pthread_cond_broadcast(&q.loaded_cond);
+    pthread_mutex_unlock(&q.lock);
+    for (t = 1; t < nthreads; t++) {
+        if (decoders[t].started) pthread_join(decoders[t].tid, NULL);
+    }
+    for (; q.linked < q.loaded; q.linked++) exZsetRdbFreeBlock(&q.blocks[q.linked % q.nslots]);
+
+    pthread_mutex_destroy(&q.lock);
+    pthread_cond_destroy(&q.loaded_cond);
+    pthread_cond_destroy(&q.decoded_cond);
+    RedisModule_Free(q.blocks);
+    RedisModule_Free(decoders);
+    return ok;
+}
+
+void *TairZsetTypeRdbLoad(RedisModuleIO *rdb, int encver) {
     size_t i, score_num;
     unsigned long length;
+    unsigned char *types = NULL;
 
     length = RedisModule_LoadUnsigned(rdb);
     score_num = RedisModule_LoadUnsigned(rdb);
+    if (score_num == 0 || score_num > MAX_SCORE_NUM) {
+        RedisModule_LogIOError(rdb, "warning", "TairZset: invalid score dimensions %zu", score_num);
+        return NULL;
+    }
+    if (encver >= TAIRZSET_ENCVER_VER_2) {
+        size_t typeslen;
+        types = (unsigned char *)RedisModule_LoadStringBuffer(rdb, &typeslen);
+        if (typeslen == 0) {
+            RedisModule_Free(types);
+            types = NULL;
+        } else {
+            /* The schema is indexed by dimension and by type later on. */
+            int valid = typeslen == score_num;
+            for (i = 0; valid && i < score_num; i++) {
+                if (types[i] >= MSCORE_TYPES) valid = 0;
+            }
+            if (!valid) {
+                RedisModule_LogIOError(rdb, "warning", "TairZset: corrupted score schema");
+                RedisModule_Free(types);
+                return NULL;
+            }
+        }
+    }
 
-    TairZsetObj *o = createTairZsetTypeObject(score_num);
+    /* Members are only known while loading, so start with a listpack when the
+     * length allows it and convert as soon as a member is too long. */
+    TairZsetObj *o = exZsetTypeCreate(score_num, types, length, 0);
+    if (o->encoding == TAIRZSET_ENCODING_SKIPLIST) m_zindexExpand(o->index, length);
+    scoretype *score = mnewScore(score_num);
+    const unsigned char *legacy = encver < TAIRZSET_ENCVER_VER_4 ? types : NULL;
 
-    while (length--) {
-        RedisModuleString *ele;
-        scoretype *score = RedisModule_Calloc(1, sizeof(scoretype) + sizeof(double) * score_num);
-        score->score_num = score_num;
+    if (encver >= TAIRZSET_ENCVER_VER_3) {
+        int ok;
+        if (o->encoding == TAIRZSET_ENCODING_SKIPLIST && tairzset_rdb_load_threads > 1 &&
+            length >= (unsigned long)tairzset_rdb_load_threads_min_elements) {
+            ok = exZsetRdbLoadBlocksThreaded(rdb, o, length, (int)tairzset_rdb_load_threads, legacy);
+        } else {
+            ok = exZsetRdbLoadBlocks(rdb, o, length, score, legacy);
+        }
+        if (!ok) {
+            RedisModule_LogIOError(rdb, "warning", "TairZset: corrupted elements block");
+            RedisModule_Free(score);
+            TairZsetTypeReleaseObject(o);
+            return NULL;
+        }
+        RedisModule_Free(score);
+        return o;
+    }
 
-        ele = RedisModule_LoadString(rdb);
+    while (length--) {
+        size_t elelen;
+        char *ele = RedisModule_LoadStringBuffer(rdb, &elelen);
 
         for (i = 0; i < score_num; i++) {
             score->scores[i] = RedisModule_LoadDouble(rdb);
         }
-
-        m_zslInsert(o->zsl, score, ele);
-        m_dictAdd(o->dict, ele, score);
+        mscoreDoubleToInt(score, legacy);
+        exZsetRdbLoadElement(o, ele, elelen, score, length);
+        RedisModule_Free(ele);
     }
+    RedisModule_Free(score);
 
     return o;
 }
 
 void TairZsetTypeRdbSave(RedisModuleIO *rdb, void *value) {
     TairZsetObj *o = (TairZsetObj *)value;
-    m_zskiplist *zsl = o->zsl;
-    size_t i, score_num;
-
-    score_num = zsl->score_num;
+    size_t score_num = o->score_num;
+    exZsetRdbWriter w;
 
-    RedisModule_SaveUnsigned(rdb, zsl->length);
+    RedisModule_SaveUnsigned(rdb, exZsetLength(o));
     RedisModule_SaveUnsigned(rdb, score_num);
-
-    m_zskiplistNode *zn = zsl->tail;
-    while (zn != NULL) {
-        RedisModule_SaveString(rdb, zn->ele);
-        for (i = 0; i < score_num; i++) {
-            RedisModule_SaveDouble(rdb, zn->score->scores[i]);
+    RedisModule_SaveStringBuffer(rdb, o->types ? (const char *)o->types : "", o->types ? score_num : 0);
+
+    /* Elements are saved from the tail with both encodings. */
+    exZsetRdbWriterInit(&w, rdb, score_num);
+    if (o->encoding == TAIRZSET_ENCODING_LISTPACK) {
+        unsigned char *zl = o->zl;
+        unsigned char *eptr, *sptr, *vstr;
+        uint32_t vlen;
+
+        scoretype *score = mnewScore(score_num);
+        eptr = m_lpSeek(zl, -2);
+        sptr = eptr ? m_lpNext(zl, eptr) : NULL;
+        while (eptr != NULL) {
+            vstr = m_lpGet(eptr, &vlen);
+            m_zzlGetScore(sptr, score);
+            exZsetRdbWriterAdd(&w, (const char *)vstr, vlen, score->scores);
+            m_zzlPrev(zl, &eptr, &sptr);
+        }
+        RedisModule_Free(score);
+    } else {
+        m_zskiplistNode *zn = o->zsl->tail;
+        while (zn != NULL) {
+            exZsetRdbWriterAdd(&w, zn->ele, sdslen(zn->ele), zn->score->scores);
+            zn = zn->level[0].backward;
         }
-
-        zn = zn->backward;
     }
+    exZsetRdbWriterRelease(&w);
 }
 
-#define AOF_REWRITE_ITEMS_PER_CMD 64
-void TairZsetTypeAofRewrite(RedisModuleIO *aof, RedisModuleString *key, void *value) {
-    TairZsetObj *o = (TairZsetObj *)value;
+/* The AOF rewrite emits one EXZADD per batch of elements, in score order so
+ * that the replay appends every element at the tail. A batch ends after
+ * AOF_REWRITE_MAX_ITEMS_PER_CMD elements or AOF_REWRITE_MAX_BYTES_PER_CMD
+ * bytes of scores and members, so small elements share big commands while
+ * big members do not make huge ones. */
+#define AOF_REWRITE_MAX_ITEMS_PER_CMD 1024
+#define AOF_REWRITE_MAX_BYTES_PER_CMD (64 * 1024)
+
+typedef struct exZsetAofBatch {
+    RedisModuleIO *aof;
+    RedisModuleString *key;
+    RedisModuleString *schema; /* SCHEMA argument, NULL if all doubles. */
+    RedisModuleString **argv;  /* Score-member pairs. */
+    size_t argc, bytes;
+    char scorebuf[MSCORE_MAX_CHARS];
+} exZsetAofBatch;
+
+/* Emit an EXZADD of the score-member pairs in 'argv', with the SCHEMA option
+ * for the sorted sets with typed dimensions. */
+static void exZsetEmitAOF(RedisModuleIO *aof, RedisModuleString *key, RedisModuleString *schema, RedisModuleString **argv, size_t argc) {
+    if (schema)
+        RedisModule_EmitAOF(aof, "EXZADD", "scsv", key, "SCHEMA", schema, argv, argc);
+    else
+        RedisModule_EmitAOF(aof, "EXZADD", "sv", key, argv, argc);
+}
 
-    long long count = 0, i;
+static void exZsetAofBatchFlush(exZsetAofBatch *b) {
+    size_t i;
 
-    size_t array_size = 0;
+    if (b->argc == 0) return;
+    exZsetEmitAOF(b->aof, b->key, b->schema, b->argv, b->argc);
+    for (i = 0; i < b->argc; i++) RedisModule_FreeString(NULL, b->argv[i]);
+    b->argc = 0;
+    b->bytes = 0;
+}
 
-    RedisModuleString **string_array = RedisModule_Calloc(AOF_REWRITE_ITEMS_PER_CMD * 2, sizeof(RedisModuleString *));
+/* Add an element to the batch, the score is printed in the buffer of the
+ * batch and both strings are created right from the score and the member. */
+static void exZsetAofBatchAdd(exZsetAofBatch *b, scoretype *score, const unsigned char *types, const char *ele, size_t elelen) {
+    size_t scorelen = mscoreFormat(b->scorebuf, score, types);
 
-    m_dictIterator *di = m_dictGetIterator(o->dict);
-    m_dictEntry *de;
-    while ((de = m_dictNext(di)) != NULL) {
-        RedisModuleString *ele = dictGetKey(de);
-        scoretype *score = (scoretype *)dictGetVal(de);
-        sds score_str = mscore2String(score);
-        string_array[array_size++] = RedisModule_CreateString(NULL, score_str, sdslen(score_str));
-        m_sdsfree(score_str);
-        string_array[array_size++] = RedisModule_CreateStringFromString(NULL, ele);
-
-        if (++count == AOF_REWRITE_ITEMS_PER_CMD) {
-            RedisModule_EmitAOF(aof, "EXZADD", "sv", key, string_array, array_size);
-            count = 0;
-            for (i = 0; i < array_size; i++) {
-                RedisModule_FreeString(NULL, string_array[i]);
-                string_array[i] = NULL;
-            }
-            array_size = 0;
-        }
+    b->argv[b->argc++] = RedisModule_CreateString(NULL, b->scorebuf, scorelen);
+    b->argv[b->argc++] = RedisModule_CreateString(NULL, ele, elelen);
+    b->bytes += scorelen + elelen;
+    if (b->argc == AOF_REWRITE_MAX_ITEMS_PER_CMD * 2 || b->bytes >= AOF_REWRITE_MAX_BYTES_PER_CMD) {
+        exZsetAofBatchFlush(b);
     }
-    m_dictReleaseIterator(di);
+}
 
-    if (array_size) {
-        RedisModule_EmitAOF(aof, "EXZADD", "sv", key, string_array, array_size);
-        for (i = 0; i < array_size; i++) {
-            RedisModule_FreeString(NULL, string_array[i]);
-            string_array[i] = NULL;
+void TairZsetTypeAofRewrite(RedisModuleIO *aof, RedisModuleString *key, void *value) {
+    TairZsetObj *o = (TairZsetObj *)value;
+    exZsetAofBatch *b = RedisModule_Alloc(sizeof(*b));
+
+    b->aof = aof;
+    b->key = key;
+    b->schema = NULL;
+    b->argv = RedisModule_Alloc(AOF_REWRITE_MAX_ITEMS_PER_CMD * 2 * sizeof(RedisModuleString *));
+    b->argc = 0;
+    b->bytes = 0;
+    if (o->types) {
+        sds schema_str = mscoreSchema2String(o->types, o->score_num);
+        b->schema = RedisModule_CreateString(NULL, schema_str, sdslen(schema_str));
+        m_sdsfree(schema_str);
+    }
+
+    if (o->encoding == TAIRZSET_ENCODING_LISTPACK) {
+        unsigned char *zl = o->zl;
+        unsigned char *eptr, *sptr, *vstr;
+        uint32_t vlen;
+        scoretype *score = mnewScore(o->score_num);
+
+        eptr = m_lpSeek(zl, 0);
+        sptr = eptr ? m_lpNext(zl, eptr) : NULL;
+        while (eptr != NULL) {
+            m_zzlGetScore(sptr, score);
+            vstr = m_lpGet(eptr, &vlen);
+            exZsetAofBatchAdd(b, score, o->types, (const char *)vstr, vlen);
+            m_zzlNext(zl, &eptr, &sptr);
+        }
+        RedisModule_Free(score);
+    } else {
+        m_zskiplistNode *zn;
+        for (zn = o->zsl->header->level[0].forward; zn != NULL; zn = zn->level[0].forward) {
+            exZsetAofBatchAdd(b, zn->score, o->types, zn->ele, sdslen(zn->ele));
         }
     }
+    exZsetAofBatchFlush(b);
 
-    RedisModule_Free(string_array);
+    if (b->schema) RedisModule_FreeString(NULL, b->schema);
+    RedisModule_Free(b->argv);
+    RedisModule_Free(b);
 }
 
 size_t TairZsetTypeMemUsage(const void *value) {
     TairZsetObj *o = (TairZsetObj *)value;
 
-    size_t asize = 0, elesize;
+    size_t asize = 0;
+
+    if (o->types) asize += o->score_num;
+
+    if (o->encoding == TAIRZSET_ENCODING_LISTPACK) {
+        return asize + sizeof(*o) + m_lpBytes(o->zl);
+    }
 
     m_zskiplist *zsl = o->zsl;
     m_zskiplistNode *znode = zsl->header->level[0].forward;
 
-    asize = sizeof(*o) + sizeof(m_zskiplist) + sizeof(dict) + (sizeof(struct m_dictEntry *) * dictSlots(o->dict));
+    asize += sizeof(*o) + sizeof(m_zskiplist) + sizeof(m_zskiplistNode) + zsl->header_level * sizeof(struct zskiplistLevel) + sizeof(m_zindex) + (sizeof(m_zskiplistNode *) * zindexSlots(o->index));
 
     while (znode != NULL) {
-        RedisModule_StringPtrLen(znode->ele, &elesize);
-        asize += sizeof(*znode) + elesize + znode->score->score_num * sizeof(double);
+        asize += sizeof(*znode) + znode->score->score_num * (sizeof(double) + sizeof(uint64_t)) + m_sdsplacementsize(sdslen(znode->ele));
         znode = znode->level[0].forward;
     }
 
@@ -2598,25 +4234,39 @@ void TairZsetTypeFree(void *value) { TairZsetTypeReleaseObject(value); }
 void TairZsetTypeDigest(RedisModuleDigest *md, void *value) {
     TairZsetObj *o = (TairZsetObj *)value;
 
-    m_dictIterator *di = m_dictGetIterator(o->dict);
-    m_dictEntry *de;
+    if (o->encoding == TAIRZSET_ENCODING_LISTPACK) {
+        unsigned char *zl = o->zl;
+        unsigned char *eptr, *sptr, *vstr;
+        uint32_t vlen;
+        scoretype *score = mnewScore(o->score_num);
+
+        eptr = m_lpSeek(zl, 0);
+        sptr = eptr ? m_lpNext(zl, eptr) : NULL;
+        while (eptr != NULL) {
+            vstr = m_lpGet(eptr, &vlen);
+            RedisModule_DigestAddStringBuffer(md, vstr, vlen);
+            m_zzlGetScore(sptr, score);
+            sds score_str = mscore2String(score, o->types);
+            RedisModule_DigestAddStringBuffer(md, (unsigned char *)score_str, sdslen(score_str));
+            m_sdsfree(score_str);
+            RedisModule_DigestEndSequence(md);
+            m_zzlNext(zl, &eptr, &sptr);
+        }
+        RedisModule_Free(score);
+        return;
+    }
 
-    size_t elelen = 0;
-    RedisModuleString *ele;
-    scoretype *score;
+    m_zskiplistNode *zn;
 
-    while ((de = m_dictNext(di)) != NULL) {
-        ele = dictGetKey(de);
-        score = dictGetVal(de);
-        const char *eleptr = RedisModule_StringPtrLen(ele, &elelen);
-        RedisModule_DigestAddStringBuffer(md, (unsigned char *)eleptr, elelen);
-        sds score_str = mscore2String(score);
+    for (zn = o->zsl->header->level[0].forward; zn != NULL; zn = zn->level[0].forward) {
+        sds ele = zn->ele;
+        scoretype *score = zn->score;
+        RedisModule_DigestAddStringBuffer(md, (unsigned char *)ele, sdslen(ele));
+        sds score_str = mscore2String(score, o->types);
         RedisModule_DigestAddStringBuffer(md, (unsigned char *)score_str, sdslen(score_str));
         m_sdsfree(score_str);
         RedisModule_DigestEndSequence(md);
     }
-
-    m_dictReleaseIterator(di);
 }
 
 size_t TairZsetTypeFreeEffort(RedisModuleString *key, const void *value) {
@@ -2659,6 +4309,7 @@ int Module_CreateCommands(RedisModuleCtx *ctx) {
     CREATE_ROCMD("exzscore", TairZsetTypeZscore_RedisCommand)
     CREATE_ROCMD("exzrange", TairZsetTypeZrange_RedisCommand)
     CREATE_ROCMD("exzrevrange", TairZsetTypeZrevrange_RedisCommand)
+    CREATE_ROCMD("exzrangearound", TairZsetTypeZrangearound_RedisCommand)
     CREATE_ROCMD("exzrangebyscore", TairZsetTypeZrangebyscore_RedisCommand)
     CREATE_ROCMD("exzrevrangebyscore", TairZsetTypeZrevrangebyscore_RedisCommand)
     CREATE_ROCMD("exzrangebylex", TairZsetTypeZrangebylex_RedisCommand)
@@ -2681,16 +4332,56 @@ int Module_CreateCommands(RedisModuleCtx *ctx) {
     return REDISMODULE_OK;
 }
 
-int __attribute__ ((visibility ("default"))) RedisModule_OnLoad(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
-    REDISMODULE_NOT_USED(argv);
-    REDISMODULE_NOT_USED(argc);
+/* Parse the module load arguments, given as name/value pairs:
+ * tairzset-max-listpack-entries <count> tairzset-max-listpack-value <bytes>
+ * tairzset-rdb-load-threads <count>
+ * tairzset-rdb-load-threads-min-elements <count> */
+static int Module_ParseArgs(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    long long value;
+
+    if (argc % 2) {
+        RedisModule_Log(ctx, "warning", "Module arguments must be name/value pairs");
+        return REDISMODULE_ERR;
+    }
+
+    for (int i = 0; i < argc; i += 2) {
+        if (RedisModule_StringToLongLong(argv[i + 1], &value) != REDISMODULE_OK || value < 0) {
+            RedisModule_Log(ctx, "warning", "Invalid value for module argument '%s'", RedisModule_StringPtrLen(argv[i], NULL));
+            return REDISMODULE_ERR;
+        }
+
+        if (!mstringcasecmp(argv[i], "tairzset-max-listpack-entries")) {
+            tairzset_max_listpack_entries = value;
+        } else if (!mstringcasecmp(argv[i], "tairzset-max-listpack-value")) {
+            tairzset_max_listpack_value = value;
+        } else if (!mstringcasecmp(argv[i], "tairzset-rdb-load-threads")) {
+            if (value > TAIRZSET_RDB_MAX_LOAD_THREADS) {
+                RedisModule_Log(ctx, "warning", "tairzset-rdb-load-threads must be at most %d", TAIRZSET_RDB_MAX_LOAD_THREADS);
+                return REDISMODULE_ERR;
+            }
+            tairzset_rdb_load_threads = value;
+        } else if (!mstringcasecmp(argv[i], "tairzset-rdb-load-threads-min-elements")) {
+            tairzset_rdb_load_threads_min_elements = value;
+        } else {
+            RedisModule_Log(ctx, "warning", "Unknown module argument '%s'", RedisModule_StringPtrLen(argv[i], NULL));
+            return REDISMODULE_ERR;
+        }
+    }
+
+    return REDISMODULE_OK;
+}
 
+int __attribute__ ((visibility ("default"))) RedisModule_OnLoad(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
     if (RedisModule_Init(ctx, "tairzset", 1, REDISMODULE_APIVER_1) == REDISMODULE_ERR) {
         return REDISMODULE_ERR;
     }
 
-    shared_minstring = RedisModule_CreateString(ctx, "minstring", strlen("minstring"));
-    shared_maxstring = RedisModule_CreateString(ctx, "maxstring", strlen("maxstring"));
+    if (Module_ParseArgs(ctx, argv, argc) == REDISMODULE_ERR) {
+        return REDISMODULE_ERR;
+    }
+
+    shared_minstring = m_sdsnew("minstring");
+    shared_maxstring = m_sdsnew("maxstring");
 
     RedisModuleTypeMethods tm = {.version = REDISMODULE_TYPE_METHOD_VERSION,
                                  .rdb_load = TairZsetTypeRdbLoad,
@@ -2701,7 +4392,7 @@ int __attribute__ ((visibility ("default"))) RedisModule_OnLoad(RedisModuleCtx *
                                  .digest = TairZsetTypeDigest,
                                  .free_effort = TairZsetTypeFreeEffort};
 
-    TairZsetType = RedisModule_CreateDataType(ctx, "tairzset_", TAIRZSET_ENCVER_VER_1, &tm);
+    TairZsetType = RedisModule_CreateDataType(ctx, "tairzset_", TAIRZSET_ENCVER_VER_4, &tm);
     if (TairZsetType == NULL) {
         return REDISMODULE_ERR;
     }
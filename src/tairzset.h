@@ -22,36 +22,46 @@
 #include "util.h"
 
 #include <string.h>
+
+/* TairZset encodings. Small sorted sets are stored in a single listpack,
+ * bigger ones in a skiplist plus a hash index mapping members to nodes. */
+#define TAIRZSET_ENCODING_SKIPLIST 0
+#define TAIRZSET_ENCODING_LISTPACK 1
+
 typedef struct TairZsetObj {
-    dict *dict;
-    m_zskiplist *zsl;
+    unsigned char encoding;
+    unsigned char score_num; /* schema, number of dimensions of every score */
+    unsigned char *types;    /* MSCORE_TYPE_* of every dimension, NULL if all doubles */
+    unsigned char *zl;       /* TAIRZSET_ENCODING_LISTPACK */
+    m_zindex *index;         /* TAIRZSET_ENCODING_SKIPLIST */
+    m_zskiplist *zsl;        /* TAIRZSET_ENCODING_SKIPLIST */
 } TairZsetObj;
 
-uint64_t dictModuleStrHash(const void *key) {
-    size_t len;
-    const char *buf = RedisModule_StringPtrLen(key, &len);
-    return m_dictGenHashFunction(buf, (int)len);
+uint64_t dictSdsHash(const void *key) {
+    return m_dictGenHashFunction(key, (int)sdslen((sds)key));
 }
 
-int dictModuleStrKeyCompare(void *privdata, const void *key1,
-                            const void *key2) {
+int dictSdsKeyCompare(void *privdata, const void *key1,
+                      const void *key2) {
     size_t l1, l2;
     DICT_NOTUSED(privdata);
 
-    const char *buf1 = RedisModule_StringPtrLen(key1, &l1);
-    const char *buf2 = RedisModule_StringPtrLen(key2, &l2);
+    l1 = sdslen((sds)key1);
+    l2 = sdslen((sds)key2);
     if (l1 != l2) return 0;
-    return memcmp(buf1, buf2, l1) == 0;
+    return memcmp(key1, key2, l1) == 0;
 }
 
+/* Temporary sets of members (EXZRANDMEMBER, EXZUNION accumulator). */
 m_dictType tairZsetDictType = {
-    dictModuleStrHash,       /* hash function */
-    NULL,                    /* key dup */
-    NULL,                    /* val dup */
-    dictModuleStrKeyCompare, /* key compare */
-    NULL,                    /* Note: RedisModleString shared & freed by skiplist */
-    NULL                     /* val destructor */
+    dictSdsHash,       /* hash function */
+    NULL,              /* key dup */
+    NULL,              /* val dup */
+    dictSdsKeyCompare, /* key compare */
+    NULL,              /* Note: SDS string owned by the caller */
+    NULL               /* val destructor */
 };
 
+long exZsetRank(TairZsetObj *zobj, RedisModuleString *ele, int reverse, int byscore, scoretype *return_score);
 int parse_score(const char * buf, size_t len, scoretype *score);
 int score_cmp(double *s1, double *s2, unsigned char num);
\ No newline at end of file
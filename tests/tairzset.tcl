@@ -510,6 +510,335 @@ start_server {tags {"tairzset"} overrides {bind 0.0.0.0}} {
         assert_equal 1000 [r exzcard tairzsetkey]
     }
 
+    test "EXZADD small key grows past listpack limits" {
+        r del tairzsetkey
+        set expected {}
+        for {set j 199} {$j >= 0} {incr j -1} {
+            r exzadd tairzsetkey $j#[expr {$j % 3}] m$j
+        }
+        for {set j 0} {$j < 200} {incr j} {
+            lappend expected m$j
+        }
+        assert_equal 200 [r exzcard tairzsetkey]
+        assert_equal $expected [r exzrange tairzsetkey 0 -1]
+        assert_equal {m10 10#1} [r exzrange tairzsetkey 10 10 withscores]
+        assert_equal 190 [r exzremrangebyrank tairzsetkey 10 -1]
+        assert_equal {m0 m1 m2 m3 m4 m5 m6 m7 m8 m9} [r exzrange tairzsetkey 0 -1]
+
+        r del tairzsetkey
+        r exzadd tairzsetkey 1 a 2 b
+        set long [string repeat x 100]
+        r exzadd tairzsetkey 1.5 $long
+        assert_equal [list a $long b] [r exzrange tairzsetkey 0 -1]
+        assert_equal 1.5 [r exzscore tairzsetkey $long]
+    }
+
+    test "EXZADD binary and long members in a skiplist" {
+        r del tairzsetkey
+        create_big_tairzset tairzsetkey 200
+        set huge [string repeat y 300]
+        r exzadd tairzsetkey -1#0#0 "a\x00b" -1#0#0 "a" -1#0#0 "a\x00" -1#0#0 $huge
+        assert_equal [list a "a\x00" "a\x00b" $huge] [r exzrange tairzsetkey 0 3]
+        assert_equal 3 [r exzrank tairzsetkey $huge]
+        assert_equal 2 [r exzrank tairzsetkey "a\x00b"]
+        r exzincrby tairzsetkey 5001#0#0 $huge
+        assert_equal 5000#0#0 [r exzscore tairzsetkey $huge]
+        assert_equal 1 [r exzrem tairzsetkey $huge]
+        assert_equal {} [r exzscore tairzsetkey $huge]
+    }
+
+    test "EXZADD signed zeros and infinities in a skiplist" {
+        r del tairzsetkey
+        create_big_tairzset tairzsetkey 200
+        r exzadd tairzsetkey -0#1#0 b 0#1#0 a 0#0#0 c -inf#5#0 m inf#-inf#0 z
+        assert_equal {m 0 c a b} [r exzrange tairzsetkey 0 4]
+        assert_equal {a b} [r exzrangebyscore tairzsetkey 0#1#0 0#1#0]
+        assert_equal 0 [r exzrevrank tairzsetkey z]
+        assert_equal 4 [r exzcount tairzsetkey (-inf#5#0 0#1#0]
+    }
+
+    test "EXZADD SCHEMA with int and float dimensions" {
+        r del tairzsetkey
+        assert_equal 2 [r exzadd tairzsetkey schema int#float 9223372036854775807#0.1 a -3#1.5 b]
+        assert_equal 9223372036854775807#0.1 [r exzscore tairzsetkey a]
+        assert_error "*not a valid format*" {r exzadd tairzsetkey 1.5#0 c}
+        assert_error "*not a valid format*" {r exzadd tairzsetkey 1#1e39 c}
+        assert_error "*out of range*" {r exzincrby tairzsetkey 1#0 a}
+        assert_equal 2#1.7 [r exzincrby tairzsetkey 5#0.2 b]
+        assert_error "*does not match*" {r exzadd tairzsetkey schema int#double 1#1 c}
+        r debug reload
+        assert_equal {b 2#1.7 a 9223372036854775807#0.1} [r exzrange tairzsetkey 0 -1 withscores]
+    }
+
+    foreach {type filler} {listpack 0 skiplist 200} {
+        test "EXZADD SCHEMA int dimensions are exact 64 bit integers - $type" {
+            r del tairzsetkey dstkey dblkey
+            for {set i 0} {$i < $filler} {incr i} {
+                r exzadd tairzsetkey schema int#double [expr {$i * 1000003}]#$i filler$i
+            }
+            r exzadd tairzsetkey schema int#double 9223372036854775807#0 max -9223372036854775808#0 min \
+                9007199254740993#0 odd 9007199254740992#0 even
+            assert_equal 9007199254740993#0 [r exzscore tairzsetkey odd]
+            assert_equal -9223372036854775808#0 [r exzscore tairzsetkey min]
+            assert_equal 1 [expr {[r exzrank tairzsetkey odd] - [r exzrank tairzsetkey even]}]
+            assert_equal 0 [r exzrevrank tairzsetkey max]
+            assert_equal 0 [r exzrank tairzsetkey min]
+
+            # Increments are exact and fail when they overflow.
+            assert_error "*out of range*" {r exzincrby tairzsetkey 1#0 max}
+            assert_error "*out of range*" {r exzincrby tairzsetkey -1#0 min}
+            assert_equal 9007199254740993#0 [r exzincrby tairzsetkey 1#0 even]
+            assert_equal 2 [r exzcount tairzsetkey 9007199254740993#0 9007199254740993#0]
+
+            # Infinite bounds are the ends of the int dimensions.
+            assert_equal {max} [r exzrangebyscore tairzsetkey (9007199254740993#0 +inf#inf]
+            assert_equal {min} [r exzrangebyscore tairzsetkey -inf#-inf -9223372036854775808#0]
+            assert_equal [r exzcard tairzsetkey] [r exzcount tairzsetkey -inf#-inf inf#inf]
+            assert_error "*not a float*" {r exzcount tairzsetkey 1.5#0 2#0}
+
+            # Set operations keep the schema and saturate, mixing it with
+            # another one gives doubles.
+            assert_equal [r exzcard tairzsetkey] [r exzunionstore dstkey 2 tairzsetkey tairzsetkey]
+            assert_equal 9223372036854775807#0 [r exzscore dstkey max]
+            assert_equal 18014398509481986#0 [r exzscore dstkey odd]
+            r exzunionstore dstkey 1 tairzsetkey weights 0.5
+            assert_equal 4503599627370497#0 [r exzscore dstkey odd]
+            r exzadd dblkey 1.5#1 odd
+            r exzunionstore dstkey 2 tairzsetkey dblkey
+            assert_equal 9007199254740994#1 [r exzscore dstkey odd]
+            assert_equal 9.223372036854776e+18#0 [r exzscore dstkey max]
+
+            assert_equal 1 [r exzadd tairzsetkey binary [binary format wq -5 0.5] bin]
+            assert_equal -5#0.5 [r exzscore tairzsetkey bin]
+
+            r debug reload
+            assert_equal 9007199254740993#0 [r exzscore tairzsetkey odd]
+            assert_equal {min -9223372036854775808#0} [r exzrange tairzsetkey 0 0 withscores]
+            assert_equal {max 9223372036854775807#0} [r exzrevrange tairzsetkey 0 0 withscores]
+        }
+    }
+
+    test "EXZADD BINARY scores" {
+        r del tairzsetkey
+        assert_equal 2 [r exzadd tairzsetkey binary [binary format q2 {1.5 2}] a [binary format q2 {-1 0.5}] b]
+        assert_equal {b -1#0.5 a 1.5#2} [r exzrange tairzsetkey 0 -1 withscores]
+        assert_equal 2.5#3 [r exzadd tairzsetkey binary incr [binary format q2 {1 1}] a]
+        assert_error "*not a valid format*" {r exzadd tairzsetkey binary [binary format q 1] c}
+        assert_error "*not a valid format*" {r exzadd tairzsetkey binary abc c}
+    }
+
+    foreach {type len} {listpack 10 skiplist 200} {
+        test "EXZADD/EXZINCRBY WITHRANK - $type" {
+            create_big_tairzset tairzsetkey $len
+            set top [expr {$len - 1}]
+            assert_equal {1 3} [r exzadd tairzsetkey withrank 2.5#0#0 x]
+            assert_equal [list 0 [expr {$len - 3}]] [r exzadd tairzsetkey withrevrank 2.5#0#0 x]
+            assert_equal [list 0 $len] [r exzadd tairzsetkey withrank 1000#0#0 x]
+            assert_equal {0 {}} [r exzadd tairzsetkey xx withrank 1#0#0 nosuchmember]
+            assert_equal [list 0 $len] [r exzadd tairzsetkey nx withrank 1#0#0 x]
+            assert_equal {-1#0#0 0} [r exzincrby tairzsetkey -1001#0#0 x withrank]
+            assert_equal [list 2000#0#0 0] [r exzadd tairzsetkey incr withrevrank 2001#0#0 x]
+            assert_equal [list $top#$top#$top 1] [r exzincrby tairzsetkey 0#0#0 $top withrevrank]
+            assert_error "*single*" {r exzadd tairzsetkey withrank 1#0#0 a 2#0#0 b}
+            assert_error "*not compatible*" {r exzadd tairzsetkey withrank withrevrank 1#0#0 a}
+            assert_error "*syntax*" {r exzincrby tairzsetkey 1#0#0 a withscores}
+        }
+
+        test "EXZRANGEAROUND - $type" {
+            create_big_tairzset tairzsetkey $len
+            set top [expr {$len - 1}]
+            assert_equal {3 4 5 6} [r exzrangearound tairzsetkey 5 2 1]
+            assert_equal {7 6 5 4} [r exzrangearound tairzsetkey 5 2 1 rev]
+            assert_equal {0 1} [r exzrangearound tairzsetkey 0 10 1]
+            assert_equal [list [expr {$top - 1}] $top] [r exzrangearound tairzsetkey $top 1 10]
+            assert_equal {1 1#1#1 2 2#2#2} [r exzrangearound tairzsetkey 1 0 1 withscores]
+            assert_equal [r exzrange tairzsetkey 0 -1] [r exzrangearound tairzsetkey 3 1000 1000]
+            assert_equal {} [r exzrangearound tairzsetkey nosuchmember 1 1]
+            assert_equal {} [r exzrangearound nosuchkey 1 1 1]
+            assert_error "*out of range*" {r exzrangearound tairzsetkey 1 -1 1}
+            assert_error "*syntax*" {r exzrangearound tairzsetkey 1 1 1 limit}
+        }
+
+        test "EXZRANGE/EXZRANGEBYSCORE AFTER token pagination - $type" {
+            create_big_tairzset tairzsetkey $len
+            # Page through the whole set, resuming after the last element.
+            set all {}
+            set page [r exzrange tairzsetkey 0 2 withscores]
+            while {[llength $page]} {
+                foreach {ele score} $page {lappend all $ele}
+                set page [r exzrange tairzsetkey 0 2 withscores after $score $ele]
+            }
+            assert_equal [r exzrange tairzsetkey 0 -1] $all
+
+            # The token does not need to be in the set anymore.
+            r exzrem tairzsetkey 4
+            assert_equal {5 6} [r exzrange tairzsetkey 0 1 after 4#4#4 4]
+            assert_equal {3 2} [r exzrevrange tairzsetkey 0 1 after 4#4#4 4]
+            assert_equal {6 7} [r exzrange tairzsetkey 1 2 after 4#4#4 4]
+            assert_equal [list [expr {$len - 1}]] [r exzrange tairzsetkey -1 -1 after 4#4#4 4]
+            assert_equal {5 5#5#5} [r exzrangebyscore tairzsetkey 0#0#0 +inf#0#0 withscores limit 0 1 after 4#4#4 4]
+            assert_equal {6 7} [r exzrangebyscore tairzsetkey 6#0#0 8#0#0 after 3#3#3 3]
+            assert_equal {7} [r exzrangebyscore tairzsetkey 5#0#0 8#0#0 limit 1 5 after 5#5#5 5]
+            assert_equal {3 2} [r exzrevrangebyscore tairzsetkey +inf#0#0 0#0#0 limit 0 2 after 4#4#4 4]
+            assert_equal {} [r exzrevrangebyscore tairzsetkey +inf#0#0 0#0#0 after 0#0#0 0]
+            assert_error "*not a valid format*" {r exzrange tairzsetkey 0 1 after 4 4}
+            assert_error "*syntax*" {r exzrange tairzsetkey 0 1 after 4#4#4}
+        }
+    }
+
+    test "EXZRANGEBYSCORE/EXZRANGEBYLEX LIMIT with deep offsets in a skiplist" {
+        create_big_tairzset tairzsetkey 300
+        assert_equal {150 151} [r exzrangebyscore tairzsetkey 10#0#0 +inf#0#0 limit 140 2]
+        assert_equal {148 147} [r exzrevrangebyscore tairzsetkey 289#0#0 -inf#0#0 limit 140 2]
+        assert_equal {299} [r exzrangebyscore tairzsetkey 0#0#0 +inf#0#0 limit 299 5]
+        assert_equal {} [r exzrangebyscore tairzsetkey 0#0#0 +inf#0#0 limit 300 5]
+        assert_equal {} [r exzrangebyscore tairzsetkey 0#0#0 200#0#0 limit 250 5]
+        assert_equal {} [r exzrangebyscore tairzsetkey 0#0#0 +inf#0#0 limit -1 5]
+        r del tairzsetkey
+        for {set i 100} {$i < 400} {incr i} {
+            r exzadd tairzsetkey 0 m$i
+        }
+        assert_equal {m250 m251} [r exzrangebylex tairzsetkey {[m110} + limit 140 2]
+        assert_equal {m249 m248} [r exzrevrangebylex tairzsetkey {(m390} - limit 140 2]
+        assert_equal {} [r exzrangebylex tairzsetkey - + limit 300 1]
+    }
+
+    test "EXZADD monotonic and near tail inserts in a skiplist" {
+        r del tairzsetkey
+        set expected {}
+        for {set i 0} {$i < 1000} {incr i} {
+            r exzadd tairzsetkey [expr {$i * 10}] m$i
+            # Every tenth insert lands a few elements before the tail.
+            if {$i % 10 == 9} {r exzadd tairzsetkey [expr {$i * 10 - 45}] n$i}
+        }
+        for {set i 0} {$i < 1000} {incr i} {
+            lappend expected m$i
+            if {$i % 10 == 4} {lappend expected n[expr {$i + 5}]}
+        }
+        assert_equal $expected [r exzrange tairzsetkey 0 -1]
+        foreach j {0 5 123 550 999} {
+            assert_equal $j [r exzrank tairzsetkey [lindex $expected $j]]
+        }
+        r exzremrangebyrank tairzsetkey -50 -1
+        r exzadd tairzsetkey 100000 last
+        assert_equal [expr {[llength $expected] - 50}] [r exzrank tairzsetkey last]
+    }
+
+    test "EXZADD many pairs with repeated and existing members in a skiplist" {
+        r del tairzsetkey
+        create_big_tairzset tairzsetkey 200
+        set args {}
+        for {set i 0} {$i < 100} {incr i} {
+            lappend args [expr {199 - $i}]#0#0 new$i [expr {$i * 2}]#0#0 $i
+        }
+        lappend args 7#0#0 new3 7#0#0 new3 5000#0#0 new4
+        assert_equal 100 [r exzadd tairzsetkey {*}$args]
+        assert_equal 300 [r exzcard tairzsetkey]
+        assert_equal 7#0#0 [r exzscore tairzsetkey new3]
+        assert_equal 299 [r exzrank tairzsetkey new4]
+        assert_equal 0 [r exzadd tairzsetkey ch nx {*}$args]
+        assert_equal 4 [r exzadd tairzsetkey ch xx {*}$args]
+        set range [r exzrange tairzsetkey 0 -1 withscores]
+        r debug reload
+        assert_equal $range [r exzrange tairzsetkey 0 -1 withscores]
+    }
+
+    test "RDB save/load small and big keys" {
+        create_tairzset smallkey {1#1 a 1#0 b 2#5 c}
+        create_big_tairzset bigkey 300
+        set small [r exzrange smallkey 0 -1 withscores]
+        set big [r exzrange bigkey 0 -1 withscores]
+        r debug reload
+        assert_equal $small [r exzrange smallkey 0 -1 withscores]
+        assert_equal $big [r exzrange bigkey 0 -1 withscores]
+        assert_equal 1 [r exzrank smallkey a]
+        assert_equal 150 [r exzrank bigkey [lindex $big 300]]
+        assert_equal 10 [r exzrevrank bigkey [lindex $big 578]]
+        r exzadd bigkey -1#0#0 first 1000#0#0 last
+        assert_equal 0 [r exzrank bigkey first]
+        assert_equal 301 [r exzrank bigkey last]
+    }
+
+    test "RDB save/load keys of several blocks and random scores" {
+        # More elements than a block holds, random scores stored as raw
+        # columns and a member longer than a block in the skiplist key.
+        r del bigkey smallkey
+        set args {}
+        for {set i 0} {$i < 3000} {incr i} {
+            lappend args [expr {rand() * 1e6 - 5e5}]#[expr {rand()}]#[expr {int(rand() * 100)}] m$i
+            if {[llength $args] == 200} {
+                r exzadd bigkey {*}$args
+                set args {}
+            }
+        }
+        set longmember [string repeat x 70000]
+        r exzadd bigkey 0#0#0 $longmember 1e300#-1e-300#-0.5 last
+        for {set i 0} {$i < 50} {incr i} {
+            r exzadd smallkey [expr {rand()}]#[expr {rand() * 1e10}] s$i
+        }
+        set big [r exzrange bigkey 0 -1 withscores]
+        set small [r exzrange smallkey 0 -1 withscores]
+        set digest [r debug digest]
+        r debug reload
+        assert_equal $digest [r debug digest]
+        assert_equal $big [r exzrange bigkey 0 -1 withscores]
+        assert_equal $small [r exzrange smallkey 0 -1 withscores]
+        assert_equal 3002 [r exzcard bigkey]
+        assert_equal 0#0#0 [r exzscore bigkey $longmember]
+        assert_equal [lsearch -exact $big $longmember] [expr {[r exzrank bigkey $longmember] * 2}]
+        assert_equal 3001 [r exzrank bigkey last]
+        assert_equal 1 [r exzrem bigkey $longmember]
+        assert_equal 3001 [r exzcard bigkey]
+    }
+
+    proc wide_score {pos value} {
+        set dims [lrepeat 10 1]
+        lset dims $pos $value
+        join $dims #
+    }
+
+    foreach {type filler} {listpack 0 skiplist 200} {
+        test "Scores of 10 dimensions - $type" {
+            # Two blocks of four dimensions for the vector kernels and a
+            # tail of two for the scalar code.
+            r del widekey dstkey u1 u2
+            for {set i 0} {$i < $filler} {incr i} {
+                r exzadd widekey [wide_score 0 [expr {$i + 100}]] filler$i
+            }
+            r exzadd widekey [wide_score 0 1] c [wide_score 9 0] a [wide_score 5 0] b \
+                [wide_score 4 2] d [wide_score 0 0] e [wide_score 8 2] f
+            assert_equal {e b a c f d} [r exzrange widekey 0 5]
+            assert_equal 2 [r exzrank widekey a]
+            assert_equal 4 [r exzrank widekey f]
+            assert_equal {b a c} [r exzrangebyscore widekey [wide_score 5 0] [wide_score 0 1]]
+
+            # A NaN in the tail or in a block fails and leaves the score alone.
+            r exzadd widekey [wide_score 9 -inf] n
+            assert_error "*NaN*" {r exzincrby widekey [wide_score 9 inf] n}
+            assert_equal 2#2#2#2#2#2#inf#2#2#-inf [r exzincrby widekey [wide_score 6 inf] n]
+            assert_error "*NaN*" {r exzincrby widekey [wide_score 6 -inf] n}
+            assert_equal 2#2#2#2#2#2#inf#2#2#-inf [r exzscore widekey n]
+
+            # NaN dimensions of the aggregated scores become 0.
+            r exzadd u1 [wide_score 6 inf] x [wide_score 9 -inf] y
+            assert_equal 2 [r exzunionstore dstkey 1 u1 weights 0]
+            assert_equal {x 0#0#0#0#0#0#0#0#0#0 y 0#0#0#0#0#0#0#0#0#0} [r exzrange dstkey 0 -1 withscores]
+            r exzadd u2 [wide_score 6 -inf] x
+            assert_equal 2 [r exzunionstore dstkey 2 u1 u2]
+            assert_equal {y 1#1#1#1#1#1#1#1#1#-inf x 2#2#2#2#2#2#0#2#2#2} [r exzrange dstkey 0 -1 withscores]
+        }
+    }
+
+    test "EXZUNIONSTORE/EXZINTERSTORE small result" {
+        create_big_tairzset bigkey 300
+        create_tairzset smallkey {1#1#1 1 200#200#200 200 7#7#7 x}
+        assert_equal 2 [r exzinterstore dstkey 2 bigkey smallkey]
+        assert_equal {1 2#2#2 200 400#400#400} [r exzrange dstkey 0 -1 withscores]
+        assert_equal {1 2#2#2} [r exzpopmin dstkey]
+        assert_equal 301 [r exzunionstore dstkey 2 bigkey smallkey]
+        assert_equal 7#7#7 [r exzscore dstkey x]
+    }
+
     set elements 128
     test "EXZRANGEBYSCORE fuzzy test, 100 ranges in $elements element sorted set" {
         set err {}
@@ -835,9 +1164,24 @@ start_server {tags {"tairzset"} overrides {bind 0.0.0.0}} {
         r del exzmscoretest
         r exzadd exzmscoretest 10#1.1 x
 
-        assert_equal {10#1.1000000000000001 {}} [r exzmscore exzmscoretest x y]
+        assert_equal {10#1.1 {}} [r exzmscore exzmscoretest x y]
     } 
 
+    test "EXZSCORE and WITHSCORES native replies with RESP3" {
+        r del exzmscoretest
+        r exzadd exzmscoretest 1.5 x 2.5 y
+        r del exzmscoretest2
+        r exzadd exzmscoretest2 schema int#double 3#0.5 x
+        # HELLO is not supported before Redis 6.0
+        if {![catch {r hello 3}]} {
+            assert_equal 1.5 [r exzscore exzmscoretest x]
+            assert_equal {x 1.5 y 2.5} [r exzrange exzmscoretest 0 -1 withscores]
+            assert_equal {3 0.5} [r exzscore exzmscoretest2 x]
+            r hello 2
+        }
+        assert_equal 3#0.5 [r exzscore exzmscoretest2 x]
+    }
+
     test "EXZMSCORE retrieve single member" {
         r del exzmscoretest
         r exzadd exzmscoretest 10 x
@@ -1533,6 +1877,45 @@ start_server {tags {"tairzset"} overrides {bind 0.0.0.0}} {
     }
 }
 
+start_server {tags {"tairzset"} overrides {bind 0.0.0.0}} {
+    # Decode keys from 1000 elements with 3 threads, reading batches of
+    # 3 * 4 blocks of 1024 elements.
+    r module load $testmodule tairzset-rdb-load-threads 3 tairzset-rdb-load-threads-min-elements 1000
+
+    test "RDB load with threads of keys of several batches" {
+        foreach {key len} {bigkey 30000 onebatch 1000 nothreads 999} {
+            r del $key
+            set args {}
+            for {set i 0} {$i < $len} {incr i} {
+                lappend args [expr {int(rand() * 1000)}]#[expr {rand()}] m$i
+                if {[llength $args] == 1000 || $i == $len - 1} {
+                    r exzadd $key {*}$args
+                    set args {}
+                }
+            }
+        }
+        r exzadd bigkey 0#0 [string repeat x 70000]
+        foreach key {bigkey onebatch nothreads} {
+            set range($key) [r exzrange $key 0 -1 withscores]
+        }
+        set digest [r debug digest]
+        r debug reload
+        assert_equal $digest [r debug digest]
+        foreach key {bigkey onebatch nothreads} {
+            assert_equal $range($key) [r exzrange $key 0 -1 withscores]
+            set len [expr {[llength $range($key)] / 2}]
+            foreach rank [list 0 1 [expr {$len / 2}] [expr {$len - 1}]] {
+                assert_equal $rank [r exzrank $key [lindex $range($key) [expr {$rank * 2}]]]
+            }
+        }
+        assert_equal 30001 [r exzcard bigkey]
+        r exzadd bigkey -1#0 first
+        assert_equal 0 [r exzrank bigkey first]
+        assert_equal 1 [r exzrem bigkey m29999]
+        assert_equal 30001 [r exzcard bigkey]
+    }
+}
+
 start_server {tags {"repl test"} overrides {bind 0.0.0.0}} {
     r module load $testmodule
     set slave [srv 0 client]